@@ -0,0 +1,75 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include "allocstats.h"
+
+namespace
+{
+    std::atomic<uint64_t> g_Allocations{0};
+    std::atomic<uint64_t> g_Bytes{0};
+    std::atomic<int64_t> g_LiveBytes{0};
+
+    // Each block is prefixed with its size so frees can be accounted for
+    constexpr size_t kHeader = alignof(std::max_align_t);
+
+    void* trackedAlloc(size_t size)
+    {
+        void* block = std::malloc(size + kHeader);
+        if(!block)
+            throw std::bad_alloc();
+        *static_cast<size_t*>(block) = size;
+        g_Allocations.fetch_add(1, std::memory_order_relaxed);
+        g_Bytes.fetch_add(size, std::memory_order_relaxed);
+        g_LiveBytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+        return static_cast<char*>(block) + kHeader;
+    }
+
+    void trackedFree(void* address)
+    {
+        if(!address)
+            return;
+        void* block = static_cast<char*>(address) - kHeader;
+        g_LiveBytes.fetch_sub(static_cast<int64_t>(*static_cast<size_t*>(block)), std::memory_order_relaxed);
+        std::free(block);
+    }
+}
+
+AllocStats allocStats()
+{
+    AllocStats stats;
+    stats.mAllocations = g_Allocations.load(std::memory_order_relaxed);
+    stats.mBytes = g_Bytes.load(std::memory_order_relaxed);
+    stats.mLiveBytes = g_LiveBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void* operator new(size_t size)
+{
+    return trackedAlloc(size);
+}
+
+void* operator new[](size_t size)
+{
+    return trackedAlloc(size);
+}
+
+void operator delete(void* address) noexcept
+{
+    trackedFree(address);
+}
+
+void operator delete[](void* address) noexcept
+{
+    trackedFree(address);
+}
+
+void operator delete(void* address, size_t) noexcept
+{
+    trackedFree(address);
+}
+
+void operator delete[](void* address, size_t) noexcept
+{
+    trackedFree(address);
+}
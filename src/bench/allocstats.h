@@ -0,0 +1,16 @@
+#ifndef ALLOCSTATS_H
+#define ALLOCSTATS_H
+#include <cstdint>
+
+// Counters fed by the global operator new/delete replacement in
+// allocstats.cpp. Only covers C++ allocations, not malloc.
+struct AllocStats
+{
+    uint64_t mAllocations = 0;
+    uint64_t mBytes = 0;
+    int64_t mLiveBytes = 0;
+};
+
+AllocStats allocStats();
+
+#endif // ALLOCSTATS_H
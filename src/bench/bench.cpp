@@ -0,0 +1,164 @@
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <sys/resource.h>
+#include "bench.h"
+
+namespace
+{
+    struct BenchResult
+    {
+        std::string mName;
+        size_t mIterations;
+        double mSeconds;
+        size_t mBytes;
+        AllocStats mAllocs;
+        uint64_t mPeakRSS;
+    };
+
+    struct BenchValue
+    {
+        std::string mName;
+        double mValue;
+        std::string mUnit;
+    };
+
+    std::vector<BenchResult> g_Results;
+    std::vector<BenchValue> g_Values;
+
+    double msPerIteration(const BenchResult& result)
+    {
+        return result.mIterations ? (result.mSeconds * 1000.0) / result.mIterations : 0.0;
+    }
+
+    double mbPerSecond(const BenchResult& result)
+    {
+        return result.mSeconds > 0 ? (result.mBytes / (1024.0 * 1024.0)) / result.mSeconds : 0.0;
+    }
+
+    double allocsPerIteration(const BenchResult& result)
+    {
+        return result.mIterations ? double(result.mAllocs.mAllocations) / result.mIterations : 0.0;
+    }
+
+    std::string quoted(const std::string& text)
+    {
+        std::string out = "\"";
+        for(char c : text)
+        {
+            if(c == '"' || c == '\\')
+                out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    std::string csvField(const std::string& text)
+    {
+        std::string out = "\"";
+        for(char c : text)
+        {
+            if(c == '"')
+                out += '"';
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    std::ofstream openReport(const std::string& filename)
+    {
+        std::ofstream file(filename, std::ios::out | std::ios::trunc);
+        if (!file || !file.is_open())
+            throw std::runtime_error("Failed to open " + filename + " for writing.");
+        return file;
+    }
+}
+
+void reportResult(const std::string& name, const BenchTimer& timer, size_t iterations, size_t bytes)
+{
+    BenchResult result{name, iterations, timer.seconds(), bytes, timer.allocations(), peakRSS()};
+    g_Results.push_back(result);
+
+    if(bytes)
+        printf("%-48s %10.4f ms/iter %10.2f MB/s %10.1f allocs/iter\n", name.c_str(),
+               msPerIteration(result), mbPerSecond(result), allocsPerIteration(result));
+    else
+        printf("%-48s %10.4f ms/iter %16s %10.1f allocs/iter\n", name.c_str(),
+               msPerIteration(result), "", allocsPerIteration(result));
+}
+
+void reportValue(const std::string& name, double value, const std::string& unit)
+{
+    g_Values.push_back({name, value, unit});
+    if(std::fabs(value) >= 100)
+        printf("%-48s %10.0f %s\n", name.c_str(), value, unit.c_str());
+    else
+        printf("%-48s %10.4f %s\n", name.c_str(), value, unit.c_str());
+}
+
+uint32_t nextRandom(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+uint64_t peakRSS()
+{
+    rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    // Linux reports KiB, macOS bytes
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss) / 1024;
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+}
+
+void writeReportJSON(const std::string& filename)
+{
+    std::ofstream file = openReport(filename);
+    file << "{\n  \"peak_rss_kib\": " << peakRSS() << ",\n  \"results\": [";
+    for(size_t i = 0; i < g_Results.size(); i++)
+    {
+        const BenchResult& result = g_Results[i];
+        file << (i ? ",\n" : "\n") << "    {\"name\": " << quoted(result.mName)
+             << ", \"iterations\": " << result.mIterations
+             << ", \"seconds\": " << result.mSeconds
+             << ", \"ms_per_iter\": " << msPerIteration(result)
+             << ", \"bytes\": " << result.mBytes
+             << ", \"mb_per_sec\": " << mbPerSecond(result)
+             << ", \"allocations\": " << result.mAllocs.mAllocations
+             << ", \"allocated_bytes\": " << result.mAllocs.mBytes
+             << ", \"peak_rss_kib\": " << result.mPeakRSS << "}";
+    }
+    file << "\n  ],\n  \"values\": [";
+    for(size_t i = 0; i < g_Values.size(); i++)
+    {
+        const BenchValue& value = g_Values[i];
+        file << (i ? ",\n" : "\n") << "    {\"name\": " << quoted(value.mName)
+             << ", \"value\": " << value.mValue << ", \"unit\": " << quoted(value.mUnit) << "}";
+    }
+    file << "\n  ]\n}\n";
+    if(!file)
+        throw std::runtime_error("Failed to write " + filename + ".");
+}
+
+void writeReportCSV(const std::string& filename)
+{
+    std::ofstream file = openReport(filename);
+    file << "name,iterations,seconds,ms_per_iter,bytes,mb_per_sec,allocations,allocated_bytes,peak_rss_kib,value,unit\n";
+    for(auto& result : g_Results)
+    {
+        file << csvField(result.mName) << ',' << result.mIterations << ',' << result.mSeconds << ','
+             << msPerIteration(result) << ',' << result.mBytes << ',' << mbPerSecond(result) << ','
+             << result.mAllocs.mAllocations << ',' << result.mAllocs.mBytes << ',' << result.mPeakRSS << ",,\n";
+    }
+    for(auto& value : g_Values)
+        file << csvField(value.mName) << ",,,,,,,,," << value.mValue << ',' << csvField(value.mUnit) << '\n';
+    if(!file)
+        throw std::runtime_error("Failed to write " + filename + ".");
+}
@@ -0,0 +1,82 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "allocstats.h"
+
+// Times a run and counts the C++ allocations made during it. stop()
+// freezes both, for when checking the result shouldn't count.
+class BenchTimer
+{
+public:
+    using Clock = std::chrono::high_resolution_clock;
+
+    Clock::time_point mStart;
+    Clock::time_point mStop;
+    AllocStats mStartAllocs;
+    AllocStats mStopAllocs;
+    bool mStopped = false;
+
+    BenchTimer()
+    {
+        reset();
+    };
+
+    void reset()
+    {
+        mStopped = false;
+        mStartAllocs = allocStats();
+        mStart = Clock::now();
+    };
+
+    void stop()
+    {
+        mStop = Clock::now();
+        mStopAllocs = allocStats();
+        mStopped = true;
+    };
+
+    double seconds() const
+    {
+        return std::chrono::duration<double>((mStopped ? mStop : Clock::now()) - mStart).count();
+    };
+
+    AllocStats allocations() const
+    {
+        AllocStats end = mStopped ? mStopAllocs : allocStats();
+        AllocStats stats;
+        stats.mAllocations = end.mAllocations - mStartAllocs.mAllocations;
+        stats.mBytes = end.mBytes - mStartAllocs.mBytes;
+        stats.mLiveBytes = end.mLiveBytes - mStartAllocs.mLiveBytes;
+        return stats;
+    };
+};
+
+// Stops the optimizer from dropping work whose result is otherwise unused
+inline volatile uint64_t g_ResultSink;
+inline void keepResult(uint64_t value)
+{
+    g_ResultSink = value;
+}
+
+// Prints one result line and keeps it for the machine readable report.
+// bytes may be 0 when throughput doesn't apply.
+void reportResult(const std::string& name, const BenchTimer& timer, size_t iterations, size_t bytes = 0);
+// A measurement that isn't a timing, like a count or a memory size
+void reportValue(const std::string& name, double value, const std::string& unit);
+
+// xorshift32, for repeatable filler data and access patterns
+uint32_t nextRandom(uint32_t& state);
+
+// Peak resident set size of the whole process so far, in KiB
+uint64_t peakRSS();
+
+// Everything reported so far. The JSON is one object with a results and a
+// values array, the CSV one row per result or value with empty cells for
+// columns that don't apply. Both throw if the file can't be written.
+void writeReportJSON(const std::string& filename);
+void writeReportCSV(const std::string& filename);
+
+#endif // BENCH_H
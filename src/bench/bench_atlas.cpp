@@ -0,0 +1,163 @@
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "atlaspacker.h"
+#include "bench.h"
+#include "texturelayout.h"
+
+namespace
+{
+    // Mostly item sized sprites with the odd large one, like a patch
+    void randomSize(uint32_t& state, uint16_t& width, uint16_t& height)
+    {
+        bool large = nextRandom(state) % 16 == 0;
+        uint32_t limit = large ? 160 : 64;
+        width = static_cast<uint16_t>(4 + nextRandom(state) % limit);
+        height = static_cast<uint16_t>(4 + nextRandom(state) % limit);
+    }
+
+    // Every cell inside its page, no two overlapping
+    void checkPlacements(const AtlasPacker& packer, const std::vector<AtlasPacker::Placement>& placements)
+    {
+        size_t side = packer.pageSize();
+        std::vector<std::vector<uint8_t>> used(packer.pageCount(), std::vector<uint8_t>(side * side));
+        for(auto& placement : placements)
+        {
+            const AtlasPacker::Rect& cell = placement.mCell;
+            if(placement.mPage >= packer.pageCount() || cell.mX + cell.mWidth > side || cell.mY + cell.mHeight > side
+               || cell.mX % 8 || cell.mY % 8 || placement.mWidth > cell.mWidth || placement.mHeight > cell.mHeight)
+                throw std::runtime_error("Atlas cell out of bounds");
+            for(size_t y = cell.mY; y < cell.mY + cell.mHeight; y++)
+            {
+                for(size_t x = cell.mX; x < cell.mX + cell.mWidth; x++)
+                {
+                    if(used[placement.mPage][y * side + x]++)
+                        throw std::runtime_error("Atlas cells overlap");
+                }
+            }
+        }
+    }
+
+    void reportStats(const std::string& label, const AtlasPacker& packer)
+    {
+        const AtlasPacker::Stats& stats = packer.stats();
+        reportValue(label + " pages", stats.mPages, "pages");
+        reportValue(label + " efficiency", stats.efficiency() * 100.0, "%");
+        reportValue(label + " texels", stats.mPageArea, "texels");
+        reportValue(label + " texels as separate textures", stats.mSeparateArea, "texels");
+    }
+
+    void benchPacking(uint16_t pageSize)
+    {
+        std::string label = "atlas " + std::to_string(pageSize);
+        const uint32_t count = 2000;
+        AtlasPacker packer(pageSize);
+        std::vector<AtlasPacker::Placement> placements;
+        uint32_t state = 12345;
+
+        {
+            BenchTimer timer;
+            for(uint32_t i = 0; i < count; i++)
+            {
+                uint16_t width, height;
+                randomSize(state, width, height);
+                auto placement = packer.insert(width, height);
+                if(!placement)
+                    throw std::runtime_error("Unlimited atlas refused a sprite");
+                placements.push_back(*placement);
+            }
+            reportResult(label + " insert", timer, count);
+        }
+        checkPlacements(packer, placements);
+        reportStats(label + " packed", packer);
+
+        // A dream change: half of it goes, new sprites come in
+        {
+            BenchTimer timer;
+            for(uint32_t i = 0; i < placements.size();)
+            {
+                if(nextRandom(state) % 2)
+                {
+                    packer.remove(placements[i]);
+                    placements[i] = placements.back();
+                    placements.pop_back();
+                }
+                else
+                    i++;
+            }
+            for(uint32_t i = 0; i < count / 2; i++)
+            {
+                uint16_t width, height;
+                randomSize(state, width, height);
+                placements.push_back(*packer.insert(width, height));
+            }
+            reportResult(label + " evict and refill", timer, count / 2);
+        }
+        checkPlacements(packer, placements);
+        reportStats(label + " after churn", packer);
+
+        // A capped atlas says no instead of growing
+        AtlasPacker capped(pageSize, 1);
+        uint32_t fitted = 0;
+        while(capped.insert(32, 32))
+            fitted++;
+        if(fitted != uint32_t(pageSize / 32) * (pageSize / 32) || capped.pageCount() != 1)
+            throw std::runtime_error("Capped atlas packed the wrong number of cells");
+    }
+
+    FOX5Image makeImage(uint16_t width, uint16_t height, FOX5Image::ImageFormat format, uint32_t seed)
+    {
+        FOX5Image image(0, 0, width, height, format);
+        image.mData.resize(image.getMemSize());
+        for(auto& byte : image.mData)
+            byte = static_cast<uint8_t>(nextRandom(seed));
+        return image;
+    }
+
+    // Cells written one at a time must come out as if the whole page had
+    // gone through the client's single texture conversion
+    void checkTiledWrites()
+    {
+        for(auto format : {FOX5Image::ImageFormat::E_32BIT, FOX5Image::ImageFormat::E_8BIT})
+        {
+            FOX5Image image = makeImage(33, 65, format, 7);
+            std::vector<uint8_t> expected = fox5TextureData(image, 64, 128);
+            std::vector<uint8_t> texture(expected.size());
+            writeTiledRect(texture.data(), 64, 128, 0, 0, 64, 128, image, 0xFF);
+            if(texture != expected)
+                throw std::runtime_error("Tiled write differs from fox5TextureData");
+        }
+
+        const uint16_t side = 256;
+        AtlasPacker packer(side, 1);
+        std::vector<uint8_t> page(side * side * 4);
+        FOX5Image composite(0, 0, side, side, FOX5Image::ImageFormat::E_32BIT);
+        composite.mData.assign(side * side * 4, 0);
+        uint32_t seed = 99;
+        for(uint32_t i = 0; i < 40; i++)
+        {
+            uint16_t width, height;
+            randomSize(seed, width, height);
+            auto placement = packer.insert(width, height);
+            if(!placement)
+                break;
+            FOX5Image image = makeImage(width, height, FOX5Image::ImageFormat::E_32BIT, i + 1);
+            writeTiledRect(page.data(), side, side, placement->mCell.mX, placement->mCell.mY,
+                           placement->mCell.mWidth, placement->mCell.mHeight, image);
+            for(uint16_t y = 0; y < height; y++)
+                std::memcpy(&composite.mData[((placement->mCell.mY + y) * side + placement->mCell.mX) * 4],
+                            &image.mData[y * width * 4], width * 4);
+        }
+        if(page != fox5TextureData(composite, side, side))
+            throw std::runtime_error("Atlas page differs from a whole page conversion");
+    }
+}
+
+void benchAtlas(const std::filesystem::path&)
+{
+    checkTiledWrites();
+    benchPacking(256);
+    benchPacking(512);
+}
@@ -0,0 +1,115 @@
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "lrucache.h"
+
+namespace
+{
+    using Cache = LRUCache<uint32_t, uint32_t>;
+
+    void expect(bool condition, const char* what)
+    {
+        if(!condition)
+            throw std::runtime_error(std::string("LRU cache ") + what);
+    }
+
+    void checkCache()
+    {
+        Cache cache(250);
+        cache.insert(1, 1, 100);
+        cache.insert(2, 2, 100);
+        cache.insert(3, 3, 100);
+        expect(!cache.trim(), "evicted something used this frame");
+        expect(cache.stats().mBytes == 300 && cache.stats().mEvictions == 0, "lost a pinned entry");
+
+        // 1 is the oldest until it's used again
+        cache.nextFrame();
+        expect(cache.find(1) && *cache.find(1) == 1, "lost an entry");
+        expect(cache.trim(), "stayed over budget");
+        expect(!cache.find(2) && cache.find(3) && cache.find(1), "evicted the wrong entry");
+        expect(cache.stats().mEvictions == 1 && cache.stats().mBytes == 200, "miscounted an eviction");
+
+        // A refusal is skipped over, not waited on
+        cache.insert(4, 4, 100);
+        cache.nextFrame();
+        cache.find(4);
+        expect(cache.trim([](const uint32_t& key, const uint32_t&) { return key != 3; }), "stayed over budget");
+        expect(cache.find(3) && !cache.find(1), "evicted a refused entry");
+
+        cache.nextFrame();
+        cache.nextFrame();
+        cache.find(4);
+        cache.dropUnused(1, [](const uint32_t&, const uint32_t&) { return true; });
+        expect(!cache.find(3) && cache.find(4) && cache.stats().mEntries == 1, "kept an unused entry");
+
+        const Cache::Stats& stats = cache.stats();
+        expect(stats.mHits == 8 && stats.mMisses == 3 && stats.mEvictions == 3 && stats.mPeakBytes == 300,
+               "miscounted");
+        cache.insert(4, 5, 50);
+        expect(*cache.find(4) == 5 && cache.stats().mBytes == 50, "didn't replace an entry");
+    }
+
+    // A client walking between maps: each frame draws the sprites of the
+    // current scene, which keeps changing, plus the odd one from anywhere
+    void benchWorkload(size_t budget)
+    {
+        const uint32_t images = 4000;
+        const uint32_t sceneSize = 150;
+        const uint32_t frames = 6000;
+        std::vector<size_t> sizes(images);
+        uint32_t state = 7;
+        for(auto& size : sizes)
+        {
+            uint32_t side = 32 << (nextRandom(state) % 3);
+            size = size_t(side) * side * (nextRandom(state) % 2 ? 4 : 2);
+        }
+        std::vector<uint32_t> scene(sceneSize);
+        for(auto& image : scene)
+            image = nextRandom(state) % images;
+
+        Cache cache(budget);
+        uint64_t loadedBytes = 0;
+        BenchTimer timer;
+        for(uint32_t frame = 0; frame < frames; frame++)
+        {
+            // Every couple of seconds a fifth of the scene changes
+            if(frame % 120 == 0)
+            {
+                for(uint32_t i = 0; i < sceneSize / 5; i++)
+                    scene[nextRandom(state) % sceneSize] = nextRandom(state) % images;
+            }
+            for(uint32_t i = 0; i < sceneSize + 4; i++)
+            {
+                uint32_t image = i < sceneSize ? scene[i] : nextRandom(state) % images;
+                if(!cache.find(image))
+                {
+                    cache.insert(image, image, sizes[image]);
+                    loadedBytes += sizes[image];
+                }
+            }
+            cache.nextFrame();
+            cache.trim();
+        }
+        timer.stop();
+        const Cache::Stats& stats = cache.stats();
+        // Only a scene larger than the budget may keep it over
+        if(stats.mBytes > budget && budget >= 4u << 20)
+            throw std::runtime_error("LRU cache ended a frame over budget");
+
+        std::string label = "cache budget " + std::to_string(budget >> 20) + " MiB";
+        reportValue(label + " lookups", (stats.mHits + stats.mMisses) / timer.seconds(), "lookups/s");
+        reportValue(label + " hit rate", stats.hitRate() * 100.0, "%");
+        reportValue(label + " evictions", stats.mEvictions, "textures");
+        reportValue(label + " loaded per frame", loadedBytes / double(frames), "bytes");
+        reportValue(label + " peak", stats.mPeakBytes, "bytes");
+    }
+}
+
+void benchCache(const std::filesystem::path&)
+{
+    checkCache();
+    for(size_t budget : {2u << 20, 4u << 20, 8u << 20, 16u << 20})
+        benchWorkload(budget);
+}
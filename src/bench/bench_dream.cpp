@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "synthdream.h"
+#include "dreamfile.h"
+
+namespace
+{
+    template <typename T, typename Getter>
+    uint64_t scanTiles(const std::vector<T>& tiles, Getter getter)
+    {
+        uint64_t sum = 0;
+        for(auto& tile : tiles)
+            sum += getter(tile);
+        return sum;
+    }
+
+    template <typename T>
+    uint64_t scanLayer(const std::vector<T>& layer)
+    {
+        uint64_t sum = 0;
+        for(T value : layer)
+            sum += value;
+        return sum;
+    }
+
+    // One layer swept over the whole map, as interleaved tiles (the old
+    // storage) against the layer's own array. MB/s counts layer bytes only.
+    template <typename T, typename Getter>
+    void benchLayerScan(const std::string& name, const std::vector<DreamTile_t>& tiles,
+                        const std::vector<T>& layer, Getter getter)
+    {
+        const int passes = 50;
+        uint64_t tileSum = 0, layerSum = 0;
+
+        BenchTimer timer;
+        for(int pass = 0; pass < passes; pass++)
+            tileSum += scanTiles(tiles, getter);
+        reportResult("dream scan " + name + " tiles", timer, passes, layer.size() * sizeof(T) * passes);
+
+        timer.reset();
+        for(int pass = 0; pass < passes; pass++)
+            layerSum += scanLayer(layer);
+        reportResult("dream scan " + name + " layer", timer, passes, layer.size() * sizeof(T) * passes);
+
+        if(tileSum != layerSum)
+            throw std::runtime_error("Layer scan mismatch for " + name);
+    }
+
+    // Rows and columns a viewport covers, worked out the slow obvious way
+    // so the query has something to be checked against
+    uint64_t viewportReference(const Dream& dream, int32_t left, int32_t top, int32_t width, int32_t height, size_t& tiles)
+    {
+        uint64_t sum = 0;
+        for(int32_t y = 0; y < dream.mHeight; y++)
+        {
+            int32_t sy = y * (DREAM_TILE_HEIGHT / 2);
+            if(sy + DREAM_TILE_HEIGHT <= top || sy >= top + height)
+                continue;
+            for(int32_t x = 0; x < dream.mWidth; x++)
+            {
+                int32_t sx = x * DREAM_TILE_WIDTH + (y & 1) * (DREAM_TILE_WIDTH / 2);
+                if(sx + DREAM_TILE_WIDTH <= left || sx >= left + width)
+                    continue;
+                DreamTile_t tile = dream.get(x, y);
+                sum = sum * 31 + tile.mFloor + tile.mObject;
+                tiles++;
+            }
+        }
+        return sum;
+    }
+
+    // Panning across the map, drawing floors and objects each frame
+    void benchViewport(const Dream& dream, int32_t width, int32_t height, const std::string& label)
+    {
+        const int frames = 2000;
+        const int32_t mapWidth = dream.mWidth * DREAM_TILE_WIDTH;
+        const int32_t mapHeight = dream.mHeight * (DREAM_TILE_HEIGHT / 2);
+        auto position = [&](int frame, int32_t& left, int32_t& top)
+        {
+            left = (frame * 7919) % (mapWidth + width) - width;
+            top = (frame * 104729) % (mapHeight + height) - height;
+        };
+
+        size_t tiles = 0;
+        uint64_t checksum = 0;
+        BenchTimer timer;
+        for(int frame = 0; frame < frames; frame++)
+        {
+            int32_t left, top;
+            position(frame, left, top);
+            uint64_t sum = 0;
+            dream.forEachTileInView(left, top, width, height, [&](uint16_t, uint16_t, size_t index)
+            {
+                sum = sum * 31 + dream.mFloors[index] + dream.mObjects[index];
+                tiles++;
+            });
+            checksum += sum;
+        }
+        timer.stop();
+        double seconds = timer.seconds();
+        keepResult(checksum);
+        reportResult("dream viewport " + label, timer, frames);
+        reportValue("dream viewport " + label, tiles / seconds, "tiles/s");
+
+        // get(x, y) per tile, as a renderer had to before
+        size_t referenceTiles = 0;
+        uint64_t referenceChecksum = 0;
+        timer.reset();
+        for(int frame = 0; frame < frames; frame++)
+        {
+            int32_t left, top;
+            position(frame, left, top);
+            int32_t firstRow = std::max(0, top / (DREAM_TILE_HEIGHT / 2) - 2);
+            int32_t lastRow = std::min<int32_t>(dream.mHeight - 1, (top + height) / (DREAM_TILE_HEIGHT / 2) + 1);
+            int32_t firstColumn = std::max(0, left / DREAM_TILE_WIDTH - 1);
+            int32_t lastColumn = std::min<int32_t>(dream.mWidth - 1, (left + width) / DREAM_TILE_WIDTH + 1);
+            uint64_t sum = 0;
+            for(int32_t y = firstRow; y <= lastRow; y++)
+            {
+                for(int32_t x = firstColumn; x <= lastColumn; x++)
+                {
+                    DreamTile_t tile = dream.get(x, y);
+                    sum = sum * 31 + tile.mFloor + tile.mObject;
+                    referenceTiles++;
+                }
+            }
+            referenceChecksum += sum;
+        }
+        timer.stop();
+        seconds = timer.seconds();
+        keepResult(referenceChecksum);
+        reportResult("dream viewport " + label + " via get", timer, frames);
+        reportValue("dream viewport " + label + " via get", referenceTiles / seconds, "tiles/s");
+
+        // The query must match a brute force overlap test exactly
+        for(int frame = 0; frame < 20; frame++)
+        {
+            int32_t left, top;
+            position(frame, left, top);
+            size_t expectedTiles = 0, queryTiles = 0;
+            uint64_t expected = viewportReference(dream, left, top, width, height, expectedTiles);
+            uint64_t sum = 0;
+            dream.forEachTileInView(left, top, width, height, [&](uint16_t, uint16_t, size_t index)
+            {
+                sum = sum * 31 + dream.mFloors[index] + dream.mObjects[index];
+                queryTiles++;
+            });
+            if(sum != expected || queryTiles != expectedTiles)
+                throw std::runtime_error("Viewport query mismatch");
+        }
+    }
+
+    // A stream of server tile changes, then the renderer picking up what moved
+    void benchEdits(const std::string& file)
+    {
+        Dream dream(file);
+        const int edits = 100000;
+        uint32_t state = 12345;
+
+        BenchTimer timer;
+        for(int i = 0; i < edits; i++)
+        {
+            uint32_t r = nextRandom(state);
+            uint16_t x = r % dream.mWidth, y = (r >> 16) % dream.mHeight;
+            if(i & 1)
+                dream.setObject(x, y, uint16_t(i));
+            else
+                dream.setFloor(x, y, uint16_t(i));
+        }
+        reportResult("dream set 1000 tiles", timer, edits / 1000);
+
+        dream.forEachDirtyChunk([&](uint16_t, uint16_t, uint8_t layers)
+        {
+            if(layers & ~((1 << uint8_t(DreamLayer::FLOOR)) | (1 << uint8_t(DreamLayer::OBJECT))))
+                throw std::runtime_error("Unexpected dirty layer");
+        });
+        reportValue("dream dirty after 100k edits", dream.dirtyChunkCount(),
+                    "of " + std::to_string(size_t(dream.mChunksX) * dream.mChunksY) + " chunks");
+
+        dream.clearDirty();
+        const int fills = 1000;
+        timer.reset();
+        for(int i = 0; i < fills; i++)
+        {
+            uint32_t r = nextRandom(state);
+            dream.fill(DreamLayer::EFFECT, r % dream.mWidth, (r >> 16) % dream.mHeight, 24, 24, uint16_t(i + 1));
+        }
+        reportResult("dream fill 24x24", timer, fills);
+
+        // Fill must hit exactly the clipped rectangle, across chunk edges
+        dream.fill(DreamLayer::NW_WALL, 0, 0, 60, 30, 0);
+        dream.fill(DreamLayer::NW_WALL, 10, 13, 30, 7, 0xAB);
+        dream.fill(DreamLayer::NW_WALL, dream.mWidth - 5, dream.mHeight - 3, 40, 40, 0xCD);
+        for(uint16_t x = 0; x < 60; x++)
+        {
+            for(uint16_t y = 0; y < 30; y++)
+            {
+                bool inside = x >= 10 && x < 40 && y >= 13 && y < 20;
+                if(inside != (dream.get(x, y).mNWWall == 0xAB))
+                    throw std::runtime_error("Fill covered the wrong tiles");
+            }
+        }
+        if(dream.get(dream.mWidth - 1, dream.mHeight - 1).mNWWall != 0xCD)
+            throw std::runtime_error("Clipped fill missed the map corner");
+
+        // Rewriting what's already there isn't a change
+        dream.clearDirty();
+        dream.setNWWall(12, 14, 0xAB);
+        dream.fill(DreamLayer::NW_WALL, 10, 13, 30, 7, 0xAB);
+        if(dream.dirtyChunkCount() != 0)
+            throw std::runtime_error("Unchanged tiles were marked dirty");
+        dream.setRegion(0, 0, 7);
+        if(dream.dirtyChunkCount() != 1 || dream.get(0, 0).mRegion != 7)
+            throw std::runtime_error("Region edit was lost");
+    }
+}
+
+void benchDream(const std::filesystem::path& workDir)
+{
+    // A folder of stored dreams, the way an index sees it
+    {
+        std::vector<std::string> files;
+        size_t bytes = 0;
+        for(uint32_t i = 0; i < 1000; i++)
+        {
+            SynthDreamOptions options;
+            options.mSeed = i + 1;
+            std::string file = (workDir / ("dream" + std::to_string(i) + ".map")).string();
+            writeSynthDream(file, options);
+            files.push_back(file);
+            bytes += std::filesystem::file_size(file);
+        }
+
+        for(auto mode : {Dream::ParseMode::HEADER, Dream::ParseMode::FULL})
+        {
+            const char* label = mode == Dream::ParseMode::HEADER ? "dream open 1000 52x100 header only" : "dream open 1000 52x100 full";
+            uint64_t checksum = 0;
+            BenchTimer timer;
+            for(auto& file : files)
+            {
+                Dream dream(file, mode);
+                checksum += dream.mWidth + dream.mHeight + dream.mAllowLarge + dream.mRating.size();
+            }
+            timer.stop();
+            double seconds = timer.seconds();
+            reportResult(label, timer, files.size(), mode == Dream::ParseMode::FULL ? bytes : 0);
+            reportValue(label, files.size() / seconds, "files/s");
+            if(checksum != files.size() * (52 + 100 + 1 + 5))
+                throw std::runtime_error("Dream header mismatch");
+        }
+        
+        // A header only Dream has no tiles to touch
+        Dream header(files[0], Dream::ParseMode::HEADER);
+        if(header.hasLayers())
+            throw std::runtime_error("Header only Dream has layers");
+        int refused = 0;
+        auto expectRefused = [&](auto&& edit)
+        {
+            try
+            {
+                edit();
+            }
+            catch(const std::runtime_error&)
+            {
+                refused++;
+            }
+        };
+        expectRefused([&] { header.get(40, 90); });
+        expectRefused([&] { header.setFloor(40, 90, 7); });
+        expectRefused([&] { header.fill(DreamLayer::NE_WALL, 0, 0, 10, 10, 1); });
+        if(refused != 3)
+            throw std::runtime_error("Header only Dream allowed a tile access");
+    }
+
+
+    // Full loads from a small dream up to the largest the client allows
+    SynthDreamOptions options;
+    std::string file;
+    for(uint16_t size : {128, 256, 512, 1000})
+    {
+        options.mWidth = size;
+        options.mHeight = size;
+        file = (workDir / ("dream_" + std::to_string(size) + ".map")).string();
+        writeSynthDream(file, options);
+
+        const int iterations = std::max(20, 20 * 1000 * 1000 / (size * size));
+        std::string label = "dream load " + std::to_string(size) + "x" + std::to_string(size);
+        BenchTimer timer;
+        for(int i = 0; i < iterations; i++)
+        {
+            Dream dream(file);
+        }
+        reportResult(label, timer, iterations, std::filesystem::file_size(file) * iterations);
+    }
+
+    Dream dream(file);
+    std::vector<DreamTile_t> tiles(dream.mFloors.size());
+    for(uint16_t x = 0; x < dream.mWidth; x++)
+        for(uint16_t y = 0; y < dream.mHeight; y++)
+            tiles[dream.index(x, y)] = dream.get(x, y);
+
+    for(size_t i = 0; i < size_t(dream.mWidth) * dream.mHeight; i += 997)
+    {
+        DreamTile_t tile = tiles[dream.index(i / dream.mHeight, i % dream.mHeight)];
+        if(tile.mFloor != synthDreamValue(options, 0, i)
+           || tile.mNWWall != synthDreamValue(options, 2, i) >> 8
+           || tile.mAmbient != synthDreamValue(options, 6, i))
+            throw std::runtime_error("Dream layer contents mismatch");
+    }
+
+    benchLayerScan("floors", tiles, dream.mFloors, [](const DreamTile_t& tile) { return tile.mFloor; });
+    benchLayerScan("objects", tiles, dream.mObjects, [](const DreamTile_t& tile) { return tile.mObject; });
+    benchLayerScan("NE walls", tiles, dream.mNEWalls, [](const DreamTile_t& tile) { return tile.mNEWall; });
+    benchLayerScan("effects", tiles, dream.mEffects, [](const DreamTile_t& tile) { return tile.mEffect; });
+
+    benchViewport(dream, 400, 240, "3ds top screen");
+    benchViewport(dream, 1280, 720, "720p");
+    benchEdits(file);
+
+    // Editing one layer a 1.00 map lacks mustn't make get() read its partner
+    {
+        SynthDreamOptions old;
+        old.mWidth = 4;
+        old.mHeight = 4;
+        old.mVersionMinor = 0;
+        std::string oldFile = (workDir / "dream_v100.map").string();
+        writeSynthDream(oldFile, old);
+        Dream oldDream(oldFile);
+        oldDream.setRegion(1, 1, 7);
+        oldDream.set(DreamLayer::LIGHTING, 2, 2, 9);
+        DreamTile_t region = oldDream.get(1, 1);
+        DreamTile_t lighting = oldDream.get(2, 2);
+        if(region.mRegion != 7 || region.mEffect != 0 || lighting.mLighting != 9 || lighting.mAmbient != 0)
+            throw std::runtime_error("Edit on a 1.00 map read the wrong layers");
+    }
+}
@@ -0,0 +1,132 @@
+#include <filesystem>
+#include <memory>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "bench.h"
+#include "synthfox5.h"
+#include "fox5.h"
+
+namespace
+{
+    const char* modeName(FOX5::LoadMode mode)
+    {
+        return mode == FOX5::LoadMode::MAPPED ? "mapped" : "stream";
+    }
+
+    const char* compressionName(FOX5::CompressionType compression)
+    {
+        return compression == FOX5::CompressionType::LZMA ? "lzma" : "raw";
+    }
+
+    // Opens every file in turn, the way a dream load walks its patch list
+    void benchOpen(const std::vector<std::string>& files, FOX5::LoadMode mode, const std::string& label)
+    {
+        size_t bytes = 0;
+        for(auto& file : files)
+            bytes += std::filesystem::file_size(file);
+
+        BenchTimer timer;
+        for(auto& file : files)
+        {
+            FOX5 fox(file, mode);
+        }
+        reportResult("fox5 open " + label + " " + modeName(mode), timer, files.size(), bytes);
+    }
+
+    void benchImages(const std::string& file, FOX5::LoadMode mode, const std::string& label)
+    {
+        FOX5 fox(file, mode);
+        size_t bytes = 0;
+
+        BenchTimer timer;
+        for(uint32_t i = 0; i < fox.imageCount(); i++)
+        {
+            FOX5Image image = fox.getImage(i);
+            bytes += image.mData.size();
+        }
+        reportResult("fox5 getImage " + label + " " + modeName(mode), timer, fox.imageCount(), bytes);
+    }
+
+    // Sizing a texture budget up front, without touching any payload
+    void benchInfo(const std::string& file, const SynthFox5Options& options, const std::string& label)
+    {
+        FOX5 fox(file, FOX5::LoadMode::MAPPED);
+        const int passes = 1000;
+        uint64_t total = 0;
+
+        BenchTimer timer;
+        for(int pass = 0; pass < passes; pass++)
+        {
+            for(uint32_t i = 0; i < fox.imageCount(); i++)
+                total += fox.imageInfo(i).mMemSize;
+        }
+        reportResult("fox5 imageInfo " + label + " all images", timer, passes);
+
+        uint64_t expected = uint64_t(passes) * options.mImages * options.mImageWidth * options.mImageHeight * 4;
+        if(total != expected)
+            throw std::runtime_error("Image directory size mismatch");
+    }
+
+    // Warming a whole dream's worth of images in one go
+    void benchBatch(const std::string& file, FOX5::LoadMode mode, const std::string& label)
+    {
+        FOX5 fox(file, mode);
+        std::vector<uint32_t> ids(fox.imageCount());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        for(unsigned threads : std::set<unsigned>{1u, 2u, 4u, cores})
+        {
+            BenchTimer timer;
+            std::vector<FOX5Image> images = fox.getImages(ids, threads);
+            timer.stop();
+
+            size_t bytes = 0;
+            for(auto& image : images)
+                bytes += image.mData.size();
+            reportResult("fox5 getImages " + label + " " + modeName(mode) + " x" + std::to_string(threads),
+                         timer, images.size(), bytes);
+        }
+    }
+}
+
+void benchFox5(const std::filesystem::path& workDir)
+{
+    for(auto compression : {FOX5::CompressionType::LZMA, FOX5::CompressionType::NOT})
+    {
+        // Many small patch files
+        std::vector<std::string> patches;
+        for(uint32_t i = 0; i < 200; i++)
+        {
+            SynthFox5Options options;
+            options.mObjects = 8;
+            options.mImages = 16;
+            options.mCompression = compression;
+            options.mSeed = i + 1;
+
+            std::string file = (workDir / ("patch" + std::to_string(i) + "_" + compressionName(compression) + ".fox")).string();
+            writeSynthFox5(file, options);
+            patches.push_back(file);
+        }
+
+        // One big archive
+        SynthFox5Options options;
+        options.mObjects = 2000;
+        options.mImages = 2000;
+        options.mCompression = compression;
+        std::string large = (workDir / (std::string("large_") + compressionName(compression) + ".fox")).string();
+        writeSynthFox5(large, options);
+        benchInfo(large, options, std::string("large ") + compressionName(compression));
+
+        for(auto mode : {FOX5::LoadMode::STREAM, FOX5::LoadMode::MAPPED})
+        {
+            benchOpen(patches, mode, std::string("patches ") + compressionName(compression));
+            benchOpen({large}, mode, std::string("large ") + compressionName(compression));
+            benchImages(large, mode, std::string("large ") + compressionName(compression));
+            benchBatch(large, mode, std::string("large ") + compressionName(compression));
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <vector>
+#include "bench.h"
+#include "synthfox5.h"
+#include "filecommon.h"
+
+namespace
+{
+    std::vector<uint8_t> makePayload(size_t size)
+    {
+        // Half repeating pattern, half noise
+        std::vector<uint8_t> data(size);
+        uint32_t state = 0x12345678;
+        for(size_t i = 0; i < size; i++)
+        {
+            state = state * 1103515245 + 12345;
+            data[i] = (i / 4096) % 2 ? static_cast<uint8_t>(state >> 16) : static_cast<uint8_t>(i);
+        }
+        return data;
+    }
+
+    uint64_t g_BaselineAllocs = 0;
+
+    void* countingAlloc(const ISzAlloc*, size_t size)
+    {
+        g_BaselineAllocs++;
+        return malloc(size);
+    }
+
+    void countingFree(const ISzAlloc*, void* address)
+    {
+        free(address);
+    }
+
+    // Thousands of small sprites, the case the decoder pool is for
+    void benchSmallImages()
+    {
+        const size_t count = 2000;
+        const size_t size = 32 * 32 * 4;
+        std::vector<uint8_t> raw = makePayload(size);
+        std::vector<uint8_t> compressed = encodeLZMALiterals(raw.data(), raw.size());
+        std::vector<uint8_t> out(size);
+
+        {
+            // What decompressLZMA used to do: LzmaDecode with fresh probs
+            ISzAlloc alloc = { countingAlloc, countingFree };
+            g_BaselineAllocs = 0;
+            BenchTimer timer;
+            for(size_t i = 0; i < count; i++)
+            {
+                SizeT destLen = size;
+                SizeT srcLen = compressed.size() - LZMA_ALONE_HEADER_SIZE;
+                ELzmaStatus status;
+                LzmaDecode(out.data(), &destLen, compressed.data() + LZMA_ALONE_HEADER_SIZE, &srcLen,
+                           compressed.data(), LZMA_PROPS_SIZE, LZMA_FINISH_ANY, &status, &alloc);
+            }
+            reportResult("lzma small images LzmaDecode", timer, count, size * count);
+            reportValue("lzma small images LzmaDecode", double(g_BaselineAllocs) / count, "decoder allocs/image");
+        }
+
+        {
+            LZMADecoderPool::Stats before = LZMADecoderPool::stats();
+            BenchTimer timer;
+            for(size_t i = 0; i < count; i++)
+            {
+                std::vector<uint8_t> image = decompressLZMA(compressed, size);
+            }
+            timer.stop();
+            LZMADecoderPool::Stats after = LZMADecoderPool::stats();
+            reportResult("lzma small images pooled", timer, count, size * count);
+            reportValue("lzma small images pooled", double(after.mAllocations - before.mAllocations) / count, "decoder allocs/image");
+        }
+    }
+}
+
+void benchLZMA()
+{
+    benchSmallImages();
+
+    for(size_t size : {size_t(4096), size_t(256 * 1024), size_t(4 * 1024 * 1024)})
+    {
+        std::vector<uint8_t> raw = makePayload(size);
+        std::vector<uint8_t> compressed = encodeLZMALiterals(raw.data(), raw.size());
+        size_t iterations = std::max<size_t>(1, (16 * 1024 * 1024) / size);
+        std::string label = std::to_string(size / 1024) + "KiB";
+
+        {
+            BenchTimer timer;
+            for(size_t i = 0; i < iterations; i++)
+            {
+                std::vector<uint8_t> out = decompressLZMA(compressed, size);
+            }
+            reportResult("lzma oneshot " + label, timer, iterations, size * iterations);
+        }
+
+        {
+            std::vector<uint8_t> out(size);
+            BenchTimer timer;
+            for(size_t i = 0; i < iterations; i++)
+            {
+                LZMAStream lzma(out.data(), out.size());
+                for(size_t offset = 0; offset < compressed.size(); offset += 4096)
+                    lzma.write(compressed.data() + offset, std::min<size_t>(4096, compressed.size() - offset));
+            }
+            reportResult("lzma stream to buffer " + label, timer, iterations, size * iterations);
+            if(out != raw)
+                throw std::runtime_error("LZMAStream buffer output mismatch");
+        }
+
+        {
+            size_t mismatches = 0;
+            BenchTimer timer;
+            for(size_t i = 0; i < iterations; i++)
+            {
+                size_t position = 0;
+                LZMAStream lzma([&](const uint8_t* data, size_t length) {
+                    mismatches += !std::equal(data, data + length, raw.begin() + position);
+                    position += length;
+                });
+                for(size_t offset = 0; offset < compressed.size(); offset += 4096)
+                    lzma.write(compressed.data() + offset, std::min<size_t>(4096, compressed.size() - offset));
+            }
+            reportResult("lzma stream to sink " + label, timer, iterations, size * iterations);
+            if(mismatches)
+                throw std::runtime_error("LZMAStream sink output mismatch");
+        }
+    }
+}
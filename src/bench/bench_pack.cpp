@@ -0,0 +1,221 @@
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "synthfox5.h"
+#include "fox5.h"
+#include "fox5pack.h"
+#include "texturelayout.h"
+
+namespace
+{
+    // What the client does per texture today, from the FOX5 file
+    std::vector<uint64_t> loadFromFox(const std::string& file, const std::string& label)
+    {
+        std::vector<uint64_t> hashes;
+        size_t bytes = 0;
+        BenchTimer timer;
+        FOX5 fox(file, FOX5::LoadMode::STREAM);
+        for(uint32_t id = 0; id < fox.imageCount(); id++)
+        {
+            FOX5Image image = fox.getImage(id);
+            GPUFormat format = selectTextureFormat(analyzeTexture(image));
+            std::vector<uint8_t> texels(size_t(textureSize(image.mWidth)) * textureSize(image.mHeight)
+                                        * gpuBitsPerPixel(format) / 8);
+            fox5TextureData(image, texels.data(), textureSize(image.mWidth), textureSize(image.mHeight), format);
+            hashes.push_back(hashBytes(texels.data(), texels.size()));
+            bytes += texels.size();
+        }
+        timer.stop();
+        reportResult("texture load fox5 " + label, timer, hashes.size(), bytes);
+        return hashes;
+    }
+
+    std::vector<uint64_t> loadFromPack(const std::string& file, FOX5::LoadMode mode, const std::string& label)
+    {
+        std::vector<uint64_t> hashes;
+        std::vector<uint8_t> texels;
+        size_t bytes = 0;
+        BenchTimer timer;
+        FOX5Pack pack(file, mode);
+        for(uint32_t id = 0; id < pack.imageCount(); id++)
+        {
+            texels.resize(pack.image(id).mSize);
+            pack.readImage(id, texels.data());
+            hashes.push_back(hashBytes(texels.data(), texels.size()));
+            bytes += texels.size();
+        }
+        timer.stop();
+        reportResult(std::string("texture load pack ") + (mode == FOX5::LoadMode::MAPPED ? "mapped " : "stream ") + label,
+                     timer, hashes.size(), bytes);
+        return hashes;
+    }
+
+    // What format selection saves over everything in GPU_RGBA8
+    void reportTextureMemory(const FOX5Pack& pack, const std::string& label)
+    {
+        uint64_t texels = 0;
+        uint64_t rgba8Texels = 0;
+        uint32_t reduced = 0;
+        for(uint32_t id = 0; id < pack.imageCount(); id++)
+        {
+            const FOX5Pack::Image& image = pack.image(id);
+            texels += image.mSize;
+            rgba8Texels += uint64_t(image.mTexWidth) * image.mTexHeight * 4;
+            reduced += image.mFormat != GPUFormat::RGBA8;
+        }
+        reportValue("texture memory " + label + " rgba8", rgba8Texels, "bytes");
+        reportValue("texture memory " + label + " selected", texels, "bytes");
+        reportValue("texture memory " + label + " reduced images", reduced * 100.0 / pack.imageCount(), "%");
+    }
+
+    void checkTree(FOX5& fox, const FOX5Pack& pack)
+    {
+        if(pack.objectCount() != fox.objectCount() || pack.mGenerator != fox.mGenerator)
+            throw std::runtime_error("Pack object count mismatch");
+        for(uint32_t i = 0; i < fox.objectCount(); i++)
+        {
+            FOX5Object& object = fox.object(i);
+            const FOX5Pack::Object* record = pack.findObject(object.mObjectID);
+            if(!record || pack.string(record->mName) != object.mName || pack.object(i).mKeywords != object.mKeywords)
+                throw std::runtime_error("Pack object mismatch");
+
+            auto shapes = fox.shapes(object);
+            auto packShapes = pack.shapes(*record);
+            if(packShapes.size() != shapes.size())
+                throw std::runtime_error("Pack shape count mismatch");
+            for(size_t s = 0; s < shapes.size(); s++)
+            {
+                auto frames = fox.frames(shapes[s]);
+                auto packFrames = pack.frames(packShapes[s]);
+                if(packShapes[s].mPurpose != shapes[s].mPurpose || packFrames.size() != frames.size())
+                    throw std::runtime_error("Pack shape mismatch");
+                for(size_t f = 0; f < frames.size(); f++)
+                {
+                    auto channels = fox.channels(frames[f]);
+                    auto packChannels = pack.channels(packFrames[f]);
+                    if(packChannels.size() != channels.size())
+                        throw std::runtime_error("Pack frame mismatch");
+                    for(size_t c = 0; c < channels.size(); c++)
+                    {
+                        if(packChannels[c].mImageID != channels[c].mImageID)
+                            throw std::runtime_error("Pack channel mismatch");
+                    }
+                }
+            }
+        }
+    }
+}
+
+void benchPack(const std::filesystem::path& workDir)
+{
+    struct Case
+    {
+        const char* mLabel;
+        uint16_t mWidth;
+        uint16_t mHeight;
+        FOX5Image::ImageFormat mFormat;
+        bool mSprites;
+    };
+    const Case cases[] = {
+        {"32x32 argb", 32, 32, FOX5Image::ImageFormat::E_32BIT, false},
+        {"33x65 argb", 33, 65, FOX5Image::ImageFormat::E_32BIT, false},
+        {"33x65 8bit", 33, 65, FOX5Image::ImageFormat::E_8BIT, false},
+        {"64x64 argb sprites", 64, 64, FOX5Image::ImageFormat::E_32BIT, true},
+        {"33x65 8bit sprites", 33, 65, FOX5Image::ImageFormat::E_8BIT, true},
+    };
+
+    for(auto& test : cases)
+    {
+        SynthFox5Options options;
+        options.mObjects = 500;
+        options.mImages = 500;
+        options.mImageWidth = test.mWidth;
+        options.mImageHeight = test.mHeight;
+        options.mImageFormat = test.mFormat;
+        options.mSpriteImages = test.mSprites;
+        std::string label = test.mLabel;
+        std::string file = (workDir / ("pack_" + std::to_string(test.mWidth) + "x" + std::to_string(test.mHeight)
+                                       + "_" + std::to_string(static_cast<int>(test.mFormat))
+                                       + (test.mSprites ? "_sprites" : "") + ".fox")).string();
+        std::string packFile = std::filesystem::path(file).replace_extension(".f5p").string();
+        writeSynthFox5(file, options);
+
+        {
+            FOX5 fox(file, FOX5::LoadMode::MAPPED);
+            BenchTimer timer;
+            FOX5Pack::write(fox, packFile);
+            reportResult("fox5pack write " + label, timer, fox.imageCount(), std::filesystem::file_size(packFile));
+            reportValue("fox5pack size " + label + " fox5", std::filesystem::file_size(file), "bytes");
+            reportValue("fox5pack size " + label + " pack", std::filesystem::file_size(packFile), "bytes");
+        }
+
+        std::vector<uint64_t> expected = loadFromFox(file, label);
+        for(auto mode : {FOX5::LoadMode::STREAM, FOX5::LoadMode::MAPPED})
+        {
+            if(loadFromPack(packFile, mode, label) != expected)
+                throw std::runtime_error("Packed texels differ from the client conversion");
+        }
+
+        FOX5 fox(file, FOX5::LoadMode::MAPPED, FOX5::ParseMode::LAZY);
+        FOX5Pack pack(packFile);
+        checkTree(fox, pack);
+        reportTextureMemory(pack, label);
+        
+        // Forcing a format overrides the selection, one image at a time too
+        TextureFormatPolicy policy;
+        policy.mDefault = GPUFormat::RGBA8;
+        policy.mOverrides[1] = GPUFormat::RGBA4;
+        FOX5Pack::write(fox, packFile, 0, policy);
+        FOX5Pack forced(packFile);
+        for(uint32_t id = 0; id < forced.imageCount(); id++)
+        {
+            if(forced.image(id).mFormat != (id == 1 ? GPUFormat::RGBA4 : GPUFormat::RGBA8))
+                throw std::runtime_error("Pack ignored its format policy");
+        }
+
+        // A write that fails halfway keeps the old pack and leaves nothing
+        // behind. The last image asks for a format that doesn't exist.
+        auto countFiles = [&]() { return std::distance(std::filesystem::directory_iterator(workDir), {}); };
+        auto before = countFiles();
+        policy.mOverrides[forced.imageCount() - 1] = static_cast<GPUFormat>(0xFF);
+        bool threw = false;
+        try
+        {
+            FOX5Pack::write(fox, packFile, 0, policy);
+        }
+        catch(const std::runtime_error&)
+        {
+            threw = true;
+        }
+        if(!threw || countFiles() != before || FOX5Pack(packFile).imageCount() != forced.imageCount())
+            throw std::runtime_error("Failed pack write left files behind");
+    }
+
+    // Damage anywhere in the tree has to be caught on open
+    std::string file = (workDir / "pack_damaged.fox").string();
+    std::string packFile = (workDir / "pack_damaged.f5p").string();
+    SynthFox5Options options;
+    options.mImages = 4;
+    writeSynthFox5(file, options);
+    {
+        FOX5 fox(file, FOX5::LoadMode::MAPPED);
+        FOX5Pack::write(fox, packFile);
+    }
+    {
+        std::fstream damage(packFile, std::ios::in | std::ios::out | std::ios::binary);
+        damage.seekp(300);
+        damage.put('\x5A');
+    }
+    try
+    {
+        FOX5Pack pack(packFile);
+    }
+    catch(const std::runtime_error&)
+    {
+        return;
+    }
+    throw std::runtime_error("Damaged pack was opened");
+}
@@ -0,0 +1,256 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "allocstats.h"
+#include "bench.h"
+#include "synthfox5.h"
+#include "fox5.h"
+
+namespace
+{
+    // The per command FOX5Value decode every level used to go through
+    // before its parseData saw a field. This is only the decode half of the
+    // old path, the tree building on top of it came on top.
+    size_t walkVariantCommands(const std::vector<uint8_t>& block)
+    {
+        BigEndianReader reader(block.data(), block.size());
+        reader.skip(4);
+        size_t values = 0;
+        while(!reader.empty())
+        {
+            FOX5Command cmd(reader);
+            values += cmd.getValues().size();
+        }
+        return values;
+    }
+
+    uint64_t treeChecksum(FOX5& fox)
+    {
+        uint64_t checksum = fox.mObjects.size();
+        for(auto& object : fox.mObjects)
+        {
+            checksum = checksum * 31 + object.mObjectID + object.mName.size() + object.mKeywords.size();
+            for(auto& shape : fox.shapes(object))
+            {
+                checksum = checksum * 31 + static_cast<uint8_t>(shape.mPurpose) + fox.kitterspeak(shape).size();
+                for(auto& frame : fox.frames(shape))
+                    for(auto& channel : fox.channels(frame))
+                        checksum = checksum * 31 + channel.mImageID;
+            }
+        }
+        return checksum;
+    }
+
+    void benchCache(const std::filesystem::path& workDir)
+    {
+        SynthFox5Options options;
+        options.mObjects = 10000;
+        options.mImages = 0;
+        std::string file = (workDir / "parse_10k_lzma.fox").string();
+        writeSynthFox5(file, options);
+        
+        std::filesystem::path cacheDir = workDir / "treecache";
+        std::filesystem::remove_all(cacheDir);
+        
+        const int iterations = 5;
+        uint64_t expected;
+        {
+            BenchTimer timer;
+            for(int i = 0; i < iterations; i++)
+            {
+                FOX5 fox(file, FOX5::LoadMode::MAPPED);
+                expected = treeChecksum(fox);
+            }
+            reportResult("fox5 open 10k objects lzma, no cache", timer, iterations);
+        }
+        
+        FOX5::setCacheDirectory(cacheDir.string());
+        {
+            BenchTimer timer;
+            FOX5 fox(file, FOX5::LoadMode::MAPPED);
+            reportResult("fox5 open 10k objects lzma, cold cache", timer, 1);
+            if(fox.loadedFromCache() || treeChecksum(fox) != expected)
+                throw std::runtime_error("Cold cache load mismatch");
+        }
+        for(auto mode : {FOX5::LoadMode::MAPPED, FOX5::LoadMode::STREAM})
+        {
+            BenchTimer timer;
+            for(int i = 0; i < iterations; i++)
+            {
+                FOX5 fox(file, mode);
+                if(!fox.loadedFromCache() || treeChecksum(fox) != expected)
+                    throw std::runtime_error("Warm cache load mismatch");
+            }
+            reportResult(std::string("fox5 open 10k objects lzma, warm cache ")
+                         + (mode == FOX5::LoadMode::MAPPED ? "mapped" : "stream"),
+                         timer, iterations);
+        }
+        
+        // A damaged entry must be ignored and replaced
+        std::filesystem::path entry = std::filesystem::directory_iterator(cacheDir)->path();
+        {
+            std::fstream damage(entry, std::ios::in | std::ios::out | std::ios::binary);
+            damage.seekp(std::filesystem::file_size(entry) / 2);
+            damage.put('\x5A');
+        }
+        {
+            FOX5 fox(file, FOX5::LoadMode::MAPPED);
+            if(fox.loadedFromCache() || treeChecksum(fox) != expected)
+                throw std::runtime_error("Corrupt cache entry was used");
+        }
+        // So must one for an older version of the file
+        std::filesystem::last_write_time(file, std::filesystem::last_write_time(file) + std::chrono::seconds(1));
+        {
+            FOX5 fox(file, FOX5::LoadMode::MAPPED);
+            if(fox.loadedFromCache())
+                throw std::runtime_error("Stale cache entry was used");
+        }
+        {
+            FOX5 fox(file, FOX5::LoadMode::MAPPED);
+            if(!fox.loadedFromCache())
+                throw std::runtime_error("Cache entry was not rebuilt");
+        }
+        FOX5::setCacheDirectory("");
+    }
+}
+
+void benchParse(const std::filesystem::path& workDir)
+{
+    SynthFox5Options options;
+    options.mObjects = 10000;
+    options.mImages = 0;
+    options.mCompression = FOX5::CompressionType::NOT;
+
+    std::vector<uint8_t> block = buildSynthCommandBlock(options);
+    std::string file = (workDir / "parse_10k.fox").string();
+    writeSynthFox5(file, options);
+
+    const int iterations = 5;
+    {
+        size_t values = 0;
+        BenchTimer timer;
+        for(int i = 0; i < iterations; i++)
+            values += walkVariantCommands(block);
+        timer.stop();
+        double seconds = timer.seconds();
+        reportResult("fox5 parse 10k objects variant decode", timer, iterations, block.size() * iterations);
+        reportValue("fox5 parse 10k objects variant decode", options.mObjects * iterations / seconds, "objects/s");
+        
+        // Every value of the synthetic tree, counts and list headers included
+        size_t perFrame = 4 + options.mChannelsPerFrame * 4;
+        size_t perShape = 8 + options.mFramesPerShape * perFrame;
+        size_t perObject = 8 + options.mShapesPerObject * perShape;
+        if(values != iterations * (6 + options.mImages * 4 + options.mObjects * perObject))
+            throw std::runtime_error("Variant decode value count mismatch");
+    }
+    
+    {
+        BenchTimer timer;
+        for(int i = 0; i < iterations; i++)
+            FOX5Command::validate(block);
+        timer.stop();
+        reportResult("fox5 validate 10k objects", timer, iterations, block.size() * iterations);
+        
+        // Each kind of damage has to be caught rather than walked past
+        auto expectInvalid = [&](const char* what, std::vector<uint8_t> damaged)
+        {
+            try
+            {
+                FOX5Command::validate(damaged);
+            }
+            catch(const std::runtime_error&)
+            {
+                return;
+            }
+            throw std::runtime_error(std::string("Validator accepted ") + what);
+        };
+        std::vector<uint8_t> damaged = block;
+        damaged.pop_back();
+        expectInvalid("a truncated block", damaged);
+        damaged = block;
+        damaged[10] = 0xFF;
+        expectInvalid("an unknown command", damaged);
+        damaged = block;
+        damaged[5] = 1;
+        expectInvalid("a list at the wrong level", damaged);
+        damaged = block;
+        damaged[10] = static_cast<uint8_t>(FOX5Command::Command::CHANNEL_PURPOSE);
+        expectInvalid("a channel command in the file entry", damaged);
+        damaged = block;
+        damaged.push_back(static_cast<uint8_t>(FOX5Command::Command::NOP));
+        expectInvalid("data after the file list", damaged);
+    }
+
+    {
+        BenchTimer timer;
+        for(int i = 0; i < iterations; i++)
+        {
+            FOX5 fox(file, FOX5::LoadMode::MAPPED);
+            if(fox.mObjects.size() != options.mObjects)
+                throw std::runtime_error("Parsed object count mismatch");
+        }
+        timer.stop();
+        double seconds = timer.seconds();
+        reportResult("fox5 parse 10k objects tree", timer, iterations, block.size() * iterations);
+        reportValue("fox5 parse 10k objects tree", options.mObjects * iterations / seconds, "objects/s");
+    }
+
+    {
+        // What a client touching a few objects per patch pays for
+        const int32_t wanted[] = {0, 17, 4242, 9999};
+        size_t shapes = 0;
+        BenchTimer timer;
+        for(int i = 0; i < iterations; i++)
+        {
+            FOX5 fox(file, FOX5::LoadMode::MAPPED, FOX5::ParseMode::LAZY);
+            if(fox.objectCount() != options.mObjects)
+                throw std::runtime_error("Indexed object count mismatch");
+            for(int32_t id : wanted)
+            {
+                FOX5Object* object = fox.findObject(id);
+                if(!object || object->mObjectID != id || object->mName != "Object " + std::to_string(id))
+                    throw std::runtime_error("Lazy object lookup mismatch");
+                shapes += fox.shapes(*object).size();
+            }
+            if(fox.loadedObjectCount() != std::size(wanted))
+                throw std::runtime_error("Lazy mode parsed more than it was asked for");
+        }
+        timer.stop();
+        if(shapes != iterations * std::size(wanted) * options.mShapesPerObject)
+            throw std::runtime_error("Lazy shape count mismatch");
+        reportResult("fox5 lazy open 10k objects, 4 lookups", timer, iterations, block.size() * iterations);
+        
+        FOX5 fox(file, FOX5::LoadMode::MAPPED, FOX5::ParseMode::LAZY);
+        reportValue("fox5 lazy open 10k objects tree memory", fox.treeMemoryUsage(), "bytes");
+    }
+
+    {
+        AllocStats before = allocStats();
+        FOX5 fox(file, FOX5::LoadMode::MAPPED);
+        AllocStats after = allocStats();
+        reportValue("fox5 parse 10k objects allocations", after.mAllocations - before.mAllocations, "allocs");
+        reportValue("fox5 parse 10k objects memory held", after.mLiveBytes - before.mLiveBytes, "bytes");
+        reportValue("fox5 parse 10k objects tree memory", fox.treeMemoryUsage(), "bytes");
+
+        const int passes = 100;
+        uint64_t checksum = 0;
+        BenchTimer timer;
+        for(int pass = 0; pass < passes; pass++)
+        {
+            for(auto& object : fox.mObjects)
+                for(auto& shape : fox.shapes(object))
+                    for(auto& frame : fox.frames(shape))
+                        for(auto& channel : fox.channels(frame))
+                            checksum += channel.mImageID + frame.mFrameOffset[0] + static_cast<uint8_t>(shape.mPurpose);
+        }
+        reportResult("fox5 traverse 10k objects", timer, passes);
+        if(checksum != passes * uint64_t(options.mObjects) * options.mShapesPerObject * options.mFramesPerShape
+                        * options.mChannelsPerFrame * static_cast<uint8_t>(FOX5Shape::Purpose::ITEM))
+            throw std::runtime_error("Traversal checksum mismatch");
+    }
+
+    benchCache(workDir);
+}
@@ -0,0 +1,473 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "fox5palette.h"
+#include "texturelayout.h"
+#include "texturepalette.h"
+
+namespace
+{
+    std::vector<uint8_t> makeTexels(size_t size, uint32_t seed)
+    {
+        std::vector<uint8_t> texels(size);
+        for(auto& byte : texels)
+            byte = static_cast<uint8_t>(nextRandom(seed));
+        return texels;
+    }
+
+    // How fox5TextureData used to work: pad, rotate to R, G, B, A, then
+    // tile into a fresh buffer
+    std::vector<uint8_t> stagedTextureData(const FOX5Image& image, uint16_t texWidth, uint16_t texHeight)
+    {
+        const int bpp = 4;
+        std::vector<uint8_t> argb = image.mData;
+        if(image.mImageFormat == FOX5Image::ImageFormat::E_8BIT)
+        {
+            argb.resize(size_t(image.mWidth) * image.mHeight * bpp);
+            for(size_t i = 0; i < size_t(image.mWidth) * image.mHeight; i++)
+            {
+                uint8_t index = image.mData[i];
+                argb[i * 4] = index == 0 ? 0x00 : 0xFF;
+                argb[i * 4 + 1] = fox5palette[index][0];
+                argb[i * 4 + 2] = fox5palette[index][1];
+                argb[i * 4 + 3] = fox5palette[index][2];
+            }
+        }
+        uint8_t* pixels = padImage(argb.data(), image.mWidth, image.mHeight, bpp, texWidth, texHeight, 0xFF);
+        size_t dataSize = size_t(texWidth) * texHeight * bpp;
+        for(size_t i = 0; i < dataSize; i += 4)
+        {
+            uint8_t alpha = pixels[i];
+            pixels[i] = pixels[i + 1];
+            pixels[i + 1] = pixels[i + 2];
+            pixels[i + 2] = pixels[i + 3];
+            pixels[i + 3] = alpha;
+        }
+        std::vector<uint8_t> result(dataSize);
+        swizzleTexture(result.data(), pixels, texWidth, texHeight, bpp);
+        delete[] pixels;
+        return result;
+    }
+
+    FOX5Image makeImage(uint16_t width, uint16_t height, FOX5Image::ImageFormat format)
+    {
+        FOX5Image image(0, 0, width, height, format);
+        image.mData = makeTexels(image.getMemSize(), width * 7 + height);
+        return image;
+    }
+
+    const FOX5Image::ImageFormat FORMATS[] = {FOX5Image::ImageFormat::E_32BIT, FOX5Image::ImageFormat::E_8BIT};
+
+    const char* formatName(FOX5Image::ImageFormat format)
+    {
+        return format == FOX5Image::ImageFormat::E_8BIT ? "8bit" : "argb";
+    }
+
+    // The fused conversion has to match the staged one for every shape of
+    // padding: none, odd widths, short rows, whole tiles of it
+    void checkConversion()
+    {
+        const uint16_t sizes[][2] = {{8, 8}, {1, 1}, {33, 65}, {64, 64}, {7, 100}, {250, 3}, {640, 480}};
+        for(auto format : FORMATS)
+        {
+            for(auto& size : sizes)
+            {
+                FOX5Image image = makeImage(size[0], size[1], format);
+                uint16_t texWidth = textureSize(size[0]);
+                uint16_t texHeight = textureSize(size[1]);
+                if(fox5TextureData(image, texWidth, texHeight) != stagedTextureData(image, texWidth, texHeight))
+                    throw std::runtime_error(std::string("Fused texture conversion differs at ")
+                                             + std::to_string(size[0]) + "x" + std::to_string(size[1])
+                                             + " " + formatName(format));
+            }
+        }
+    }
+
+    void benchConversion(uint16_t width, uint16_t height, FOX5Image::ImageFormat format)
+    {
+        std::string label = std::to_string(width) + "x" + std::to_string(height) + " " + formatName(format);
+        FOX5Image image = makeImage(width, height, format);
+        uint16_t texWidth = textureSize(width);
+        uint16_t texHeight = textureSize(height);
+        size_t bytes = size_t(texWidth) * texHeight * 4;
+        int iterations = std::max<int>(4, static_cast<int>((64u << 20) / bytes));
+        {
+            BenchTimer timer;
+            for(int i = 0; i < iterations; i++)
+                stagedTextureData(image, texWidth, texHeight);
+            reportResult("texture convert staged " + label, timer, iterations, bytes * iterations);
+        }
+        {
+            // Into a buffer that already exists, like the texture's own
+            std::vector<uint8_t> texture(bytes);
+            BenchTimer timer;
+            for(int i = 0; i < iterations; i++)
+                fox5TextureData(image, texture.data(), texWidth, texHeight);
+            reportResult("texture convert fused " + label, timer, iterations, bytes * iterations);
+        }
+    }
+
+    const GPUFormat PALETTE_FORMATS[] = {GPUFormat::RGBA8, GPUFormat::RGBA5551, GPUFormat::RGB565, GPUFormat::RGBA4};
+
+    // One index at a time with the texel size looked up each time, what a
+    // straightforward palette loop does
+    void naiveExpand(uint8_t* dest, const uint8_t* indices, size_t count, const TexturePalette& palette)
+    {
+        for(size_t i = 0; i < count; i++)
+            std::memcpy(dest + i * palette.bytesPerTexel(), palette.texel(indices[i]), palette.bytesPerTexel());
+    }
+
+    // An 8-bit image through palette the long way: expand, pad, tile
+    std::vector<uint8_t> stagedPaletteData(const FOX5Image& image, uint16_t texWidth, uint16_t texHeight,
+                                           const TexturePalette& palette)
+    {
+        const int bpp = palette.bytesPerTexel();
+        std::vector<uint8_t> linear(size_t(image.mWidth) * image.mHeight * bpp);
+        naiveExpand(linear.data(), image.mData.data(), size_t(image.mWidth) * image.mHeight, palette);
+        // swizzleTexture reverses each texel on the way
+        for(size_t i = 0; i < linear.size(); i += bpp)
+            std::reverse(linear.begin() + i, linear.begin() + i + bpp);
+        uint8_t* pixels = padImage(linear.data(), image.mWidth, image.mHeight, bpp, texWidth, texHeight, 0xFF);
+        std::vector<uint8_t> result(size_t(texWidth) * texHeight * bpp);
+        swizzleTexture(result.data(), pixels, texWidth, texHeight, bpp);
+        delete[] pixels;
+        return result;
+    }
+
+    void checkPalette()
+    {
+        std::vector<uint8_t> indices = makeTexels(1027, 5);
+        for(auto format : PALETTE_FORMATS)
+        {
+            const TexturePalette& palette = TexturePalette::standard(format);
+            const int bpp = palette.bytesPerTexel();
+            if(bpp * 8 != gpuBitsPerPixel(format))
+                throw std::runtime_error("Palette texel size doesn't match its format");
+            
+            // Every entry against the format's bit layout
+            for(int index = 0; index < 256; index++)
+            {
+                const uint8_t* color = fox5palette[index];
+                uint32_t alpha = index == 0 ? 0 : 0xFF;
+                uint32_t expected;
+                if(format == GPUFormat::RGBA8)
+                    expected = (color[0] << 24) | (color[1] << 16) | (color[2] << 8) | alpha;
+                else if(format == GPUFormat::RGBA5551)
+                    expected = (((color[0] * 31 + 127) / 255) << 11) | (((color[1] * 31 + 127) / 255) << 6)
+                             | (((color[2] * 31 + 127) / 255) << 1) | (alpha >> 7);
+                else if(format == GPUFormat::RGB565)
+                    expected = (((color[0] * 31 + 127) / 255) << 11) | (((color[1] * 63 + 127) / 255) << 5)
+                             | ((color[2] * 31 + 127) / 255);
+                else
+                    expected = (((color[0] * 15 + 127) / 255) << 12) | (((color[1] * 15 + 127) / 255) << 8)
+                             | (((color[2] * 15 + 127) / 255) << 4) | (alpha >> 4);
+                uint32_t texel = 0;
+                for(int i = 0; i < bpp; i++)
+                    texel |= uint32_t(palette.texel(index)[i]) << (8 * i);
+                if(texel != expected)
+                    throw std::runtime_error(std::string("Palette texel wrong in ") + gpuFormatName(format));
+            }
+            
+            std::vector<uint8_t> expanded(indices.size() * bpp);
+            std::vector<uint8_t> expected(indices.size() * bpp);
+            palette.expand(expanded.data(), indices.data(), indices.size());
+            naiveExpand(expected.data(), indices.data(), indices.size(), palette);
+            if(expanded != expected)
+                throw std::runtime_error(std::string("Palette expand differs in ") + gpuFormatName(format));
+            
+            // Identity remap changes nothing, a real one only what it maps
+            uint8_t map[256];
+            for(int index = 0; index < 256; index++)
+                map[index] = static_cast<uint8_t>(index);
+            TexturePalette same = palette.remapped(map);
+            for(int index = 8; index < 16; index++)
+                map[index] = static_cast<uint8_t>(index + 100);
+            TexturePalette remapped = palette.remapped(map);
+            for(int index = 0; index < 256; index++)
+            {
+                bool mapped = index >= 8 && index < 16;
+                if(std::memcmp(same.texel(index), palette.texel(index), bpp)
+                   || std::memcmp(remapped.texel(index), palette.texel(mapped ? index + 100 : index), bpp))
+                    throw std::runtime_error(std::string("Palette remap wrong in ") + gpuFormatName(format));
+            }
+            
+            const uint16_t sizes[][2] = {{8, 8}, {1, 1}, {33, 65}, {7, 100}, {250, 3}};
+            for(auto& size : sizes)
+            {
+                FOX5Image image = makeImage(size[0], size[1], FOX5Image::ImageFormat::E_8BIT);
+                uint16_t texWidth = textureSize(size[0]);
+                uint16_t texHeight = textureSize(size[1]);
+                std::vector<uint8_t> texture(size_t(texWidth) * texHeight * bpp);
+                fox5TextureData(image, texture.data(), texWidth, texHeight, remapped);
+                if(texture != stagedPaletteData(image, texWidth, texHeight, remapped))
+                    throw std::runtime_error(std::string("Palette texture conversion differs at ")
+                                             + std::to_string(size[0]) + "x" + std::to_string(size[1])
+                                             + " " + gpuFormatName(format));
+                if(format == GPUFormat::RGBA8)
+                {
+                    fox5TextureData(image, texture.data(), texWidth, texHeight, palette);
+                    if(texture != stagedTextureData(image, texWidth, texHeight))
+                        throw std::runtime_error("Standard palette differs from the staged conversion");
+                }
+            }
+        }
+        
+        // 32-bit images have no indices to look up
+        FOX5Image image = makeImage(8, 8, FOX5Image::ImageFormat::E_32BIT);
+        std::vector<uint8_t> texture(8 * 8 * 2);
+        try
+        {
+            fox5TextureData(image, texture.data(), 8, 8, TexturePalette::standard(GPUFormat::RGBA4));
+        }
+        catch(const std::invalid_argument&)
+        {
+            return;
+        }
+        throw std::runtime_error("32-bit image converted through a palette");
+    }
+
+    // A 32-bit image packed texel by texel, then padded and tiled
+    std::vector<uint8_t> stagedPackedData(const FOX5Image& image, uint16_t texWidth, uint16_t texHeight,
+                                          GPUFormat format)
+    {
+        std::vector<uint8_t> linear(size_t(image.mWidth) * image.mHeight * 2);
+        for(size_t i = 0; i < size_t(image.mWidth) * image.mHeight; i++)
+        {
+            const uint8_t* argb = &image.mData[i * 4];
+            uint32_t texel;
+            if(format == GPUFormat::RGBA5551)
+                texel = packTexel<GPUFormat::RGBA5551>(argb[1], argb[2], argb[3], argb[0]);
+            else if(format == GPUFormat::RGB565)
+                texel = packTexel<GPUFormat::RGB565>(argb[1], argb[2], argb[3], argb[0]);
+            else
+                texel = packTexel<GPUFormat::RGBA4>(argb[1], argb[2], argb[3], argb[0]);
+            // Big end first, swizzleTexture turns it around
+            linear[i * 2] = static_cast<uint8_t>(texel >> 8);
+            linear[i * 2 + 1] = static_cast<uint8_t>(texel);
+        }
+        uint8_t* pixels = padImage(linear.data(), image.mWidth, image.mHeight, 2, texWidth, texHeight, 0xFF);
+        std::vector<uint8_t> result(size_t(texWidth) * texHeight * 2);
+        swizzleTexture(result.data(), pixels, texWidth, texHeight, 2);
+        delete[] pixels;
+        return result;
+    }
+
+    // A flat colored 32-bit image, texels picked by pattern from colors
+    FOX5Image makeFlatImage(const std::vector<uint32_t>& colors)
+    {
+        FOX5Image image(0, 0, 16, 16, FOX5Image::ImageFormat::E_32BIT);
+        image.mData.resize(image.getMemSize());
+        for(size_t i = 0; i < 256; i++)
+        {
+            uint32_t argb = colors[(i * 7 + i / 16) % colors.size()];
+            for(int c = 0; c < 4; c++)
+                image.mData[i * 4 + c] = static_cast<uint8_t>(argb >> (24 - 8 * c));
+        }
+        return image;
+    }
+
+    void checkFormats()
+    {
+        const uint16_t sizes[][2] = {{8, 8}, {1, 1}, {33, 65}, {7, 100}, {250, 3}};
+        for(auto format : {GPUFormat::RGBA5551, GPUFormat::RGB565, GPUFormat::RGBA4})
+        {
+            for(auto& size : sizes)
+            {
+                uint16_t texWidth = textureSize(size[0]);
+                uint16_t texHeight = textureSize(size[1]);
+                std::vector<uint8_t> texture(size_t(texWidth) * texHeight * 2);
+                FOX5Image image = makeImage(size[0], size[1], FOX5Image::ImageFormat::E_32BIT);
+                fox5TextureData(image, texture.data(), texWidth, texHeight, format);
+                if(texture != stagedPackedData(image, texWidth, texHeight, format))
+                    throw std::runtime_error(std::string("Texture conversion differs at ")
+                                             + std::to_string(size[0]) + "x" + std::to_string(size[1])
+                                             + " argb to " + gpuFormatName(format));
+                image = makeImage(size[0], size[1], FOX5Image::ImageFormat::E_8BIT);
+                fox5TextureData(image, texture.data(), texWidth, texHeight, format);
+                if(texture != stagedPaletteData(image, texWidth, texHeight, TexturePalette::standard(format)))
+                    throw std::runtime_error(std::string("Texture conversion differs at ")
+                                             + std::to_string(size[0]) + "x" + std::to_string(size[1])
+                                             + " 8bit to " + gpuFormatName(format));
+            }
+        }
+        
+        // Each kind of image lands in the smallest format that keeps it
+        struct Case
+        {
+            const char* mWhat;
+            std::vector<uint32_t> mColors; // ARGB
+            GPUFormat mExpected;
+        };
+        std::vector<uint32_t> ramp;
+        for(uint32_t level = 0; level < 256; level += 2)
+            ramp.push_back(0xFF000000u | (level << 16));
+        const Case cases[] = {
+            {"an opaque image", {0xFF102030, 0xFFFFFFFF, 0xFF808000}, GPUFormat::RGB565},
+            {"a cut out image", {0x00000000, 0xFF102030, 0xFFC08040}, GPUFormat::RGBA5551},
+            {"a 4-bit shadow", {0x00000000, 0x44000000, 0xFF336699}, GPUFormat::RGBA4},
+            {"antialiased edges", {0x00000000, 0x80000000, 0xFF336699}, GPUFormat::RGBA8},
+            {"a smooth ramp", ramp, GPUFormat::RGBA8},
+        };
+        for(auto& test : cases)
+        {
+            GPUFormat format = selectTextureFormat(analyzeTexture(makeFlatImage(test.mColors)));
+            if(format != test.mExpected)
+                throw std::runtime_error(std::string("Selected ") + gpuFormatName(format) + " for " + test.mWhat);
+        }
+        FOX5Image indexed(0, 0, 16, 16, FOX5Image::ImageFormat::E_8BIT);
+        indexed.mData.assign(256, 40);
+        if(selectTextureFormat(analyzeTexture(indexed)) != GPUFormat::RGB565)
+            throw std::runtime_error("Selected a format with alpha for an opaque 8-bit image");
+        indexed.mData[3] = 0;
+        if(selectTextureFormat(analyzeTexture(indexed)) != GPUFormat::RGBA5551)
+            throw std::runtime_error("Selected the wrong format for a cut out 8-bit image");
+        
+        TextureFormatPolicy policy;
+        policy.mOverrides[7] = GPUFormat::RGBA4;
+        if(policy.choose(7, indexed) != GPUFormat::RGBA4 || policy.choose(8, indexed) != GPUFormat::RGBA5551)
+            throw std::runtime_error("Format policy ignored an override");
+    }
+
+    void benchFormat(GPUFormat format)
+    {
+        FOX5Image image = makeImage(200, 300, FOX5Image::ImageFormat::E_32BIT);
+        uint16_t texWidth = textureSize(image.mWidth);
+        uint16_t texHeight = textureSize(image.mHeight);
+        size_t bytes = size_t(texWidth) * texHeight * gpuBitsPerPixel(format) / 8;
+        std::vector<uint8_t> texture(bytes);
+        const int conversions = 200;
+        {
+            BenchTimer timer;
+            for(int i = 0; i < conversions; i++)
+                fox5TextureData(image, texture.data(), texWidth, texHeight, format);
+            reportResult(std::string("texture convert 200x300 argb to ") + gpuFormatName(format), timer, conversions,
+                         bytes * conversions);
+        }
+    }
+
+    // Noise gives up on the first texel, a cut out sprite has to be counted
+    void benchAnalysis()
+    {
+        FOX5Image image(0, 0, 200, 300, FOX5Image::ImageFormat::E_32BIT);
+        image.mData.resize(image.getMemSize());
+        for(size_t i = 0; i < size_t(200) * 300; i++)
+        {
+            uint8_t band = static_cast<uint8_t>((i % 200) / 50);
+            uint8_t texel[4] = {uint8_t(band ? 0xFF : 0), uint8_t(band * 60), 0x40, uint8_t(i / 200 / 100 * 80)};
+            std::memcpy(&image.mData[i * 4], texel, 4);
+        }
+        const int iterations = 200;
+        BenchTimer timer;
+        GPUFormat format = GPUFormat::RGBA8;
+        for(int i = 0; i < iterations; i++)
+            format = selectTextureFormat(analyzeTexture(image));
+        reportResult("texture analyze 200x300 cut out sprite", timer, iterations, image.mData.size() * iterations);
+        if(format != GPUFormat::RGBA5551)
+            throw std::runtime_error("Cut out sprite wasn't given RGBA5551");
+    }
+
+    void benchPalette(GPUFormat format)
+    {
+        const TexturePalette& palette = TexturePalette::standard(format);
+        const size_t count = 1 << 20;
+        const int iterations = 16;
+        std::vector<uint8_t> indices = makeTexels(count, 3);
+        std::vector<uint8_t> dest(count * palette.bytesPerTexel());
+        std::string label = gpuFormatName(format);
+        {
+            BenchTimer timer;
+            for(int i = 0; i < iterations; i++)
+                naiveExpand(dest.data(), indices.data(), count, palette);
+            reportResult("palette expand naive " + label, timer, iterations, count * iterations);
+        }
+        {
+            BenchTimer timer;
+            for(int i = 0; i < iterations; i++)
+                palette.expand(dest.data(), indices.data(), count);
+            reportResult("palette expand " + label, timer, iterations, count * iterations);
+        }
+        
+        // A remapped 8-bit sprite straight to a tiled texture
+        FOX5Image image = makeImage(200, 300, FOX5Image::ImageFormat::E_8BIT);
+        uint16_t texWidth = textureSize(image.mWidth);
+        uint16_t texHeight = textureSize(image.mHeight);
+        size_t bytes = size_t(texWidth) * texHeight * palette.bytesPerTexel();
+        std::vector<uint8_t> texture(bytes);
+        const int conversions = 200;
+        BenchTimer timer;
+        for(int i = 0; i < conversions; i++)
+            fox5TextureData(image, texture.data(), texWidth, texHeight, palette);
+        reportResult("texture convert 200x300 8bit to " + label, timer, conversions, bytes * conversions);
+    }
+
+    // swizzleTexture has to give exactly what reverse_morton_order does
+    void checkSwizzle()
+    {
+        const int sizes[][2] = {{8, 8}, {16, 8}, {8, 32}, {64, 128}, {256, 64}, {1024, 1024}};
+        for(int bpp : {2, 3, 4})
+        {
+            for(auto& size : sizes)
+            {
+                std::vector<uint8_t> expected = makeTexels(size_t(size[0]) * size[1] * bpp, size[0] * 31 + bpp);
+                std::vector<uint8_t> source = expected;
+                reverse_morton_order(expected.data(), size[0], size[1], bpp);
+
+                std::vector<uint8_t> swizzled(source.size());
+                swizzleTexture(swizzled.data(), source.data(), size[0], size[1], bpp);
+                if(swizzled != expected)
+                    throw std::runtime_error("swizzleTexture differs from reverse_morton_order at "
+                                             + std::to_string(size[0]) + "x" + std::to_string(size[1])
+                                             + " " + std::to_string(bpp) + " bpp");
+            }
+        }
+    }
+
+    void benchSwizzle(int side, int bpp)
+    {
+        std::string label = std::to_string(side) + "x" + std::to_string(side) + " " + std::to_string(bpp) + " bpp";
+        size_t bytes = size_t(side) * side * bpp;
+        int iterations = std::max<int>(4, static_cast<int>((64u << 20) / bytes));
+        std::vector<uint8_t> source = makeTexels(bytes, 1);
+        std::vector<uint8_t> dest(bytes);
+        {
+            BenchTimer timer;
+            for(int i = 0; i < iterations; i++)
+                reverse_morton_order(source.data(), side, side, bpp);
+            reportResult("swizzle reverse_morton_order " + label, timer, iterations, bytes * iterations);
+        }
+        {
+            BenchTimer timer;
+            for(int i = 0; i < iterations; i++)
+                swizzleTexture(dest.data(), source.data(), side, side, bpp);
+            reportResult("swizzle swizzleTexture " + label, timer, iterations, bytes * iterations);
+        }
+    }
+}
+
+void benchTexture(const std::filesystem::path&)
+{
+    checkSwizzle();
+    checkConversion();
+    checkPalette();
+    checkFormats();
+    for(auto format : FORMATS)
+    {
+        benchConversion(33, 65, format);
+        benchConversion(200, 300, format);
+        benchConversion(1000, 1000, format);
+    }
+    for(auto format : PALETTE_FORMATS)
+        benchPalette(format);
+    for(auto format : PALETTE_FORMATS)
+        benchFormat(format);
+    benchAnalysis();
+    for(int side : {256, 1024})
+    {
+        for(int bpp : {2, 3, 4})
+            benchSwizzle(side, bpp);
+    }
+}
@@ -0,0 +1,105 @@
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include "bench.h"
+
+void benchLZMA();
+void benchFox5(const std::filesystem::path& workDir);
+void benchParse(const std::filesystem::path& workDir);
+void benchDream(const std::filesystem::path& workDir);
+void benchPack(const std::filesystem::path& workDir);
+void benchAtlas(const std::filesystem::path& workDir);
+void benchTexture(const std::filesystem::path& workDir);
+void benchCache(const std::filesystem::path& workDir);
+
+namespace
+{
+    struct Suite
+    {
+        const char* mName;
+        std::function<void(const std::filesystem::path&)> mRun;
+    };
+
+    const Suite SUITES[] = {
+        {"lzma", [](const std::filesystem::path&) { benchLZMA(); }},
+        {"fox5", benchFox5},
+        {"parse", benchParse},
+        {"dream", benchDream},
+        {"pack", benchPack},
+        {"atlas", benchAtlas},
+        {"texture", benchTexture},
+        {"cache", benchCache},
+    };
+
+    void usage(const char* program)
+    {
+        fprintf(stderr, "Usage: %s [--suite name]... [--json file] [--csv file] [work folder]\n", program);
+        fprintf(stderr, "Suites:");
+        for(auto& suite : SUITES)
+            fprintf(stderr, " %s", suite.mName);
+        fprintf(stderr, "\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::filesystem::path workDir = std::filesystem::temp_directory_path() / "furcformats_bench";
+    std::set<std::string> suites;
+    std::string jsonFile, csvFile;
+
+    for(int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if(std::strcmp(argv[i], "--suite") == 0 && hasValue)
+            suites.insert(argv[++i]);
+        else if(std::strcmp(argv[i], "--json") == 0 && hasValue)
+            jsonFile = argv[++i];
+        else if(std::strcmp(argv[i], "--csv") == 0 && hasValue)
+            csvFile = argv[++i];
+        else if(argv[i][0] != '-')
+            workDir = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for(auto& name : suites)
+    {
+        bool known = false;
+        for(auto& suite : SUITES)
+            known |= name == suite.mName;
+        if(!known)
+        {
+            fprintf(stderr, "Unknown suite %s\n", name.c_str());
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    std::filesystem::create_directories(workDir);
+
+    try
+    {
+        for(auto& suite : SUITES)
+        {
+            if(suites.empty() || suites.count(suite.mName))
+                suite.mRun(workDir);
+        }
+        printf("%-48s %10llu KiB\n", "peak RSS", static_cast<unsigned long long>(peakRSS()));
+
+        if(!jsonFile.empty())
+            writeReportJSON(jsonFile);
+        if(!csvFile.empty())
+            writeReportCSV(csvFile);
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "Benchmark failed: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
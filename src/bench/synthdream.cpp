@@ -0,0 +1,68 @@
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include "synthdream.h"
+
+uint16_t synthDreamValue(const SynthDreamOptions& options, int layer, size_t i)
+{
+    // Cheap integer hash, so every layer and tile differs without a table
+    uint32_t x = static_cast<uint32_t>(i) * 2654435761u ^ (options.mSeed + layer * 0x9E3779B9u);
+    x ^= x >> 15;
+    x *= 0x2C1B3C6Du;
+    x ^= x >> 12;
+    switch(layer)
+    {
+        case 0: return x % 500;                 // Floors
+        case 1: return (x & 7) ? 0 : x % 4000;  // Objects, mostly empty
+        case 2: return x & 0xFFFF;              // Both walls
+        default: return (x & 3) ? 0 : x % 100;
+    }
+}
+
+std::vector<uint8_t> buildSynthDream(const SynthDreamOptions& options)
+{
+    char header[256];
+    int headerSize = snprintf(header, sizeof(header),
+        "MAP V01.%02d Furcadia\n"
+        "width=%u\n"
+        "height=%u\n"
+        "revision=1\n"
+        "patcht=0\n"
+        "name=Synthetic %ux%u\n"
+        "allowlarge=1\n"
+        "rating=Clean\n"
+        "BODY\n",
+        options.mVersionMinor, options.mWidth, options.mHeight, options.mWidth, options.mHeight);
+
+    int layers = 3;
+    if(options.mVersionMinor >= 30)
+        layers += 2;
+    if(options.mVersionMinor >= 50)
+        layers += 2;
+
+    size_t tiles = size_t(options.mWidth) * options.mHeight;
+    std::vector<uint8_t> data(header, header + headerSize);
+    data.reserve(headerSize + tiles * 2 * layers);
+
+    for(int layer = 0; layer < layers; layer++)
+    {
+        for(size_t i = 0; i < tiles; i++)
+        {
+            uint16_t value = synthDreamValue(options, layer, i);
+            data.push_back(static_cast<uint8_t>(value));
+            data.push_back(static_cast<uint8_t>(value >> 8));
+        }
+    }
+    return data;
+}
+
+void writeSynthDream(const std::string& filename, const SynthDreamOptions& options)
+{
+    std::vector<uint8_t> data = buildSynthDream(options);
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file || !file.is_open())
+        throw std::runtime_error("Failed to open " + filename + " for writing.");
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!file)
+        throw std::runtime_error("Failed to write " + filename + ".");
+}
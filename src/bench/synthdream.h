@@ -0,0 +1,24 @@
+#ifndef SYNTHDREAM_H
+#define SYNTHDREAM_H
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Shape of a generated, unencoded .map file
+struct SynthDreamOptions
+{
+    uint16_t mWidth = 52;
+    uint16_t mHeight = 100;
+    uint8_t mVersionMinor = 50; // 1.xx, decides which layers are written
+    uint32_t mSeed = 1;
+};
+
+std::vector<uint8_t> buildSynthDream(const SynthDreamOptions& options);
+void writeSynthDream(const std::string& filename, const SynthDreamOptions& options);
+
+// The value buildSynthDream puts at tile index i of a layer, in file order:
+// 0 floors, 1 objects, 2 walls (NE in the low byte), 3 regions, 4 effects,
+// 5 lighting, 6 ambient
+uint16_t synthDreamValue(const SynthDreamOptions& options, int layer, size_t i);
+
+#endif // SYNTHDREAM_H
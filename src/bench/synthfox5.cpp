@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "bench.h"
+#include "synthfox5.h"
+
+namespace
+{
+    // Minimal LZMA range encoder, mirrors the bit model in LzmaDec.c
+    class RangeEncoder
+    {
+    public:
+        std::vector<uint8_t>& mOut;
+        uint64_t mLow = 0;
+        uint32_t mRange = 0xFFFFFFFF;
+        uint8_t mCache = 0;
+        uint64_t mCacheSize = 1;
+
+        RangeEncoder(std::vector<uint8_t>& out) : mOut(out) {};
+
+        void shiftLow()
+        {
+            if(static_cast<uint32_t>(mLow) < 0xFF000000 || (mLow >> 32) != 0)
+            {
+                uint8_t temp = mCache;
+                do
+                {
+                    mOut.push_back(static_cast<uint8_t>(temp + static_cast<uint8_t>(mLow >> 32)));
+                    temp = 0xFF;
+                } while(--mCacheSize != 0);
+                mCache = static_cast<uint8_t>(static_cast<uint32_t>(mLow) >> 24);
+            }
+            mCacheSize++;
+            mLow = (mLow & 0x00FFFFFF) << 8;
+        };
+
+        void encodeBit(uint16_t& prob, uint32_t bit)
+        {
+            uint32_t bound = (mRange >> 11) * prob;
+            if(bit == 0)
+            {
+                mRange = bound;
+                prob += (2048 - prob) >> 5;
+            }
+            else
+            {
+                mLow += bound;
+                mRange -= bound;
+                prob -= prob >> 5;
+            }
+            while(mRange < (1u << 24))
+            {
+                mRange <<= 8;
+                shiftLow();
+            }
+        };
+
+        void flush()
+        {
+            for(int i = 0; i < 5; i++)
+                shiftLow();
+        };
+    };
+
+    void writeUint8(std::vector<uint8_t>& out, uint8_t v)
+    {
+        out.push_back(v);
+    }
+
+    void writeUint16(std::vector<uint8_t>& out, uint16_t v)
+    {
+        out.push_back(static_cast<uint8_t>(v >> 8));
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    void writeUint32(std::vector<uint8_t>& out, uint32_t v)
+    {
+        out.push_back(static_cast<uint8_t>(v >> 24));
+        out.push_back(static_cast<uint8_t>(v >> 16));
+        out.push_back(static_cast<uint8_t>(v >> 8));
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    void writeString(std::vector<uint8_t>& out, const std::string& v)
+    {
+        writeUint16(out, static_cast<uint16_t>(v.size()));
+        out.insert(out.end(), v.begin(), v.end());
+    }
+
+    void writeCommand(std::vector<uint8_t>& out, FOX5Command::Command cmd)
+    {
+        out.push_back(static_cast<uint8_t>(cmd));
+    }
+
+    void writeListStart(std::vector<uint8_t>& out, uint8_t level, uint32_t count)
+    {
+        writeCommand(out, FOX5Command::Command::LIST_START);
+        writeUint8(out, level);
+        writeUint32(out, count);
+    }
+
+    std::vector<uint8_t> makeImage(const SynthFox5Options& options, uint32_t index)
+    {
+        size_t bpp = options.mImageFormat == FOX5Image::ImageFormat::E_32BIT ? 4 : 1;
+        std::vector<uint8_t> pixels(options.mImageWidth * options.mImageHeight * bpp);
+        uint32_t state = options.mSeed * 2654435761u + index + 1;
+        if(!options.mSpriteImages)
+        {
+            for(size_t i = 0; i < pixels.size(); i++)
+                pixels[i] = static_cast<uint8_t>(nextRandom(state));
+            return pixels;
+        }
+        
+        // A disc of four color bands. Channels are multiples of 17 so the
+        // colors stay apart in any 16-bit format.
+        uint8_t colors[4][4];
+        for(auto& color : colors)
+        {
+            color[0] = 0xFF;
+            for(int c = 1; c < 4; c++)
+                color[c] = static_cast<uint8_t>(nextRandom(state) % 16 * 17);
+        }
+        uint32_t kind = index % 4;
+        int width = options.mImageWidth;
+        int height = options.mImageHeight;
+        for(int y = 0; y < height; y++)
+        {
+            for(int x = 0; x < width; x++)
+            {
+                int dx = 2 * x - width;
+                int dy = 2 * y - height;
+                int distance = (dx * dx + dy * dy) * 16 / (width * width + height * height + 1);
+                uint8_t* pixel = &pixels[(size_t(y) * width + x) * bpp];
+                if(bpp == 1)
+                {
+                    // Even images opaque, odd ones cut out
+                    bool visible = distance < 4 || index % 2 == 0;
+                    pixel[0] = visible ? static_cast<uint8_t>(16 + 8 * std::min(distance, 3) + index % 8) : 0;
+                    continue;
+                }
+                std::memcpy(pixel, colors[std::min(distance, 3)], 4);
+                if(kind == 1 && distance >= 4)
+                    pixel[0] = 0;
+                else if(kind == 2 && distance >= 4)
+                    pixel[0] = 0x44;
+                else if(kind == 3)
+                    pixel[0] = static_cast<uint8_t>(std::max(0, 255 - distance * 23));
+            }
+        }
+        return pixels;
+    }
+
+    std::vector<uint8_t> compress(const SynthFox5Options& options, const std::vector<uint8_t>& data)
+    {
+        if(options.mCompression == FOX5::CompressionType::LZMA)
+            return encodeLZMALiterals(data.data(), data.size());
+        if(options.mCompression != FOX5::CompressionType::NOT)
+            throw std::runtime_error("Synthetic FOX5 only supports LZMA or no compression");
+        return data;
+    }
+}
+
+std::vector<uint8_t> encodeLZMALiterals(const uint8_t* data, size_t size)
+{
+    // lc=3, lp=0, pb=2 is the standard "0x5D" props byte
+    const unsigned lc = 3;
+    const unsigned pb = 2;
+    const uint32_t dictSize = 1 << 16;
+
+    std::vector<uint8_t> out;
+    out.reserve(13 + size + size / 8 + 16);
+    out.push_back(static_cast<uint8_t>((pb * 5) * 9 + lc));
+    for(int i = 0; i < 4; i++)
+        out.push_back(static_cast<uint8_t>(dictSize >> (i * 8)));
+    for(int i = 0; i < 8; i++)
+        out.push_back(static_cast<uint8_t>(static_cast<uint64_t>(size) >> (i * 8)));
+
+    // State never leaves 0 when only literals are emitted
+    std::vector<uint16_t> isMatch(16 << 4, 1024);
+    std::vector<uint16_t> literal(0x300 << lc, 1024);
+
+    RangeEncoder rc(out);
+    uint8_t prevByte = 0;
+    for(size_t pos = 0; pos < size; pos++)
+    {
+        rc.encodeBit(isMatch[pos & ((1 << pb) - 1)], 0);
+
+        uint16_t* probs = &literal[0x300 * (prevByte >> (8 - lc))];
+        uint32_t symbol = 1;
+        uint8_t byte = data[pos];
+        for(int i = 7; i >= 0; i--)
+        {
+            uint32_t bit = (byte >> i) & 1;
+            rc.encodeBit(probs[symbol], bit);
+            symbol = (symbol << 1) | bit;
+        }
+        prevByte = byte;
+    }
+    rc.flush();
+    return out;
+}
+
+std::vector<uint8_t> buildSynthCommandBlock(const SynthFox5Options& options, const std::vector<uint32_t>& imageSizes)
+{
+    using Command = FOX5Command::Command;
+
+    std::vector<uint8_t> block;
+    block.insert(block.end(), {'F', 'O', 'X', '5'});
+    writeListStart(block, 0, 1);
+
+    writeCommand(block, Command::FILE_GENERATOR);
+    writeUint8(block, 0);
+
+    writeCommand(block, Command::FILE_IMAGE_LIST);
+    writeUint32(block, options.mImages);
+    for(uint32_t i = 0; i < options.mImages; i++)
+    {
+        writeUint32(block, i < imageSizes.size() ? imageSizes[i] : 0);
+        writeUint16(block, options.mImageWidth);
+        writeUint16(block, options.mImageHeight);
+        writeUint8(block, static_cast<uint8_t>(options.mImageFormat));
+    }
+
+    uint32_t imageID = 0;
+    writeListStart(block, 1, options.mObjects);
+    for(uint32_t o = 0; o < options.mObjects; o++)
+    {
+        writeCommand(block, Command::OBJECT_IDENTIFIER);
+        writeUint32(block, o);
+        writeCommand(block, Command::OBJECT_NAME);
+        writeString(block, "Object " + std::to_string(o));
+        writeCommand(block, Command::OBJECT_KEYWORDS);
+        writeUint16(block, 2);
+        writeString(block, "synthetic");
+        writeString(block, "bench");
+        writeCommand(block, Command::OBJECT_FLAGS);
+        writeUint8(block, 0x01);
+
+        writeListStart(block, 2, options.mShapesPerObject);
+        for(uint32_t s = 0; s < options.mShapesPerObject; s++)
+        {
+            writeCommand(block, Command::SHAPE_PURPOSE);
+            writeUint8(block, static_cast<uint8_t>(FOX5Shape::Purpose::ITEM));
+            writeCommand(block, Command::SHAPE_DIRECTION);
+            writeUint8(block, static_cast<uint8_t>(FOX5Shape::Direction::NO_DIRECTION));
+            writeCommand(block, Command::SHAPE_KITTERSPEAK);
+            writeUint16(block, 1);
+            writeUint16(block, 1);
+            writeUint16(block, 0);
+            writeUint16(block, 0);
+
+            writeListStart(block, 3, options.mFramesPerShape);
+            for(uint32_t f = 0; f < options.mFramesPerShape; f++)
+            {
+                writeCommand(block, Command::FRAME_OFFSET);
+                writeUint16(block, 0);
+                writeUint16(block, 0);
+
+                writeListStart(block, 4, options.mChannelsPerFrame);
+                for(uint32_t c = 0; c < options.mChannelsPerFrame; c++)
+                {
+                    writeCommand(block, Command::CHANNEL_PURPOSE);
+                    writeUint16(block, 0);
+                    writeCommand(block, Command::CHANNEL_IMAGE_ID);
+                    writeUint16(block, static_cast<uint16_t>(options.mImages ? imageID++ % options.mImages : 0));
+                    writeCommand(block, Command::CHANNEL_OFFSET);
+                    writeUint16(block, 0);
+                    writeUint16(block, 0);
+                    writeCommand(block, Command::LIST_END);
+                }
+                writeCommand(block, Command::LIST_END);
+            }
+            writeCommand(block, Command::LIST_END);
+        }
+        writeCommand(block, Command::LIST_END);
+    }
+    writeCommand(block, Command::LIST_END);
+    return block;
+}
+
+std::vector<uint8_t> buildSynthFox5(const SynthFox5Options& options)
+{
+    std::vector<std::vector<uint8_t>> images(options.mImages);
+    std::vector<uint32_t> imageSizes(options.mImages);
+    for(uint32_t i = 0; i < options.mImages; i++)
+    {
+        images[i] = compress(options, makeImage(options, i));
+        imageSizes[i] = static_cast<uint32_t>(images[i].size());
+    }
+
+    std::vector<uint8_t> block = buildSynthCommandBlock(options, imageSizes);
+    std::vector<uint8_t> compressedBlock = compress(options, block);
+
+    std::vector<uint8_t> file = compressedBlock;
+    for(auto& image : images)
+        file.insert(file.end(), image.begin(), image.end());
+
+    writeUint8(file, static_cast<uint8_t>(options.mCompression));
+    writeUint8(file, static_cast<uint8_t>(FOX5::EncryptionType::NOT));
+    writeUint16(file, 0);
+    writeUint32(file, static_cast<uint32_t>(compressedBlock.size()));
+    writeUint32(file, static_cast<uint32_t>(block.size()));
+    file.insert(file.end(), {'F', 'O', 'X', '5', '.', '1', '.', '1'});
+    return file;
+}
+
+void writeSynthFox5(const std::string& filename, const SynthFox5Options& options)
+{
+    std::vector<uint8_t> data = buildSynthFox5(options);
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file || !file.is_open())
+        throw std::runtime_error("Failed to open " + filename + " for writing.");
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!file)
+        throw std::runtime_error("Failed to write " + filename + ".");
+}
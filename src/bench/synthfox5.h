@@ -0,0 +1,39 @@
+#ifndef SYNTHFOX5_H
+#define SYNTHFOX5_H
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "fox5.h"
+
+// Shape of a generated FOX5 file. Every level gets the same fan-out so the
+// size of the tree is easy to reason about in results.
+struct SynthFox5Options
+{
+    uint32_t mObjects = 64;
+    uint32_t mShapesPerObject = 2;
+    uint32_t mFramesPerShape = 2;
+    uint32_t mChannelsPerFrame = 1;
+
+    uint32_t mImages = 64;
+    uint16_t mImageWidth = 32;
+    uint16_t mImageHeight = 32;
+    FOX5Image::ImageFormat mImageFormat = FOX5Image::ImageFormat::E_32BIT;
+    // Flat colored shapes like real sprites instead of noise, taking turns
+    // at being opaque, cut out, shadowed and antialiased
+    bool mSpriteImages = false;
+
+    FOX5::CompressionType mCompression = FOX5::CompressionType::LZMA;
+    uint32_t mSeed = 1;
+};
+
+// Encodes data as a valid LZMA "Alone" stream using literals only. It doesn't
+// compress, but it exercises the real decoder without needing an encoder lib.
+std::vector<uint8_t> encodeLZMALiterals(const uint8_t* data, size_t size);
+
+// The decoded command block on its own, as FOX5::FOX5 sees it. Images
+// missing from imageSizes are listed with a zero compressed size.
+std::vector<uint8_t> buildSynthCommandBlock(const SynthFox5Options& options, const std::vector<uint32_t>& imageSizes = {});
+std::vector<uint8_t> buildSynthFox5(const SynthFox5Options& options);
+void writeSynthFox5(const std::string& filename, const SynthFox5Options& options);
+
+#endif // SYNTHFOX5_H
@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <string>
+#include "fox5.h"
+#include "fox5pack.h"
+
+static void printUsage()
+{
+    fprintf(stderr,
+            "Usage: fox5pack [-j threads] [-f [id=]format]... <input.fox> [output.f5p]\n"
+            "       fox5pack [-j threads] [-f format] --all <input.fox>...\n"
+            "Formats: rgba8, rgba5551, rgb565, rgba4. Without -f each image gets the\n"
+            "smallest one that keeps its alpha and all of its colors.\n");
+}
+
+static void packFile(const std::string& input, const std::string& output, unsigned threads,
+                     const TextureFormatPolicy& policy)
+{
+    auto start = std::chrono::steady_clock::now();
+    FOX5 fox(input, FOX5::LoadMode::MAPPED);
+    FOX5Pack::write(fox, output, threads, policy);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    FOX5Pack pack(output);
+    uint64_t texels = 0;
+    uint64_t rgba8Texels = 0;
+    std::map<GPUFormat, uint32_t> formats;
+    for(uint32_t id = 0; id < pack.imageCount(); id++)
+    {
+        const FOX5Pack::Image& image = pack.image(id);
+        texels += image.mSize;
+        rgba8Texels += uint64_t(image.mTexWidth) * image.mTexHeight * 4;
+        formats[image.mFormat]++;
+    }
+    printf("%s: %zu images, %zu objects, %llu -> %llu bytes (%llu of texels) in %.3f s\n",
+           output.c_str(), pack.imageCount(), pack.objectCount(),
+           static_cast<unsigned long long>(std::filesystem::file_size(input)),
+           static_cast<unsigned long long>(std::filesystem::file_size(output)),
+           static_cast<unsigned long long>(texels), seconds);
+    printf("  texture memory %llu bytes, %llu as rgba8, %llu saved;",
+           static_cast<unsigned long long>(texels), static_cast<unsigned long long>(rgba8Texels),
+           static_cast<unsigned long long>(rgba8Texels - texels));
+    for(auto& [format, count] : formats)
+        printf(" %s %u", gpuFormatName(format), count);
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        unsigned threads = 0;
+        TextureFormatPolicy policy;
+        int arg = 1;
+        while(arg + 1 < argc && (strcmp(argv[arg], "-j") == 0 || strcmp(argv[arg], "-f") == 0))
+        {
+            std::string value = argv[arg + 1];
+            if(argv[arg][1] == 'j')
+                threads = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+            else if(size_t equals = value.find('='); equals != std::string::npos)
+                policy.mOverrides[static_cast<uint32_t>(std::stoul(value.substr(0, equals)))]
+                    = parseGPUFormat(value.substr(equals + 1));
+            else
+                policy.mDefault = parseGPUFormat(value);
+            arg += 2;
+        }
+        
+        if(arg < argc && strcmp(argv[arg], "--all") == 0)
+        {
+            if(arg + 1 >= argc)
+            {
+                printUsage();
+                return 2;
+            }
+            for(arg++; arg < argc; arg++)
+                packFile(argv[arg], std::filesystem::path(argv[arg]).replace_extension(".f5p").string(), threads,
+                         policy);
+            return 0;
+        }
+        
+        if(argc - arg != 1 && argc - arg != 2)
+        {
+            printUsage();
+            return 2;
+        }
+        std::string input = argv[arg];
+        std::string output = argc - arg == 2 ? argv[arg + 1]
+                                             : std::filesystem::path(input).replace_extension(".f5p").string();
+        packFile(input, output, threads, policy);
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "fox5pack failed: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include "atlaspacker.h"
+#include <algorithm>
+#include <stdexcept>
+#include "texturelayout.h"
+
+namespace
+{
+    uint16_t alignUp(uint16_t value, uint16_t alignment)
+    {
+        return static_cast<uint16_t>((value + alignment - 1) / alignment * alignment);
+    }
+    
+    bool intersects(const AtlasPacker::Rect& a, const AtlasPacker::Rect& b)
+    {
+        return a.mX < b.mX + b.mWidth && b.mX < a.mX + a.mWidth
+            && a.mY < b.mY + b.mHeight && b.mY < a.mY + a.mHeight;
+    }
+    
+    bool contains(const AtlasPacker::Rect& outer, const AtlasPacker::Rect& inner)
+    {
+        return inner.mX >= outer.mX && inner.mY >= outer.mY
+            && inner.mX + inner.mWidth <= outer.mX + outer.mWidth
+            && inner.mY + inner.mHeight <= outer.mY + outer.mHeight;
+    }
+    
+    // Drops free rects that sit inside another one
+    void prune(std::vector<AtlasPacker::Rect>& rects)
+    {
+        for(size_t i = 0; i < rects.size(); i++)
+        {
+            for(size_t j = i + 1; j < rects.size(); j++)
+            {
+                if(contains(rects[j], rects[i]))
+                {
+                    rects.erase(rects.begin() + i);
+                    i--;
+                    break;
+                }
+                if(contains(rects[i], rects[j]))
+                {
+                    rects.erase(rects.begin() + j);
+                    j--;
+                }
+            }
+        }
+    }
+}
+
+AtlasPacker::AtlasPacker(uint16_t pageSize, uint32_t maxPages, uint16_t alignment)
+    : mPageSize(pageSize), mMaxPages(maxPages), mAlignment(alignment)
+{
+    if(alignment == 0 || pageSize % alignment != 0)
+        throw std::runtime_error("Atlas page size must be a multiple of the alignment");
+}
+
+std::optional<AtlasPacker::Placement> AtlasPacker::insert(uint16_t width, uint16_t height)
+{
+    uint16_t cellWidth = alignUp(std::max<uint16_t>(width, 1), mAlignment);
+    uint16_t cellHeight = alignUp(std::max<uint16_t>(height, 1), mAlignment);
+    if(width > mPageSize || height > mPageSize)
+        return std::nullopt;
+    
+    // Best short side fit over every page, ties go to the longer side
+    size_t bestPage = mPages.size();
+    Rect bestRect;
+    int bestShort = mPageSize + 1;
+    int bestLong = mPageSize + 1;
+    for(size_t p = 0; p < mPages.size(); p++)
+    {
+        for(auto& free : mPages[p].mFree)
+        {
+            if(free.mWidth < cellWidth || free.mHeight < cellHeight)
+                continue;
+            int leftX = free.mWidth - cellWidth;
+            int leftY = free.mHeight - cellHeight;
+            int shortSide = std::min(leftX, leftY);
+            int longSide = std::max(leftX, leftY);
+            if(shortSide < bestShort || (shortSide == bestShort && longSide < bestLong))
+            {
+                bestPage = p;
+                bestRect = free;
+                bestShort = shortSide;
+                bestLong = longSide;
+            }
+        }
+    }
+    
+    if(bestPage == mPages.size())
+    {
+        if(mMaxPages && mPages.size() >= mMaxPages)
+            return std::nullopt;
+        mPages.emplace_back();
+        resetPage(mPages.back());
+        bestRect = mPages.back().mFree.front();
+        mStats.mPages++;
+        mStats.mPageArea += uint64_t(mPageSize) * mPageSize;
+    }
+    
+    Placement placement;
+    placement.mPage = static_cast<uint32_t>(bestPage);
+    placement.mCell = {bestRect.mX, bestRect.mY, cellWidth, cellHeight};
+    placement.mWidth = width;
+    placement.mHeight = height;
+    place(mPages[bestPage], placement.mCell);
+    
+    mStats.mPlacements++;
+    mStats.mCellArea += uint64_t(cellWidth) * cellHeight;
+    mStats.mImageArea += uint64_t(width) * height;
+    mStats.mSeparateArea += uint64_t(textureSize(width)) * textureSize(height);
+    return placement;
+}
+
+void AtlasPacker::remove(const Placement& placement)
+{
+    if(placement.mPage >= mPages.size())
+        throw std::runtime_error("Atlas page out of bounds");
+    Page& page = mPages[placement.mPage];
+    if(page.mPlacements == 0)
+        throw std::runtime_error("Atlas page has nothing to remove");
+    
+    if(--page.mPlacements == 0)
+        resetPage(page);
+    else
+        release(page, placement.mCell);
+    
+    mStats.mPlacements--;
+    mStats.mCellArea -= uint64_t(placement.mCell.mWidth) * placement.mCell.mHeight;
+    mStats.mImageArea -= uint64_t(placement.mWidth) * placement.mHeight;
+    mStats.mSeparateArea -= uint64_t(textureSize(placement.mWidth)) * textureSize(placement.mHeight);
+}
+
+void AtlasPacker::clear()
+{
+    mPages.clear();
+    mStats = Stats();
+}
+
+void AtlasPacker::clip(const Placement& placement, float result[4]) const
+{
+    float scale = 1.0f / mPageSize;
+    result[0] = placement.mCell.mX * scale;
+    result[1] = placement.mCell.mY * scale;
+    result[2] = (placement.mCell.mX + placement.mWidth) * scale;
+    result[3] = (placement.mCell.mY + placement.mHeight) * scale;
+}
+
+void AtlasPacker::resetPage(Page& page)
+{
+    page.mFree.assign(1, Rect{0, 0, mPageSize, mPageSize});
+    page.mPlacements = 0;
+}
+
+void AtlasPacker::place(Page& page, const Rect& cell)
+{
+    // Every free rect the cell overlaps splits into the up to four
+    // maximal rects around it
+    std::vector<Rect> next;
+    next.reserve(page.mFree.size() + 4);
+    for(auto& free : page.mFree)
+    {
+        if(!intersects(free, cell))
+        {
+            next.push_back(free);
+            continue;
+        }
+        int freeRight = free.mX + free.mWidth;
+        int freeBottom = free.mY + free.mHeight;
+        int cellRight = cell.mX + cell.mWidth;
+        int cellBottom = cell.mY + cell.mHeight;
+        if(cell.mX > free.mX)
+            next.push_back({free.mX, free.mY, static_cast<uint16_t>(cell.mX - free.mX), free.mHeight});
+        if(cellRight < freeRight)
+            next.push_back({static_cast<uint16_t>(cellRight), free.mY, static_cast<uint16_t>(freeRight - cellRight), free.mHeight});
+        if(cell.mY > free.mY)
+            next.push_back({free.mX, free.mY, free.mWidth, static_cast<uint16_t>(cell.mY - free.mY)});
+        if(cellBottom < freeBottom)
+            next.push_back({free.mX, static_cast<uint16_t>(cellBottom), free.mWidth, static_cast<uint16_t>(freeBottom - cellBottom)});
+    }
+    prune(next);
+    page.mFree = std::move(next);
+    page.mPlacements++;
+}
+
+void AtlasPacker::release(Page& page, const Rect& cell)
+{
+    // Not a full MaxRects rebuild, the freed cell is grown by merging free
+    // rects that share a whole edge with it
+    Rect merged = cell;
+    bool grew = true;
+    while(grew)
+    {
+        grew = false;
+        for(auto& free : page.mFree)
+        {
+            if(free.mX == merged.mX && free.mWidth == merged.mWidth
+               && (free.mY + free.mHeight == merged.mY || merged.mY + merged.mHeight == free.mY))
+            {
+                merged.mY = std::min(merged.mY, free.mY);
+                merged.mHeight = static_cast<uint16_t>(merged.mHeight + free.mHeight);
+                grew = true;
+            }
+            else if(free.mY == merged.mY && free.mHeight == merged.mHeight
+                    && (free.mX + free.mWidth == merged.mX || merged.mX + merged.mWidth == free.mX))
+            {
+                merged.mX = std::min(merged.mX, free.mX);
+                merged.mWidth = static_cast<uint16_t>(merged.mWidth + free.mWidth);
+                grew = true;
+            }
+        }
+    }
+    page.mFree.push_back(merged);
+    prune(page.mFree);
+}
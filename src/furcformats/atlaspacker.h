@@ -0,0 +1,78 @@
+#ifndef ATLASPACKER_H
+#define ATLASPACKER_H
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Places sprites on shared square pages with MaxRects (best short side
+// fit). Cells are rounded up to whole tiles so each one can be written
+// into a tiled texture on its own, see writeTiledRect. Freed cells go back
+// on their page's free list and a page that empties out starts over.
+class AtlasPacker
+{
+public:
+    struct Rect
+    {
+        uint16_t mX = 0;
+        uint16_t mY = 0;
+        uint16_t mWidth = 0;
+        uint16_t mHeight = 0;
+    };
+    
+    struct Placement
+    {
+        uint32_t mPage = 0;
+        Rect mCell; // Tile aligned, what the packer hands out
+        uint16_t mWidth = 0; // What was asked for, at the cell's top left
+        uint16_t mHeight = 0;
+    };
+    
+    struct Stats
+    {
+        uint32_t mPages = 0;
+        uint32_t mPlacements = 0;
+        uint64_t mPageArea = 0;
+        uint64_t mCellArea = 0;
+        uint64_t mImageArea = 0;
+        // Texels a texture per image would take, each side padded to a
+        // power of two
+        uint64_t mSeparateArea = 0;
+        
+        double efficiency() const { return mPageArea ? double(mImageArea) / mPageArea : 0.0; };
+    };
+    
+    // maxPages = 0 for no limit
+    AtlasPacker(uint16_t pageSize = 256, uint32_t maxPages = 0, uint16_t alignment = 8);
+    
+    // nullopt if it is bigger than a page or every page allowed is full
+    std::optional<Placement> insert(uint16_t width, uint16_t height);
+    void remove(const Placement& placement);
+    void clear();
+    
+    uint16_t pageSize() const { return mPageSize; };
+    uint32_t pageCount() const { return static_cast<uint32_t>(mPages.size()); };
+    const Stats& stats() const { return mStats; };
+    
+    // Texture coordinates of a placement in the Texture::mClip order,
+    // left, top, right, bottom
+    void clip(const Placement& placement, float result[4]) const;
+    
+protected:
+    struct Page
+    {
+        std::vector<Rect> mFree;
+        uint32_t mPlacements = 0;
+    };
+    
+    uint16_t mPageSize;
+    uint32_t mMaxPages;
+    uint16_t mAlignment;
+    std::vector<Page> mPages;
+    Stats mStats;
+    
+    void resetPage(Page& page);
+    void place(Page& page, const Rect& cell);
+    void release(Page& page, const Rect& cell);
+};
+
+#endif // ATLASPACKER_H
@@ -0,0 +1,123 @@
+#ifndef BYTEREADER_H
+#define BYTEREADER_H
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+// Bounds checked cursor over a byte buffer that it doesn't own. Order is
+// the byte order of the data, fixed at compile time so a read is one load
+// plus a byte swap when the host differs.
+//
+// get() checks every field. For fixed size records call need() once and
+// use getUnchecked() for the fields inside it. Strings and byte runs come
+// back as views into the buffer, so they're only valid as long as it is.
+template <std::endian Order>
+class ByteReader
+{
+public:
+    const uint8_t* mPointer;
+    const uint8_t* mEnd;
+
+    ByteReader(const uint8_t* data, size_t size) : mPointer(data), mEnd(data + size) {};
+    ByteReader(std::span<const uint8_t> data) : ByteReader(data.data(), data.size()) {};
+
+    size_t remaining() const
+    {
+        return static_cast<size_t>(mEnd - mPointer);
+    };
+
+    bool empty() const
+    {
+        return mPointer >= mEnd;
+    };
+
+    void need(size_t size) const
+    {
+        if(size > remaining())
+            throw std::runtime_error("Unexpected end of data.");
+    };
+
+    // count records of recordSize bytes, without count * recordSize
+    // wrapping around on 32-bit
+    void need(size_t count, size_t recordSize) const
+    {
+        if(recordSize && count > remaining() / recordSize)
+            throw std::runtime_error("Unexpected end of data.");
+    };
+
+    // Integers and enums of them
+    template <typename T>
+    T getUnchecked()
+    {
+        static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "ByteReader only reads integers");
+        using Raw = std::make_unsigned_t<typename Underlying<T, std::is_enum_v<T>>::type>;
+
+        Raw value;
+        std::memcpy(&value, mPointer, sizeof(Raw));
+        mPointer += sizeof(Raw);
+        if constexpr (sizeof(Raw) > 1 && Order != std::endian::native)
+            value = swapBytes(value);
+        return static_cast<T>(value);
+    };
+
+    template <typename T>
+    T get()
+    {
+        need(sizeof(T));
+        return getUnchecked<T>();
+    };
+
+    std::string_view getString(size_t length)
+    {
+        need(length);
+        std::string_view value(reinterpret_cast<const char*>(mPointer), length);
+        mPointer += length;
+        return value;
+    };
+
+    std::span<const uint8_t> getBytes(size_t length)
+    {
+        need(length);
+        std::span<const uint8_t> value(mPointer, length);
+        mPointer += length;
+        return value;
+    };
+
+    void skip(size_t length)
+    {
+        need(length);
+        mPointer += length;
+    };
+
+private:
+    template <typename T, bool IsEnum>
+    struct Underlying
+    {
+        using type = T;
+    };
+    template <typename T>
+    struct Underlying<T, true>
+    {
+        using type = std::underlying_type_t<T>;
+    };
+
+    template <typename Raw>
+    static Raw swapBytes(Raw value)
+    {
+        if constexpr (sizeof(Raw) == 2)
+            return __builtin_bswap16(value);
+        else if constexpr (sizeof(Raw) == 4)
+            return __builtin_bswap32(value);
+        else
+            return __builtin_bswap64(value);
+    };
+};
+
+using BigEndianReader = ByteReader<std::endian::big>;
+using LittleEndianReader = ByteReader<std::endian::little>;
+
+#endif // BYTEREADER_H
@@ -1,86 +1,213 @@
 #include <cstring>
 #include <algorithm>
+#include <bit>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+#include "bytereader.h"
 #include "filecommon.h"
 #include "dreamfile.h"
 #ifdef HAS_CIPHER
     #include "furccipher.h"
 #endif
 
-Dream::Dream(const std::string& filename) :
-    mFile(filename, std::ios::in | std::ios::binary)
+// Little-endian 16-bit values straight into place. Every target we build
+// for is little-endian, where this is a plain (vectorized) copy.
+static void unpackLE16(const uint8_t* src, uint16_t* dest, size_t count)
 {
-    if (!mFile || !mFile.is_open())
-        throw std::runtime_error("Failed to open file.");
-    mName = getBasename(filename);
+    if constexpr (std::endian::native == std::endian::little)
+    {
+        std::memcpy(dest, src, count * 2);
+    }
+    else
+    {
+        for(size_t i = 0; i < count; i++)
+            dest[i] = src[i * 2] | src[i * 2 + 1] << 8;
+    }
+}
+
+// Splits the NE/NW byte pairs of the wall layer
+static void unpackWalls(const uint8_t* src, uint8_t* ne, uint8_t* nw, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    for(; i + 16 <= count; i += 16)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2 + 16));
+        __m128i even = _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes));
+        __m128i odd = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(ne + i), even);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(nw + i), odd);
+    }
+#endif
+    for(; i < count; i++)
+    {
+        ne[i] = src[i * 2];
+        nw[i] = src[i * 2 + 1];
+    }
+}
+
+// FNV-1a over the lowercased key. Header keys are dispatched by switching
+// on this, so two keys hashing alike would fail to compile.
+static constexpr uint32_t keyHash(std::string_view key)
+{
+    uint32_t hash = 2166136261u;
+    for(char c : key)
+    {
+        if(c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+static bool keyEquals(std::string_view key, std::string_view lowercase)
+{
+    if(key.size() != lowercase.size())
+        return false;
+    for(size_t i = 0; i < key.size(); i++)
+    {
+        char c = key[i];
+        if(c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if(c != lowercase[i])
+            return false;
+    }
+    return true;
+}
+
+// Leading spaces and trailing junk are fine, like std::stoi
+template <typename T>
+static bool parseNumber(std::string_view value, T& out)
+{
+    while(!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+        value.remove_prefix(1);
+    if(!value.empty() && value.front() == '+')
+        value.remove_prefix(1);
     
-    std::transform(mName.begin(), mName.end(), mName.begin(),
-                   [](unsigned char c) { return std::tolower(c); });
+    long long number = 0;
+    auto result = std::from_chars(value.data(), value.data() + value.size(), number);
+    if(result.ec != std::errc())
+        throw std::runtime_error("Bad number in map header: " + std::string(value));
     
+    if constexpr (std::is_same_v<T, bool>)
+        out = number != 0;
+    else
+        out = static_cast<T>(number);
+    return true;
+}
+
+static bool assignString(std::string_view value, std::string& out)
+{
+    out.assign(value);
+    return true;
+}
+
+bool Dream::applyHeaderValue(std::string_view key, std::string_view value)
+{
+    switch(keyHash(key))
+    {
+        case keyHash("width"): return keyEquals(key, "width") && parseNumber(value, mWidth);
+        case keyHash("height"): return keyEquals(key, "height") && parseNumber(value, mHeight);
+        case keyHash("revision"): return keyEquals(key, "revision") && parseNumber(value, mRevision);
+        case keyHash("encoded"): return keyEquals(key, "encoded") && parseNumber(value, mEncoded);
+        case keyHash("patcht"): return keyEquals(key, "patcht") && parseNumber(value, mPatcht);
+        case keyHash("sfxlayermode"): return keyEquals(key, "sfxlayermode") && assignString(value, mSFXLayerMode);
+        case keyHash("sfxopacity"): return keyEquals(key, "sfxopacity") && parseNumber(value, mSFXOpacity);
+        case keyHash("name"): return keyEquals(key, "name") && assignString(value, mName);
+        case keyHash("patchs"): return keyEquals(key, "patchs") && assignString(value, mPatchs);
+        case keyHash("noload"): return keyEquals(key, "noload") && parseNumber(value, mNoLoad);
+        case keyHash("allowjs"): return keyEquals(key, "allowjs") && parseNumber(value, mAllowJS);
+        case keyHash("allowlf"): return keyEquals(key, "allowlf") && parseNumber(value, mAllowLF);
+        case keyHash("allowfurl"): return keyEquals(key, "allowfurl") && parseNumber(value, mAllowFURL);
+        case keyHash("allowshouts"): return keyEquals(key, "allowshouts") && parseNumber(value, mAllowShouts);
+        case keyHash("allowlarge"): return keyEquals(key, "allowlarge") && parseNumber(value, mAllowLarge);
+        case keyHash("swearfilter"): return keyEquals(key, "swearfilter") && parseNumber(value, mSwearFilter);
+        case keyHash("nowho"): return keyEquals(key, "nowho") && parseNumber(value, mNoWho);
+        case keyHash("forcesittable"): return keyEquals(key, "forcesittable") && parseNumber(value, mForceSittable);
+        case keyHash("notab"): return keyEquals(key, "notab") && parseNumber(value, mNoTab);
+        case keyHash("nonovelty"): return keyEquals(key, "nonovelty") && parseNumber(value, mNoNovelty);
+        case keyHash("rating"): return keyEquals(key, "rating") && assignString(value, mRating);
+        case keyHash("allow32bitart"): return keyEquals(key, "allow32bitart") && parseNumber(value, mAllow32BitArt);
+        case keyHash("ismodern"): return keyEquals(key, "ismodern") && parseNumber(value, mIsModern);
+        case keyHash("parentalcontrols"): return keyEquals(key, "parentalcontrols") && parseNumber(value, mParentalControls);
+        default: return false;
+    }
+}
+
+size_t Dream::parseHeader(std::string_view text)
+{
     // Minimal size is calculated by the minimal requirement for a map:
     // "MAP V##.## Furcadia\nBODY\n"
-    mFile.seekg(0, std::ios::end);
-    if(mFile.tellg() < strlen("MAP V##.## Furcadia\nBODY\n"))
+    if(text.size() < strlen("MAP V##.## Furcadia\nBODY\n"))
         throw std::runtime_error("Too small to be a Dream file.");
-    mFile.seekg(0, std::ios::beg);
-    
-    char magic[strlen("MAP V##.## Furcadia")] = {0};
-    mFile.getline(magic, strlen("MAP V##.## Furcadia\n"));
     
-    if(sscanf(magic, "MAP V%d.%d Furcadia", &mVersionMajor, &mVersionMinor) != 2)
+    int versionMajor = 0, versionMinor = 0;
+    const char* end = text.data() + text.size();
+    const char* pointer = text.data() + strlen("MAP V");
+    auto major = std::from_chars(pointer, end, versionMajor);
+    if(text.substr(0, strlen("MAP V")) != "MAP V" || major.ec != std::errc()
+       || major.ptr == end || *major.ptr != '.'
+       || std::from_chars(major.ptr + 1, end, versionMinor).ec != std::errc())
     {
         throw std::runtime_error("Not a valid map file.");
     }
+    mVersionMajor = versionMajor;
+    mVersionMinor = versionMinor;
     
-    bool valid = false;
-    // Limit to 255 read attempts
-    for(int i = 0; i < 32; i++)
+    size_t lineStart = text.find('\n');
+    while(lineStart != std::string_view::npos)
     {
-        char line[255] = {0};
-        mFile.getline(line, sizeof(line));
-        std::string tmp(line);
-        
-        if(tmp.compare("BODY") == 0)
-        {
-            valid = true;
+        lineStart++;
+        size_t lineEnd = text.find('\n', lineStart);
+        if(lineEnd == std::string_view::npos)
             break;
-        }
         
-        int offset = tmp.rfind("=");
-        std::string key = tmp.substr(0, offset);
-        std::transform(key.begin(), key.end(), key.begin(),
-                    [](unsigned char c) { return std::tolower(c); });
-        std::string value = tmp.substr(offset + 1);
+        std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+        if(!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
         
-        if(key.compare("width") == 0) mWidth = std::stoi(value);
-        else if(key.compare("height") == 0) mHeight = std::stoi(value);
-        else if(key.compare("revision") == 0) mRevision = std::stoi(value);
-        else if(key.compare("encoded") == 0) mEncoded = std::stoi(value);
-        else if(key.compare("patcht") == 0) mPatcht = std::stoi(value);
-        else if(key.compare("sfxlayermode") == 0) mSFXLayerMode = value;
-        else if(key.compare("sfxopacity") == 0) mSFXOpacity = std::stoi(value);
-        else if(key.compare("name") == 0) mName = value;
-        else if(key.compare("patchs") == 0) mPatchs = value;
-        else if(key.compare("noload") == 0)  mNoLoad = std::stoi(value);
-        else if(key.compare("allowjs") == 0) mAllowJS = std::stoi(value);
-        else if(key.compare("allowlf") == 0) mAllowLF = std::stoi(value);
-        else if(key.compare("allowfurl") == 0) mAllowFURL = std::stoi(value);
-        else if(key.compare("allowshouts") == 0) mAllowShouts = std::stoi(value);
-        else if(key.compare("allowlarge") == 0) mAllowLarge = std::stoi(value);
-        else if(key.compare("swearfilter") == 0) mSwearFilter = std::stoi(value);
-        else if(key.compare("nowho") == 0) mNoWho = std::stoi(value);
-        else if(key.compare("forcesittable") == 0) mForceSittable = std::stoi(value);
-        else if(key.compare("notab") == 0) mNoTab = std::stoi(value);
-        else if(key.compare("nonovelty") == 0) mNoNovelty = std::stoi(value);
-        else if(key.compare("rating") == 0) mRating = value;
-        else if(key.compare("allow32bitart") == 0) mAllow32BitArt = std::stoi(value);
-        else if(key.compare("ismodern") == 0) mIsModern = std::stoi(value);
-        else if(key.compare("parentalcontrols") == 0) mParentalControls = std::stoi(value);
-        else
-            printf("Unknown map key: %s\n", key.c_str());
+        if(line == "BODY")
+            return lineEnd + 1;
+        
+        size_t separator = line.find('=');
+        std::string_view key = line.substr(0, separator);
+        std::string_view value = separator == std::string_view::npos ? line : line.substr(separator + 1);
+        if(!applyHeaderValue(key, value))
+            printf("Unknown map key: %.*s\n", static_cast<int>(key.size()), key.data());
+        
+        lineStart = lineEnd;
     }
+    throw std::runtime_error("Map has no body!");
+}
+
+Dream::Dream(const std::string& filename, ParseMode mode)
+{
+    mName = getBasename(filename);
+    
+    std::transform(mName.begin(), mName.end(), mName.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
     
-    if(!valid)
-        throw std::runtime_error("Map has no body!");
+    MappedFile file(filename);
+    parse(file.data(), file.size(), mode);
+}
+
+Dream::Dream(const uint8_t* data, size_t size, ParseMode mode)
+{
+    parse(data, size, mode);
+}
+
+void Dream::parse(const uint8_t* data, size_t size, ParseMode mode)
+{
+    LittleEndianReader reader(data, size);
+    reader.skip(parseHeader(std::string_view(reinterpret_cast<const char*>(data), size)));
+    if(mode == ParseMode::HEADER)
+        return;
     
     // 1.10 and older use a old verion of the crypto
     bool useOldCrypto = mVersionMajor <= 1 && mVersionMinor <= 10;
@@ -91,219 +218,238 @@ Dream::Dream(const std::string& filename) :
     if(mVersionMajor >= 1 && mVersionMinor >= 50)
         nChannels += 2;
     
-    uint32_t expectedBytes = (mWidth * mHeight * 2) * nChannels;
-    std::vector<uint8_t> data(expectedBytes, 0);
-    
-    if(mFile.read(reinterpret_cast<char*>(data.data()), data.size())){}
-    else
+    size_t tiles = size_t(mWidth) * mHeight;
+    size_t layerSize = tiles * 2; // Size in bytes, walls too
+    if(reader.remaining() / nChannels < layerSize)
         throw std::runtime_error("Failed to read entire map file!");
     
+    // Plain maps decode straight out of the file
+    LittleEndianReader body(reader.getBytes(layerSize * nChannels));
+    std::vector<uint8_t> decrypted;
     if(mEncoded)
     {
 #ifdef HAS_CIPHER
-        data = decrypt(data, useOldCrypto);
+        decrypted.assign(body.mPointer, body.mEnd);
+        decrypted = decrypt(decrypted, useOldCrypto);
+        if(decrypted.size() < layerSize * nChannels)
+            throw std::runtime_error("Not enough data for map layers.");
+        body = LittleEndianReader(decrypted.data(), decrypted.size());
 #else
         throw std::runtime_error("Can't decrypt without furccipher cipher library");
 #endif
     }
-    mTiles.resize(mWidth * mHeight);
     
-    size_t offset = 0;
-    // Read floors
+    mChunksX = (mWidth + DREAM_CHUNK_SIZE - 1) >> DREAM_CHUNK_SHIFT;
+    mChunksY = (mHeight + DREAM_CHUNK_SIZE - 1) >> DREAM_CHUNK_SHIFT;
+    size_t storedTiles = size_t(mChunksX) * mChunksY * DREAM_CHUNK_TILES;
+    
+    // In file order, nullptr is the walls
+    std::vector<uint16_t>* layers[] = {&mFloors, &mObjects, nullptr, &mRegions, &mEffects, &mLighting, &mAmbient};
+    for(int layer = 0; layer < nChannels; layer++)
     {
-        size_t floorSize = mWidth * mHeight * 2; // Size in bytes
-        if (offset + floorSize > data.size()) {
-            throw std::runtime_error("Not enough data for floors.");
-        }
-
-        // Extract the floor data
-        std::vector<uint8_t> tmp(data.begin() + offset, data.begin() + offset + floorSize);
-        std::vector<uint16_t> floors(mWidth * mHeight, 0);
-#ifdef HAS_CIPHER
-        if(mEncoded)
-            floors = readEncryptedDream16(tmp, mWidth, mHeight, useOldCrypto);
+        const uint8_t* src = body.getBytes(layerSize).data();
+        std::vector<uint16_t>* dest = layers[layer];
+        if(dest)
+            dest->resize(storedTiles);
         else
-#endif
-            for(int i = 0; i < floors.size(); i++)
-                floors[i] = tmp[i * 2] | tmp[i * 2 + 1] << 8;
-        
-        for(int i = 0; i < mTiles.size(); i++)
-            mTiles[i].mFloor = floors[i];
-        
-        offset += floorSize; // Advance offset
-    }
-
-    // Read objects
-    {
-        size_t objectSize = mWidth * mHeight * 2; // Size in bytes
-        if (offset + objectSize > data.size()) {
-            throw std::runtime_error("Not enough data for objects.");
+        {
+            mNEWalls.resize(storedTiles);
+            mNWWalls.resize(storedTiles);
         }
-
-        // Extract the object data
-        std::vector<uint8_t> tmp(data.begin() + offset, data.begin() + offset + objectSize);
-        std::vector<uint16_t> objects(mWidth * mHeight, 0);
-#ifdef HAS_CIPHER
-        if(mEncoded)
-            objects = readEncryptedDream16(tmp, mWidth, mHeight, useOldCrypto);
-        else
-#endif
-            for(int i = 0; i < objects.size(); i++)
-                objects[i] = tmp[i * 2] | tmp[i * 2 + 1] << 8;
         
-        for(int i = 0; i < mTiles.size(); i++)
-            mTiles[i].mObject = objects[i];
-        
-        offset += objectSize; // Advance offset
-    }
-
-    // Read walls
-    {
-        size_t wallSize = mWidth * mHeight * 2; // Size in bytes (example, adjust as needed)
-        if (offset + wallSize > data.size()) {
-            throw std::runtime_error("Not enough data for walls.");
-        }
-
-        // Extract the wall data
-        std::vector<uint8_t> tmp(data.begin() + offset, data.begin() + offset + wallSize);
-        std::vector<uint8_t> walls(mWidth * mHeight * 2, 0);
 #ifdef HAS_CIPHER
         if(mEncoded)
-            walls = readEncryptedDream8(tmp, mWidth, mHeight, useOldCrypto);
-        else
-#endif
-            for(int i = 0; i < walls.size(); i++)
-                walls[i] = tmp[i];
-        
-        for(int i = 0; i < mTiles.size(); i++)
-        {
-            mTiles[i].mNEWall = walls[i * 2];
-            mTiles[i].mNWWall = walls[i * 2 + 1];
-        }
-        
-        offset += wallSize; // Advance offset
-    }
-    
-    if(mVersionMajor >= 1 && mVersionMinor >= 30)
-    {
-        // Read regions
         {
-            size_t regionSize = mWidth * mHeight * 2; // Size in bytes
-            if (offset + regionSize > data.size()) {
-                throw std::runtime_error("Not enough data for regions.");
+            std::vector<uint8_t> tmp(src, src + layerSize);
+            if(dest)
+            {
+                std::vector<uint16_t> values = readEncryptedDream16(tmp, mWidth, mHeight, useOldCrypto);
+                forEachRun([&](size_t fileIndex, size_t index, size_t count)
+                {
+                    std::memcpy(dest->data() + index, values.data() + fileIndex, count * 2);
+                });
             }
-
-            // Extract the region data
-            std::vector<uint8_t> tmp(data.begin() + offset, data.begin() + offset + regionSize);
-            std::vector<uint16_t> regions(mWidth * mHeight, 0);
-#ifdef HAS_CIPHER
-            if(mEncoded)
-                regions = readEncryptedDream16(tmp, mWidth, mHeight, useOldCrypto);
             else
+            {
+                std::vector<uint8_t> walls = readEncryptedDream8(tmp, mWidth, mHeight, useOldCrypto);
+                forEachRun([&](size_t fileIndex, size_t index, size_t count)
+                {
+                    unpackWalls(walls.data() + fileIndex * 2, mNEWalls.data() + index, mNWWalls.data() + index, count);
+                });
+            }
+            continue;
+        }
 #endif
-                for(int i = 0; i < regions.size(); i++)
-                    regions[i] = tmp[i * 2] | tmp[i * 2 + 1] << 8;
-            
-            for(int i = 0; i < mTiles.size(); i++)
-                mTiles[i].mRegion = regions[i];
-            
-            offset += regionSize; // Advance offset
+        if(dest)
+        {
+            forEachRun([&](size_t fileIndex, size_t index, size_t count)
+            {
+                unpackLE16(src + fileIndex * 2, dest->data() + index, count);
+            });
         }
-        
-        // Read effects
+        else
         {
-            size_t effectSize = mWidth * mHeight * 2; // Size in bytes
-            if (offset + effectSize > data.size()) {
-                throw std::runtime_error("Not enough data for effects.");
-            }
-
-            // Extract the region data
-            std::vector<uint8_t> tmp(data.begin() + offset, data.begin() + offset + effectSize);
-            std::vector<uint16_t> effects(mWidth * mHeight, 0);
-#ifdef HAS_CIPHER
-            if(mEncoded)
-                effects = readEncryptedDream16(tmp, mWidth, mHeight, useOldCrypto);
-            else
-#endif
-                for(int i = 0; i < effects.size(); i++)
-                    effects[i] = tmp[i * 2] | tmp[i * 2 + 1] << 8;
-            
-            for(int i = 0; i < mTiles.size(); i++)
-                mTiles[i].mEffect = effects[i];
-            
-            offset += effectSize; // Advance offset
+            forEachRun([&](size_t fileIndex, size_t index, size_t count)
+            {
+                unpackWalls(src + fileIndex * 2, mNEWalls.data() + index, mNWWalls.data() + index, count);
+            });
         }
     }
-    
-    if(mVersionMajor >= 1 && mVersionMinor >= 50)
-    {
-        // Read lighting
-        {
-            size_t lightingSize = mWidth * mHeight * 2; // Size in bytes
-            if (offset + lightingSize > data.size()) {
-                throw std::runtime_error("Not enough data for lighting.");
-            }
+}
 
-            // Extract the lighting data
-            std::vector<uint8_t> tmp(data.begin() + offset, data.begin() + offset + lightingSize);
-            std::vector<uint16_t> lighting(mWidth * mHeight, 0);
-#ifdef HAS_CIPHER
-            if(mEncoded)
-                lighting = readEncryptedDream16(tmp, mWidth, mHeight, useOldCrypto);
-            else
-#endif
-                for(int i = 0; i < lighting.size(); i++)
-                    lighting[i] = tmp[i * 2] | tmp[i * 2 + 1] << 8;
-            
-            for(int i = 0; i < mTiles.size(); i++)
-                mTiles[i].mLighting = lighting[i];
-            
-            offset += lightingSize; // Advance offset
-        }
-        
-        // Read ambient
-        {
-            size_t ambientSize = mWidth * mHeight * 2; // Size in bytes
-            if (offset + ambientSize > data.size()) {
-                throw std::runtime_error("Not enough data for ambient.");
-            }
+Dream::~Dream()
+{
+}
 
-            // Extract the ambient data
-            std::vector<uint8_t> tmp(data.begin() + offset, data.begin() + offset + ambientSize);
-            std::vector<uint16_t> ambient(mWidth * mHeight, 0);
-#ifdef HAS_CIPHER
-            if(mEncoded)
-                ambient = readEncryptedDream16(tmp, mWidth, mHeight, useOldCrypto);
-            else
-#endif
-                for(int i = 0; i < ambient.size(); i++)
-                    ambient[i] = tmp[i * 2] | tmp[i * 2 + 1] << 8;
-            
-            for(int i = 0; i < mTiles.size(); i++)
-                mTiles[i].mAmbient = ambient[i];
-            
-            offset += ambientSize; // Advance offset
-        }
+
+void Dream::requireLayers() const
+{
+    if(!hasLayers())
+        throw std::runtime_error("Map was opened header only, it has no tiles.");
+}
+
+DreamTile_t Dream::get(uint16_t x, uint16_t y) const
+{
+    requireLayers();
+    if (x >= mWidth || y >= mHeight)
+    {
+        throw std::out_of_range("Coordinates out of bounds");
     }
+    size_t i = index(x, y);
     
-    data.resize(0); // Free up space
+    DreamTile_t tile;
+    tile.mFloor = mFloors[i];
+    tile.mObject = mObjects[i];
+    tile.mNEWall = mNEWalls[i];
+    tile.mNWWall = mNWWalls[i];
+    // Older maps don't have these, and editing one doesn't create the rest
+    if(!mRegions.empty())
+        tile.mRegion = mRegions[i];
+    if(!mEffects.empty())
+        tile.mEffect = mEffects[i];
+    if(!mLighting.empty())
+        tile.mLighting = mLighting[i];
+    if(!mAmbient.empty())
+        tile.mAmbient = mAmbient[i];
+    return tile;
 }
 
-Dream::~Dream()
+std::vector<uint16_t>* Dream::editLayer16(DreamLayer layer)
+{
+    std::vector<uint16_t>* values;
+    switch(layer)
+    {
+        case DreamLayer::FLOOR: values = &mFloors; break;
+        case DreamLayer::OBJECT: values = &mObjects; break;
+        case DreamLayer::REGION: values = &mRegions; break;
+        case DreamLayer::EFFECT: values = &mEffects; break;
+        case DreamLayer::LIGHTING: values = &mLighting; break;
+        case DreamLayer::AMBIENT: values = &mAmbient; break;
+        default: return nullptr;
+    }
+    if(values->empty())
+        values->resize(size_t(mChunksX) * mChunksY * DREAM_CHUNK_TILES);
+    return values;
+}
+
+std::vector<uint8_t>* Dream::editLayer8(DreamLayer layer)
 {
-    if(mFile && mFile.is_open())
+    std::vector<uint8_t>* values;
+    switch(layer)
     {
-        mFile.close();
+        case DreamLayer::NE_WALL: values = &mNEWalls; break;
+        case DreamLayer::NW_WALL: values = &mNWWalls; break;
+        default: return nullptr;
     }
+    if(values->empty())
+        values->resize(size_t(mChunksX) * mChunksY * DREAM_CHUNK_TILES);
+    return values;
 }
 
+void Dream::markDirty(size_t chunk, DreamLayer layer)
+{
+    if(mDirtyLayers.empty())
+        mDirtyLayers.resize(size_t(mChunksX) * mChunksY);
+    if(mDirtyLayers[chunk] == 0)
+        mDirtyChunks.push_back(static_cast<uint32_t>(chunk));
+    mDirtyLayers[chunk] |= 1 << static_cast<uint8_t>(layer);
+}
+
+void Dream::clearDirty()
+{
+    for(uint32_t chunk : mDirtyChunks)
+        mDirtyLayers[chunk] = 0;
+    mDirtyChunks.clear();
+}
 
-DreamTile_t* Dream::get(uint16_t x, uint16_t y)
+void Dream::set(DreamLayer layer, uint16_t x, uint16_t y, uint16_t value)
 {
+    requireLayers();
     if (x >= mWidth || y >= mHeight)
     {
         throw std::out_of_range("Coordinates out of bounds");
     }
-    size_t index = (mHeight * x) + y;
-    return &mTiles[index];
-}
\ No newline at end of file
+    size_t i = index(x, y);
+    
+    if(std::vector<uint16_t>* values = editLayer16(layer))
+    {
+        if((*values)[i] == value)
+            return;
+        (*values)[i] = value;
+    }
+    else
+    {
+        std::vector<uint8_t>* walls = editLayer8(layer);
+        if((*walls)[i] == uint8_t(value))
+            return;
+        (*walls)[i] = uint8_t(value);
+    }
+    markDirty(i >> (2 * DREAM_CHUNK_SHIFT), layer);
+}
+
+// Fills the y runs of each column inside one chunk, true if anything changed
+template <typename T>
+static bool fillChunk(T* chunk, uint16_t x0, uint16_t x1, uint16_t y0, uint16_t y1, T value)
+{
+    bool changed = false;
+    for(uint16_t x = x0; x < x1; x++)
+    {
+        T* run = chunk + (x << DREAM_CHUNK_SHIFT);
+        if(!changed)
+            changed = std::find_if(run + y0, run + y1, [&](T v) { return v != value; }) != run + y1;
+        std::fill(run + y0, run + y1, value);
+    }
+    return changed;
+}
+
+void Dream::fill(DreamLayer layer, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t value)
+{
+    requireLayers();
+    uint32_t endX = std::min<uint32_t>(uint32_t(x) + width, mWidth);
+    uint32_t endY = std::min<uint32_t>(uint32_t(y) + height, mHeight);
+    if(x >= endX || y >= endY)
+        return;
+    
+    std::vector<uint16_t>* values = editLayer16(layer);
+    std::vector<uint8_t>* walls = values ? nullptr : editLayer8(layer);
+    
+    const uint32_t mask = DREAM_CHUNK_SIZE - 1;
+    for(uint32_t cy = y >> DREAM_CHUNK_SHIFT; cy <= (endY - 1) >> DREAM_CHUNK_SHIFT; cy++)
+    {
+        uint16_t y0 = std::max<uint32_t>(y, cy << DREAM_CHUNK_SHIFT) & mask;
+        uint16_t y1 = ((std::min<uint32_t>(endY, (cy + 1) << DREAM_CHUNK_SHIFT) - 1) & mask) + 1;
+        for(uint32_t cx = x >> DREAM_CHUNK_SHIFT; cx <= (endX - 1) >> DREAM_CHUNK_SHIFT; cx++)
+        {
+            uint16_t x0 = std::max<uint32_t>(x, cx << DREAM_CHUNK_SHIFT) & mask;
+            uint16_t x1 = ((std::min<uint32_t>(endX, (cx + 1) << DREAM_CHUNK_SHIFT) - 1) & mask) + 1;
+            
+            size_t chunk = size_t(cy) * mChunksX + cx;
+            size_t start = chunk << (2 * DREAM_CHUNK_SHIFT);
+            bool changed = values
+                ? fillChunk(values->data() + start, x0, x1, y0, y1, value)
+                : fillChunk(walls->data() + start, x0, x1, y0, y1, uint8_t(value));
+            if(changed)
+                markDirty(chunk, layer);
+        }
+    }
+}
@@ -1,16 +1,28 @@
 #ifndef DREAMFILE_H
 #define DREAMFILE_H
+#include <algorithm>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <variant>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <unordered_map>
 
+// Layers are stored in square chunks so that nearby tiles share cache lines
+#define DREAM_CHUNK_SHIFT 4
+#define DREAM_CHUNK_SIZE (1 << DREAM_CHUNK_SHIFT)
+#define DREAM_CHUNK_TILES (DREAM_CHUNK_SIZE * DREAM_CHUNK_SIZE)
 
+// Furcadia's staggered isometric grid: odd rows sit half a tile to the right
+// and every row is half a tile lower than the one before
+#define DREAM_TILE_WIDTH 62
+#define DREAM_TILE_HEIGHT 32
+
+// One tile with every layer, as handed out by Dream::get
 struct DreamTile_t
 {
     uint16_t mFloor = 0;
@@ -23,10 +35,42 @@ struct DreamTile_t
     uint16_t mAmbient = 0;
 };
 
+enum class DreamLayer : uint8_t
+{
+    FLOOR = 0,
+    OBJECT = 1,
+    NE_WALL = 2,
+    NW_WALL = 3,
+    REGION = 4,
+    EFFECT = 5,
+    LIGHTING = 6,
+    AMBIENT = 7
+};
+
 class Dream
 {
+public:
+    enum class ParseMode : uint8_t
+    {
+        FULL = 0,  // Header and every layer
+        HEADER = 1 // Attributes only, the layers stay empty
+    };
+    
 protected:
-    std::ifstream mFile;
+    // One bit per DreamLayer for every chunk, plus the chunks that have any
+    std::vector<uint8_t> mDirtyLayers;
+    std::vector<uint32_t> mDirtyChunks;
+    
+    // Creates layers the map version didn't have on first write
+    std::vector<uint16_t>* editLayer16(DreamLayer layer);
+    std::vector<uint8_t>* editLayer8(DreamLayer layer);
+    void markDirty(size_t chunk, DreamLayer layer);
+    void requireLayers() const;
+    
+    // Returns where the body starts
+    size_t parseHeader(std::string_view text);
+    bool applyHeaderValue(std::string_view key, std::string_view value);
+    void parse(const uint8_t* data, size_t size, ParseMode mode);
 
 public: // Footer
     std::string mFileName;
@@ -60,13 +104,113 @@ public: // Dream attributes
     bool mIsModern = false;
     bool mParentalControls = false;
     
-    std::vector<DreamTile_t> mTiles;
+public: // Layers, one array each, laid out as described at index()
+    uint16_t mChunksX = 0;
+    uint16_t mChunksY = 0;
+    
+    std::vector<uint16_t> mFloors;
+    std::vector<uint16_t> mObjects;
+    std::vector<uint8_t> mNEWalls;
+    std::vector<uint8_t> mNWWalls;
+    // Empty when the map version predates them
+    std::vector<uint16_t> mRegions;
+    std::vector<uint16_t> mEffects;
+    std::vector<uint16_t> mLighting;
+    std::vector<uint16_t> mAmbient;
+    
+    // Chunks go row by row. Inside a chunk tiles are column-major like the
+    // file, so loading copies whole column runs. Tiles past the map edge
+    // in the last chunks are padding and stay zero.
+    size_t index(uint16_t x, uint16_t y) const
+    {
+        size_t chunk = size_t(y >> DREAM_CHUNK_SHIFT) * mChunksX + (x >> DREAM_CHUNK_SHIFT);
+        return (chunk << (2 * DREAM_CHUNK_SHIFT))
+             | ((x & (DREAM_CHUNK_SIZE - 1)) << DREAM_CHUNK_SHIFT)
+             | (y & (DREAM_CHUNK_SIZE - 1));
+    };
+    
+    // Calls visit(x, y, index) for every tile overlapping the screen
+    // rectangle, back to front. The rectangle is in map pixels with the top
+    // left of tile 0,0 at the origin. Grow it by the tallest sprite to
+    // catch objects reaching in from below.
+    template <typename Visitor>
+    void forEachTileInView(int32_t left, int32_t top, int32_t width, int32_t height, Visitor&& visit) const
+    {
+        if(width <= 0 || height <= 0)
+            return;
+        
+        const int32_t rowStep = DREAM_TILE_HEIGHT / 2;
+        int32_t firstRow = std::max<int32_t>(0, floorDiv(top - DREAM_TILE_HEIGHT, rowStep) + 1);
+        int32_t lastRow = std::min<int32_t>(mHeight - 1, floorDiv(top + height - 1, rowStep));
+        
+        for(int32_t y = firstRow; y <= lastRow; y++)
+        {
+            int32_t shift = (y & 1) * (DREAM_TILE_WIDTH / 2);
+            int32_t firstColumn = std::max<int32_t>(0, floorDiv(left - shift - DREAM_TILE_WIDTH, DREAM_TILE_WIDTH) + 1);
+            int32_t lastColumn = std::min<int32_t>(mWidth - 1, floorDiv(left + width - 1 - shift, DREAM_TILE_WIDTH));
+            for(int32_t x = firstColumn; x <= lastColumn; x++)
+                visit(uint16_t(x), uint16_t(y), index(uint16_t(x), uint16_t(y)));
+        }
+    };
+    
+protected:
+    static int32_t floorDiv(int32_t a, int32_t b)
+    {
+        return a / b - (a % b != 0 && (a < 0) != (b < 0));
+    };
+    
+    // Calls copy(fileIndex, index, count) for each run of tiles that is
+    // contiguous both in the file and in the chunked layers
+    template <typename Copy>
+    void forEachRun(Copy&& copy) const
+    {
+        for(uint16_t x = 0; x < mWidth; x++)
+        {
+            for(uint32_t y = 0; y < mHeight; y += DREAM_CHUNK_SIZE - (y & (DREAM_CHUNK_SIZE - 1)))
+            {
+                size_t count = std::min<size_t>(DREAM_CHUNK_SIZE - (y & (DREAM_CHUNK_SIZE - 1)), mHeight - y);
+                copy(size_t(mHeight) * x + y, index(x, uint16_t(y)), count);
+            }
+        }
+    };
     
 public:
-    Dream(const std::string& filename);
+    Dream(const std::string& filename, ParseMode mode = ParseMode::FULL);
+    // A whole .map file already in memory
+    Dream(const uint8_t* data, size_t size, ParseMode mode = ParseMode::FULL);
     ~Dream();
     
-    DreamTile_t* get(uint16_t x, uint16_t y);
+    // False for a Dream opened with ParseMode::HEADER, which has no tiles
+    // to get or set
+    bool hasLayers() const { return !mFloors.empty(); };
+    
+    // Gathers every layer for one tile. Sweeps should use the layers.
+    DreamTile_t get(uint16_t x, uint16_t y) const;
+    
+public: // Edits, e.g. tile changes from the server
+    // Walls take the low byte of value
+    void set(DreamLayer layer, uint16_t x, uint16_t y, uint16_t value);
+    // Clipped to the map
+    void fill(DreamLayer layer, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t value);
+    
+    void setFloor(uint16_t x, uint16_t y, uint16_t floor) { set(DreamLayer::FLOOR, x, y, floor); };
+    void setObject(uint16_t x, uint16_t y, uint16_t object) { set(DreamLayer::OBJECT, x, y, object); };
+    void setNEWall(uint16_t x, uint16_t y, uint8_t wall) { set(DreamLayer::NE_WALL, x, y, wall); };
+    void setNWWall(uint16_t x, uint16_t y, uint8_t wall) { set(DreamLayer::NW_WALL, x, y, wall); };
+    void setRegion(uint16_t x, uint16_t y, uint16_t region) { set(DreamLayer::REGION, x, y, region); };
+    void setEffect(uint16_t x, uint16_t y, uint16_t effect) { set(DreamLayer::EFFECT, x, y, effect); };
+    
+    // Chunks changed since the last clearDirty(), in the order they were
+    // first changed. Writes of the value a tile already has don't count.
+    // visit(chunkX, chunkY, layerMask), bit n of the mask is DreamLayer n.
+    template <typename Visitor>
+    void forEachDirtyChunk(Visitor&& visit) const
+    {
+        for(uint32_t chunk : mDirtyChunks)
+            visit(uint16_t(chunk % mChunksX), uint16_t(chunk / mChunksX), mDirtyLayers[chunk]);
+    };
+    size_t dirtyChunkCount() const { return mDirtyChunks.size(); };
+    void clearDirty();
 };
 
 #endif
\ No newline at end of file
@@ -1,11 +1,26 @@
+#include <algorithm>
+#include <atomic>
 #include "filecommon.h"
 
-#define LZMA_PROPS_SIZE 5
-#define LZMA_ALONE_HEADER_SIZE 13 // LZMA Alone has 5 bytes properties + 8 bytes uncompressed size
+#if !defined(__3DS__) && (defined(__unix__) || defined(__APPLE__))
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define HAS_MMAP
+#elif defined(_WIN32)
+    #include <process.h>
+#endif
+
+static std::atomic<uint64_t> g_AllocCount{0};
+static std::atomic<uint64_t> g_AcquireCount{0};
+static std::atomic<uint64_t> g_ReuseCount{0};
+static std::atomic<uint64_t> g_TempCount{0};
 
 // Implement memory allocation functions
 void* SzAlloc(const ISzAlloc* /*p*/, size_t size)
 {
+    g_AllocCount.fetch_add(1, std::memory_order_relaxed);
     return std::malloc(size);
 }
 
@@ -15,28 +30,125 @@ void SzFree(const ISzAlloc* /*p*/, void* address)
 }
 
 static ISzAlloc g_Alloc = { SzAlloc, SzFree };
+
+struct LZMADecoderPool::Decoder
+{
+    CLzmaDec mState;
+    
+    Decoder()
+    {
+        LzmaDec_CONSTRUCT(&mState);
+    };
+    
+    ~Decoder()
+    {
+        LzmaDec_FreeProbs(&mState, &g_Alloc);
+    };
+};
+
+static thread_local std::vector<std::unique_ptr<LZMADecoderPool::Decoder>> t_IdleDecoders;
+
+LZMADecoderPool::Lease::Lease(std::unique_ptr<Decoder> decoder) :
+    mDecoder(std::move(decoder))
+{
+}
+
+LZMADecoderPool::Lease::Lease(Lease&&) noexcept = default;
+LZMADecoderPool::Lease& LZMADecoderPool::Lease::operator=(Lease&&) noexcept = default;
+
+LZMADecoderPool::Lease::~Lease()
+{
+    if(!mDecoder)
+        return;
+    
+    // The dictionary is never ours, don't leave it dangling in the pool
+    mDecoder->mState.dic = nullptr;
+    mDecoder->mState.dicBufSize = 0;
+    t_IdleDecoders.push_back(std::move(mDecoder));
+}
+
+CLzmaDec* LZMADecoderPool::Lease::get() const
+{
+    return mDecoder ? &mDecoder->mState : nullptr;
+}
+
+LZMADecoderPool::Lease LZMADecoderPool::acquire(const uint8_t* props)
+{
+    g_AcquireCount.fetch_add(1, std::memory_order_relaxed);
+    
+    std::unique_ptr<Decoder> decoder;
+    if(!t_IdleDecoders.empty())
+    {
+        decoder = std::move(t_IdleDecoders.back());
+        t_IdleDecoders.pop_back();
+    }
+    else
+    {
+        decoder = std::make_unique<Decoder>();
+    }
+    
+    // LzmaDec_AllocateProbs keeps the table when the size still fits
+    CLzmaProb* before = decoder->mState.probs;
+    if(LzmaDec_AllocateProbs(&decoder->mState, props, LZMA_PROPS_SIZE, &g_Alloc) != SZ_OK)
+        throw std::runtime_error("Failed to allocate LZMA decoder");
+    if(before && before == decoder->mState.probs)
+        g_ReuseCount.fetch_add(1, std::memory_order_relaxed);
+    
+    return Lease(std::move(decoder));
+}
+
+void LZMADecoderPool::trim()
+{
+    t_IdleDecoders.clear();
+}
+
+LZMADecoderPool::Stats LZMADecoderPool::stats()
+{
+    Stats stats;
+    stats.mAllocations = g_AllocCount.load(std::memory_order_relaxed);
+    stats.mAcquired = g_AcquireCount.load(std::memory_order_relaxed);
+    stats.mReused = g_ReuseCount.load(std::memory_order_relaxed);
+    return stats;
+}
+
 std::vector<uint8_t> decompressLZMA(const std::vector<uint8_t>& compressedData, SizeT uncompressedSize)
+{
+    return decompressLZMA(compressedData.data(), compressedData.size(), uncompressedSize);
+}
+
+std::vector<uint8_t> decompressLZMA(const uint8_t* compressedData, size_t compressedSize, SizeT uncompressedSize)
 {
     std::vector<uint8_t> decompressedData;
+    
+    if(compressedSize < LZMA_ALONE_HEADER_SIZE)
+        throw std::runtime_error("LZMA data too small");
 
     // LZMA "Alone" format includes an 8-byte uncompressed size in the header (after the properties)
     if(uncompressedSize == 0)
     {
-        memcpy(&uncompressedSize, compressedData.data() + LZMA_PROPS_SIZE, sizeof(uncompressedSize));
+        memcpy(&uncompressedSize, compressedData + LZMA_PROPS_SIZE, sizeof(uncompressedSize));
     }
     
     decompressedData.resize(uncompressedSize);
 
-    SizeT destLen = uncompressedSize;
-    SizeT srcLen = compressedData.size() - LZMA_ALONE_HEADER_SIZE; // Skip the 13-byte header
+    SizeT srcLen = compressedSize - LZMA_ALONE_HEADER_SIZE; // Skip the 13-byte header
     
     ELzmaStatus status;
-
-    int res = LzmaDecode(
-        decompressedData.data(), &destLen,
-        compressedData.data() + LZMA_ALONE_HEADER_SIZE, &srcLen,
-        compressedData.data(), LZMA_PROPS_SIZE,
-        LZMA_FINISH_ANY, &status, &g_Alloc);
+    
+    // Same as LzmaDecode, but with a pooled decoder instead of fresh probs
+    LZMADecoderPool::Lease decoder = LZMADecoderPool::acquire(compressedData);
+    CLzmaDec* state = decoder.get();
+    state->dic = decompressedData.data();
+    state->dicBufSize = uncompressedSize;
+    LzmaDec_Init(state);
+
+    int res = LzmaDec_DecodeToDic(
+        state, uncompressedSize,
+        compressedData + LZMA_ALONE_HEADER_SIZE, &srcLen,
+        LZMA_FINISH_ANY, &status);
+    
+    if(res == SZ_OK && status == LZMA_STATUS_NEEDS_MORE_INPUT)
+        res = SZ_ERROR_INPUT_EOF;
 
     if(res != SZ_OK)
         throw std::runtime_error("LZMA decompression failed");
@@ -44,97 +156,192 @@ std::vector<uint8_t> decompressLZMA(const std::vector<uint8_t>& compressedData,
     return decompressedData;
 }
 
-// Utilities
-uint32_t readUint32(uint8_t** dataPtr, uint8_t* dataEnd) {
-    if (*dataPtr + 4 > dataEnd)
-        throw std::runtime_error("Not enough data to read uint32_t.");
-
-    uint32_t value = (static_cast<uint32_t>((*dataPtr)[0]) << 24) |
-                     (static_cast<uint32_t>((*dataPtr)[1]) << 16) |
-                     (static_cast<uint32_t>((*dataPtr)[2]) << 8) |
-                     (static_cast<uint32_t>((*dataPtr)[3]));
-
-    *dataPtr += 4; // Move the pointer forward by 4 bytes
-    return value;
+LZMAStream::LZMAStream(uint8_t* dest, size_t destSize) :
+    mDest(dest), mDestSize(destSize), mUncompressedSize(destSize)
+{
 }
 
-int32_t readInt32(uint8_t** dataPtr, uint8_t* dataEnd) {
-    if (*dataPtr + 4 > dataEnd)
-        throw std::runtime_error("Not enough data to read uint32_t.");
-
-    int32_t value = (static_cast<int32_t>((*dataPtr)[0]) << 24) |
-                     (static_cast<int32_t>((*dataPtr)[1]) << 16) |
-                     (static_cast<int32_t>((*dataPtr)[2]) << 8) |
-                     (static_cast<int32_t>((*dataPtr)[3]));
-
-    *dataPtr += 4; // Move the pointer forward by 4 bytes
-    return value;
+LZMAStream::LZMAStream(Sink sink, uint64_t uncompressedSize, size_t chunkSize) :
+    mSink(sink), mChunk(chunkSize), mUncompressedSize(uncompressedSize)
+{
 }
 
-uint16_t readUint16(uint8_t** dataPtr, uint8_t* dataEnd) {
-    if (*dataPtr + 2 > dataEnd)
-        throw std::runtime_error("Not enough data to read uint16_t.");
-    
-    uint16_t value = (static_cast<uint16_t>((*dataPtr)[0]) << 8) |
-                     (static_cast<uint16_t>((*dataPtr)[1]));
-
-    *dataPtr += 2; // Move the pointer forward by 2 bytes
-    return value;
+LZMAStream::~LZMAStream()
+{
+    // The window only belongs to us when decoding to a sink
+    if(mState && !mDest)
+        g_Alloc.Free(&g_Alloc, mState->dic);
 }
 
-int16_t readInt16(uint8_t** dataPtr, uint8_t* dataEnd) {
-    if (*dataPtr + 2 > dataEnd)
-        throw std::runtime_error("Not enough data to read uint16_t.");
+void LZMAStream::begin()
+{
+    CLzmaProps props;
+    if(LzmaProps_Decode(&props, mHeader, LZMA_PROPS_SIZE) != SZ_OK)
+        throw std::runtime_error("Unsupported LZMA properties");
     
-    int16_t value = (static_cast<int16_t>((*dataPtr)[0]) << 8) |
-                    (static_cast<int16_t>((*dataPtr)[1]));
-
-    *dataPtr += 2; // Move the pointer forward by 2 bytes
-    return value;
+    if(mUncompressedSize == 0)
+    {
+        for(int i = 0; i < 8; i++)
+            mUncompressedSize |= static_cast<uint64_t>(mHeader[LZMA_PROPS_SIZE + i]) << (i * 8);
+    }
+    
+    mDecoder = LZMADecoderPool::acquire(mHeader);
+    mState = mDecoder.get();
+    
+    if(mDest)
+    {
+        mState->dic = mDest;
+        mState->dicBufSize = mDestSize;
+    }
+    else
+    {
+        // Matches can't reach further back than what's been decoded, so
+        // a window larger than the output is never needed
+        uint64_t window = props.dicSize;
+        if(mUncompressedSize != 0 && mUncompressedSize != UINT64_MAX && mUncompressedSize < window)
+            window = mUncompressedSize;
+        if(window < 4096)
+            window = 4096;
+        
+        mState->dic = static_cast<Byte*>(g_Alloc.Alloc(&g_Alloc, window));
+        if(!mState->dic)
+            throw std::runtime_error("Failed to allocate LZMA window");
+        mState->dicBufSize = window;
+    }
+    
+    LzmaDec_Init(mState);
+    mReady = true;
 }
-
-uint8_t readUint8(uint8_t** dataPtr, uint8_t* dataEnd) {
-    if (*dataPtr + 1 > dataEnd)
-        throw std::runtime_error("Not enough data to read uint8_t.");
-
-    uint8_t value = static_cast<uint8_t>((*dataPtr)[0]);
-
-    *dataPtr += 1; // Move the pointer forward by 2 bytes
-    return value;
+bool LZMAStream::write(const uint8_t* data, size_t size)
+{
+    if(!mReady)
+    {
+        size_t take = std::min(size, LZMA_ALONE_HEADER_SIZE - mHeaderSize);
+        std::memcpy(mHeader + mHeaderSize, data, take);
+        mHeaderSize += take;
+        data += take;
+        size -= take;
+        
+        if(mHeaderSize < LZMA_ALONE_HEADER_SIZE)
+            return false;
+        begin();
+    }
+    
+    if(!mFinished)
+    {
+        if(mDest)
+            decodeToDest(data, size);
+        else
+            decodeToSink(data, size);
+    }
+    return mFinished;
 }
 
-int8_t readInt8(uint8_t** dataPtr, uint8_t* dataEnd) {
-    if (*dataPtr + 1 > dataEnd)
-        throw std::runtime_error("Not enough data to read uint8_t.");
-
-    int8_t value = static_cast<int8_t>((*dataPtr)[0]);
-
-    *dataPtr += 1; // Move the pointer forward by 2 bytes
-    return value;
+void LZMAStream::decodeToDest(const uint8_t* data, size_t size)
+{
+    SizeT dicLimit = mDestSize;
+    
+    while(!mFinished)
+    {
+        SizeT inLen = size;
+        ELzmaStatus status;
+        SizeT before = mState->dicPos;
+        
+        if(LzmaDec_DecodeToDic(mState, dicLimit, data, &inLen, LZMA_FINISH_ANY, &status) != SZ_OK)
+            throw std::runtime_error("LZMA decompression failed");
+        data += inLen;
+        size -= inLen;
+        mDecodedSize = mState->dicPos;
+        
+        if(mState->dicPos == dicLimit || status == LZMA_STATUS_FINISHED_WITH_MARK)
+            mFinished = true;
+        else if(inLen == 0 && mState->dicPos == before)
+            break; // Needs more input
+    }
 }
 
-std::string readString(uint8_t** dataPtr, uint8_t* dataEnd, size_t length) {
-    if (*dataPtr + length > dataEnd) {
-        throw std::runtime_error("Not enough data to read std::string.");
+void LZMAStream::decodeToSink(const uint8_t* data, size_t size)
+{
+    while(!mFinished)
+    {
+        SizeT outLen = mChunk.size();
+        if(mUncompressedSize != UINT64_MAX && mUncompressedSize - mDecodedSize < outLen)
+            outLen = static_cast<SizeT>(mUncompressedSize - mDecodedSize);
+        SizeT inLen = size;
+        ELzmaStatus status;
+        
+        if(LzmaDec_DecodeToBuf(mState, mChunk.data(), &outLen, data, &inLen, LZMA_FINISH_ANY, &status) != SZ_OK)
+            throw std::runtime_error("LZMA decompression failed");
+        data += inLen;
+        size -= inLen;
+        
+        if(outLen)
+        {
+            mDecodedSize += outLen;
+            mSink(mChunk.data(), outLen);
+        }
+        
+        if(mDecodedSize == mUncompressedSize || status == LZMA_STATUS_FINISHED_WITH_MARK)
+            mFinished = true;
+        else if(inLen == 0 && outLen == 0)
+            break; // Needs more input
     }
-
-    std::string value(reinterpret_cast<char*>(*dataPtr), length);
-    *dataPtr += length; // Move the pointer forward by the length of the string
-
-    return value;
 }
 
-std::vector<uint8_t> readUInt8Array(uint8_t** dataPtr, uint8_t* dataEnd, size_t length) {
-    if (*dataPtr + length > dataEnd) {
-        throw std::runtime_error("Not enough data to read uint8_t array.");
+MappedFile::MappedFile(const std::string& filename)
+{
+#ifdef HAS_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error("Failed to open file.");
+    
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Failed to stat file.");
     }
+    mSize = static_cast<size_t>(st.st_size);
+    
+    if(mSize > 0)
+    {
+        void* address = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(address != MAP_FAILED)
+        {
+            mData = static_cast<const uint8_t*>(address);
+            mMapped = true;
+        }
+    }
+    close(fd);
+    
+    if(mMapped || mSize == 0)
+        return;
+#endif
+    // No mmap (or it failed), read the whole thing in one go instead
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file || !file.is_open())
+        throw std::runtime_error("Failed to open file.");
+    
+    file.seekg(0, std::ios::end);
+    mBuffer.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    file.read(reinterpret_cast<char*>(mBuffer.data()), mBuffer.size());
+    if (!file)
+        throw std::runtime_error("Failed to read file.");
+    
+    mData = mBuffer.data();
+    mSize = mBuffer.size();
+}
 
-    std::vector<uint8_t> value(*dataPtr, *dataPtr + length);
-    *dataPtr += length; // Move the pointer forward by the length of the array
-
-    return value;
+MappedFile::~MappedFile()
+{
+#ifdef HAS_MMAP
+    if(mMapped)
+        munmap(const_cast<uint8_t*>(mData), mSize);
+#endif
 }
 
+// Utilities
 uint32_t readUint32(std::ifstream& file)
 {
     uint8_t buffer[4];
@@ -179,3 +386,48 @@ std::string getBasename(const std::string& path)
     // Extract and return the substring after the last separator
     return path.substr(lastSeparator + 1);
 }
+
+std::string uniqueTempPath(const std::string& path)
+{
+#if defined(HAS_MMAP)
+    uint64_t process = static_cast<uint64_t>(getpid());
+#elif defined(_WIN32)
+    uint64_t process = static_cast<uint64_t>(_getpid());
+#else
+    uint64_t process = 0; // Only ever one process writing
+#endif
+    return path + "." + std::to_string(process) + "." + std::to_string(g_TempCount++) + ".tmp";
+}
+
+uint64_t hashBytes(const uint8_t* data, size_t size, uint64_t seed)
+{
+    const uint64_t k1 = 0x9E3779B97F4A7C15ull;
+    const uint64_t k2 = 0xBF58476D1CE4E5B9ull;
+    uint64_t hash = seed ^ (size * k1);
+    
+    auto mix = [&](uint64_t word)
+    {
+        word *= k1;
+        word ^= word >> 32;
+        hash = (hash ^ word) * k2;
+        hash ^= hash >> 29;
+    };
+    
+    for(; size >= 8; data += 8, size -= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        mix(word);
+    }
+    if(size)
+    {
+        uint64_t word = 0;
+        std::memcpy(&word, data, size);
+        mix(word ^ (uint64_t(size) << 56));
+    }
+    
+    hash ^= hash >> 31;
+    hash *= k1;
+    hash ^= hash >> 33;
+    return hash;
+}
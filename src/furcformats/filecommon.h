@@ -5,19 +5,126 @@
 #include <vector>
 #include <cstring>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include "LzmaDec.h"
 
+#define LZMA_ALONE_HEADER_SIZE 13 // LZMA Alone has 5 bytes properties + 8 bytes uncompressed size
+
+// Read-only view of a whole file. Uses mmap where the platform has it and
+// falls back to reading the file into a single buffer (e.g. on the 3DS).
+class MappedFile
+{
+protected:
+    const uint8_t* mData = nullptr;
+    size_t mSize = 0;
+    bool mMapped = false;
+    std::vector<uint8_t> mBuffer;
+
+public:
+    MappedFile(const std::string& filename);
+    ~MappedFile();
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    const uint8_t* data() const { return mData; };
+    size_t size() const { return mSize; };
+    bool isMapped() const { return mMapped; };
+};
+
+// Keeps CLzmaDec probability tables alive between decodes. Every thread has
+// its own idle list, so leases never contend. A table is only reallocated
+// when the props need a different number of probs (lc + lp changed).
+class LZMADecoderPool
+{
+public:
+    struct Decoder;
+    
+    class Lease
+    {
+    protected:
+        std::unique_ptr<Decoder> mDecoder;
+    
+    public:
+        Lease() = default;
+        Lease(std::unique_ptr<Decoder> decoder);
+        Lease(Lease&&) noexcept;
+        Lease& operator=(Lease&&) noexcept;
+        ~Lease();
+        
+        CLzmaDec* get() const;
+    };
+    
+    struct Stats
+    {
+        uint64_t mAllocations = 0; // Calls into the LZMA allocator
+        uint64_t mAcquired = 0;
+        uint64_t mReused = 0;      // Leases that didn't need new probs
+    };
+    
+    // Returns a decoder with probs ready for the 5 byte props. The caller
+    // still sets up the dictionary and calls LzmaDec_Init.
+    static Lease acquire(const uint8_t* props);
+    // Frees the calling thread's idle decoders
+    static void trim();
+    static Stats stats();
+};
+
+// Incremental LZMA "Alone" decoder. Compressed input can be fed in chunks of
+// any size (header included), so the whole stream never has to be in memory.
+class LZMAStream
+{
+public:
+    using Sink = std::function<void(const uint8_t* data, size_t size)>;
+
+protected:
+    LZMADecoderPool::Lease mDecoder;
+    CLzmaDec* mState = nullptr;
+    uint8_t mHeader[LZMA_ALONE_HEADER_SIZE];
+    size_t mHeaderSize = 0;
+    bool mReady = false;
+    bool mFinished = false;
+    
+    uint8_t* mDest = nullptr;
+    size_t mDestSize = 0;
+    Sink mSink;
+    std::vector<uint8_t> mChunk;
+    
+    uint64_t mUncompressedSize;
+    uint64_t mDecodedSize = 0;
+    
+    void begin();
+    void decodeToDest(const uint8_t* data, size_t size);
+    void decodeToSink(const uint8_t* data, size_t size);
+
+public:
+    // Decodes straight into dest, which doubles as the dictionary so no
+    // extra window is allocated. dest must hold the whole result.
+    LZMAStream(uint8_t* dest, size_t destSize);
+    // Hands decoded data to sink in pieces of at most chunkSize bytes. The
+    // window is capped at the uncompressed size (0 = take it from the header).
+    LZMAStream(Sink sink, uint64_t uncompressedSize = 0, size_t chunkSize = 16384);
+    ~LZMAStream();
+    
+    LZMAStream(const LZMAStream&) = delete;
+    LZMAStream& operator=(const LZMAStream&) = delete;
+    
+    // Feeds the next piece of compressed input, returns true once done
+    bool write(const uint8_t* data, size_t size);
+    bool finished() const { return mFinished; };
+    uint64_t decodedSize() const { return mDecodedSize; };
+};
+
 std::vector<uint8_t> decompressLZMA(const std::vector<uint8_t>& compressedData, SizeT uncompressedSize);
-uint32_t readUint32(uint8_t** dataPtr, uint8_t* dataEnd);
-int32_t readInt32(uint8_t** dataPtr, uint8_t* dataEnd);
-uint16_t readUint16(uint8_t** dataPtr, uint8_t* dataEnd);
-int16_t readInt16(uint8_t** dataPtr, uint8_t* dataEnd);
-uint8_t readUint8(uint8_t** dataPtr, uint8_t* dataEnd);
-int8_t readInt8(uint8_t** dataPtr, uint8_t* dataEnd);
-std::string readString(uint8_t** dataPtr, uint8_t* dataEnd, size_t length);
-std::vector<uint8_t> readUInt8Array(uint8_t** dataPtr, uint8_t* dataEnd, size_t length);
+std::vector<uint8_t> decompressLZMA(const uint8_t* compressedData, size_t compressedSize, SizeT uncompressedSize);
 uint32_t readUint32(std::ifstream& file);
 uint16_t readUint16(std::ifstream& file);
 std::string getBasename(const std::string& path);
+// Name next to path for writing before renaming over it. Never the same
+// twice, not even across threads or processes writing the same path.
+std::string uniqueTempPath(const std::string& path);
+// Fast 64-bit hash for change detection, not for anything adversarial
+uint64_t hashBytes(const uint8_t* data, size_t size, uint64_t seed = 0);
 
 #endif
\ No newline at end of file
@@ -1,605 +1,654 @@
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
 #include "filecommon.h"
 #include "fox5.h"
+#include "fox5cache.h"
+#include "fox5schema.h"
 
 #ifdef HAVE_PROPRIETARY
     #include "fox5cipher.h"
     #define HAS_CIPHER
 #endif
 
-void FOX5Command::parseData(uint8_t** dataPtr, uint8_t* dataEnd)
+#define FOX5_FOOTER_SIZE 20
+#define FOX5_STREAM_CHUNK 4096
+
+namespace
 {
-    uint8_t cmd = readUint8(dataPtr, dataEnd);
-    mCommand = static_cast<FOX5Command::Command>(cmd);
-    switch(mCommand)
+    using Type = FOX5Command::Type;
+    
+    template <Type FieldType, bool Checked>
+    void decodeField(FOX5Command& command, BigEndianReader& reader)
     {
-        // Shared
-        case FOX5Command::Command::NOP:
-            break;
+        auto read = [&]<typename T>() { return Checked ? reader.get<T>() : reader.getUnchecked<T>(); };
+        if constexpr (FieldType == Type::UInt8)
+            command.addValue(FieldType, read.template operator()<uint8_t>());
+        else if constexpr (FieldType == Type::Int8)
+            command.addValue(FieldType, read.template operator()<int8_t>());
+        else if constexpr (FieldType == Type::UInt16)
+            command.addValue(FieldType, read.template operator()<uint16_t>());
+        else if constexpr (FieldType == Type::Int16)
+            command.addValue(FieldType, read.template operator()<int16_t>());
+        else if constexpr (FieldType == Type::UInt32)
+            command.addValue(FieldType, read.template operator()<uint32_t>());
+        else if constexpr (FieldType == Type::Int32)
+            command.addValue(FieldType, read.template operator()<int32_t>());
+        else if constexpr (FieldType == Type::String)
+            command.addValue(FieldType, std::string(reader.getString(reader.get<uint16_t>())));
+        else
+        {
+            std::span<const uint8_t> bytes = reader.getBytes(reader.get<uint16_t>());
+            command.addValue(FieldType, std::vector<uint8_t>(bytes.begin(), bytes.end()));
+        }
+    }
+    
+    // One decoder per opcode, with the layout known at compile time the
+    // field loop unrolls and fixed size records are checked once
+    template <uint8_t Opcode>
+    void decodeCommand(FOX5Command& command, BigEndianReader& reader)
+    {
+        constexpr FOX5Schema::Layout layout = FOX5Schema::TABLE[Opcode];
+        constexpr bool fixed = !layout.mHasStrings;
         
-        case FOX5Command::Command::LIST_START:
-            reserveValues(2);
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            addValue(FOX5Command::Type::UInt32, static_cast<uint32_t>(readUint32(dataPtr, dataEnd)));
-            break;
+        size_t count = 1;
+        if constexpr (layout.mCountSize == 2)
+            count = reader.get<uint16_t>();
+        else if constexpr (layout.mCountSize == 4)
+            count = reader.get<uint32_t>();
         
-        case FOX5Command::Command::LIST_END:
-            break;
+        // The least the records can take, string data aside
+        reader.need(count, layout.mRecordSize);
+        command.reserveValues((layout.mCountSize ? 1 : 0) + count * layout.mFieldCount);
         
-        // File
-        case FOX5Command::Command::FILE_IMAGE_LIST:
+        if constexpr (layout.mCountSize == 2)
+            command.addValue(Type::UInt16, static_cast<uint16_t>(count));
+        else if constexpr (layout.mCountSize == 4)
+            command.addValue(Type::UInt32, static_cast<uint32_t>(count));
+        if constexpr (layout.mFieldCount > 0)
         {
-            size_t count = readUint32(dataPtr, dataEnd);
-            
-            reserveValues(1 + (count * 4));
-            addValue(FOX5Command::Type::UInt32, static_cast<uint32_t>(count));
-            for(uint32_t i = 0; i < count; i++)
+            for(size_t i = 0; i < count; i++)
             {
-                addValue(FOX5Command::Type::UInt32, static_cast<uint32_t>(readUint32(dataPtr, dataEnd)));
-                addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(readUint16(dataPtr, dataEnd)));
-                addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(readUint16(dataPtr, dataEnd)));
-                addValue(FOX5Command::Type::UInt8,  static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
+                [&]<size_t... Field>(std::index_sequence<Field...>)
+                {
+                    (decodeField<layout.mFields[Field], !fixed>(command, reader), ...);
+                }(std::make_index_sequence<layout.mFieldCount>{});
             }
-            break;
         }
+    }
+    
+    // Steps over one command's payload, fixed size ones in a single skip
+    template <uint8_t Opcode>
+    void skipCommand(BigEndianReader& reader)
+    {
+        constexpr FOX5Schema::Layout layout = FOX5Schema::TABLE[Opcode];
         
-        case FOX5Command::Command::FILE_GENERATOR:
-        {
-            addValue(FOX5Command::Type::UInt8,  static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            break;
-        }
+        size_t count = 1;
+        if constexpr (layout.mCountSize == 2)
+            count = reader.get<uint16_t>();
+        else if constexpr (layout.mCountSize == 4)
+            count = reader.get<uint32_t>();
         
-        // Object
-        case FOX5Command::Command::OBJECT_AUTHOR_REVISION:
-        {
-            addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(readUint16(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::OBJECT_AUTHORS:
-        {
-            uint16_t count = readUint16(dataPtr, dataEnd);
-            reserveValues(1 + count);
-            addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(count));
-            for(uint16_t i = 0; i < count; i++)
-            {
-                uint16_t size = readUint16(dataPtr, dataEnd);
-                addValue(FOX5Command::Type::String, readString(dataPtr, dataEnd, size));
-            }
-            break;
-        }
-        case FOX5Command::Command::OBJECT_AUTHORS_HASH:
+        if constexpr (!layout.mHasStrings)
         {
-            uint16_t count = readUint16(dataPtr, dataEnd);
-            reserveValues(1 + count);
-            addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(count));
-            for(uint16_t i = 0; i < count; i++)
-            {
-                uint16_t size = readUint16(dataPtr, dataEnd);
-                addValue(FOX5Command::Type::Bytes, readUInt8Array(dataPtr, dataEnd, size));
-            }
+            reader.need(count, layout.mRecordSize);
+            reader.skip(count * layout.mRecordSize);
         }
-        case FOX5Command::Command::OBJECT_LICENSE:
+        else
         {
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::OBJECT_KEYWORDS:
-        {
-            uint16_t count = readUint16(dataPtr, dataEnd);
-            reserveValues(1 + count);
-            addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(count));
-            for(uint16_t i = 0; i < count; i++)
+            for(size_t i = 0; i < count; i++)
             {
-                uint16_t size = readUint16(dataPtr, dataEnd);
-                addValue(FOX5Command::Type::String, readString(dataPtr, dataEnd, size));
+                [&]<size_t... Field>(std::index_sequence<Field...>)
+                {
+                    ((layout.mFields[Field] == Type::String || layout.mFields[Field] == Type::Bytes
+                        ? reader.skip(reader.get<uint16_t>())
+                        : reader.skip(FOX5Schema::fieldSize(layout.mFields[Field]))), ...);
+                }(std::make_index_sequence<layout.mFieldCount>{});
             }
-            break;
-        }
-        case FOX5Command::Command::OBJECT_NAME:
-        {
-            uint16_t size = readUint16(dataPtr, dataEnd);
-            addValue(FOX5Command::Type::String, readString(dataPtr, dataEnd, size));
-            break;
-        }
-        case FOX5Command::Command::OBJECT_DESCRIPTION:
-        {
-            uint16_t size = readUint16(dataPtr, dataEnd);
-            addValue(FOX5Command::Type::String, readString(dataPtr, dataEnd, size));
-            break;
-        }
-        case FOX5Command::Command::OBJECT_FLAGS:
-        {
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::OBJECT_URI:
-        {
-            uint16_t size = readUint16(dataPtr, dataEnd);
-            addValue(FOX5Command::Type::String, FOX5Value(readString(dataPtr, dataEnd, size)));
-            break;
-        }
-        case FOX5Command::Command::OBJECT_MORE_FLAGS:
-        {
-            addValue(FOX5Command::Type::UInt32, static_cast<uint32_t>(readUint32(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::OBJECT_IDENTIFIER:
-        {
-            addValue(FOX5Command::Type::Int32, static_cast<int32_t>(readInt32(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::OBJECT_EDIT_TYPE:
-        {
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            break;
         }
-        case FOX5Command::Command::OBJECT_FILTER:
+    }
+    
+    using CommandDecoder = void (*)(FOX5Command&, BigEndianReader&);
+    using CommandSkipper = void (*)(BigEndianReader&);
+    
+    template <size_t... Opcode>
+    constexpr std::array<CommandDecoder, 256> makeDecoders(std::index_sequence<Opcode...>)
+    {
+        return {(FOX5Schema::TABLE[Opcode].mKnown ? &decodeCommand<Opcode> : nullptr)...};
+    }
+    
+    template <size_t... Opcode>
+    constexpr std::array<CommandSkipper, 256> makeSkippers(std::index_sequence<Opcode...>)
+    {
+        return {(FOX5Schema::TABLE[Opcode].mKnown ? &skipCommand<Opcode> : nullptr)...};
+    }
+    
+    constexpr std::array<CommandDecoder, 256> DECODERS = makeDecoders(std::make_index_sequence<256>{});
+    constexpr std::array<CommandSkipper, 256> SKIPPERS = makeSkippers(std::make_index_sequence<256>{});
+    
+    [[noreturn]] void unknownCommand(uint8_t cmd)
+    {
+        throw std::runtime_error("Unknown command " + std::to_string(cmd));
+    }
+}
+
+void FOX5Command::parseData(BigEndianReader& reader)
+{
+    uint8_t cmd = reader.get<uint8_t>();
+    mCommand = static_cast<FOX5Command::Command>(cmd);
+    if(!DECODERS[cmd])
+        unknownCommand(cmd);
+    DECODERS[cmd](*this, reader);
+}
+
+void FOX5Command::skip(Command cmd, BigEndianReader& reader)
+{
+    uint8_t opcode = static_cast<uint8_t>(cmd);
+    if(!SKIPPERS[opcode])
+        unknownCommand(opcode);
+    SKIPPERS[opcode](reader);
+}
+
+void FOX5Command::validate(std::span<const uint8_t> block)
+{
+    BigEndianReader reader(block);
+    if(reader.remaining() < 4 || reader.getString(4) != "FOX5")
+        throw std::runtime_error("Command block doesn't start with FOX5.");
+    
+    // Entries left in each open list, the innermost last
+    std::vector<uint64_t> open;
+    bool started = false;
+    while(!reader.empty())
+    {
+        size_t offset = reader.mPointer - block.data();
+        auto fail = [&](const std::string& error)
         {
-            reserveValues(2);
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            break;
-        }
+            throw std::runtime_error(error + " at offset " + std::to_string(offset) + ".");
+        };
         
-        // Shape
-        case FOX5Command::Command::SHAPE_PURPOSE:
-        {
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::SHAPE_STATE:
-        {
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::SHAPE_DIRECTION:
-        {
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::SHAPE_RATIO:
-        {
-            reserveValues(2);
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::SHAPE_KITTERSPEAK:
-        {
-            uint16_t count = readUint16(dataPtr, dataEnd);
-            reserveValues(1 + (count * 3));
-            addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(count));
-            for(uint16_t i = 0; i < count; i++)
-            {
-                addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(readUint16(dataPtr, dataEnd)));
-                addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-                addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-            }
-            break;
-        }
+        uint8_t cmd = reader.get<uint8_t>();
+        const FOX5Schema::Layout& layout = FOX5Schema::TABLE[cmd];
+        if(!layout.mKnown)
+            fail("Unknown command " + std::to_string(cmd));
+        if(started && open.empty())
+            fail("Data after the file list");
+        if(layout.mLevel != FOX5Schema::ANY_LEVEL && layout.mLevel != open.size())
+            fail("Command " + std::to_string(cmd) + " outside its level");
         
-        // Frame
-        case FOX5Command::Command::FRAME_OFFSET:
-        {
-            reserveValues(2);
-            addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-            addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::FRAME_FURRE_OFFSET:
-        {
-            reserveValues(2);
-            addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-            addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::FRAME_ATTACH_PLUGS:
+        switch(static_cast<Command>(cmd))
         {
-            reserveValues(4);
-            addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(readUint16(dataPtr, dataEnd)));
-            addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-            addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-            addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::FRAME_ATTACH_SOCKETS:
-        {
-            uint16_t count = readUint16(dataPtr, dataEnd);
-            reserveValues(1 + (count * 4));
-            addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(count));
-            for(uint16_t i = 0; i < count; i++)
+            case Command::LIST_START:
             {
-                addValue(FOX5Command::Type::UInt8, static_cast<uint8_t>(readUint8(dataPtr, dataEnd)));
-                addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-                addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-                addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
+                uint8_t level = reader.get<uint8_t>();
+                uint32_t count = reader.get<uint32_t>();
+                if(level != open.size())
+                    fail("List level " + std::to_string(level) + " at depth " + std::to_string(open.size()));
+                if(count > reader.remaining())
+                    fail("List is longer than the data left");
+                if(count > 0)
+                    open.push_back(count);
+                started = true;
+                break;
             }
-            break;
-        }
-        
-        // Channel
-        case FOX5Command::Command::CHANNEL_PURPOSE:
-        {
-            addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(readUint16(dataPtr, dataEnd)));
-            break;
-        }
-        case FOX5Command::Command::CHANNEL_IMAGE_ID:
-        {
-            addValue(FOX5Command::Type::UInt16, static_cast<uint16_t>(readUint16(dataPtr, dataEnd)));
-            break;
+            
+            case Command::LIST_END:
+                if(open.empty())
+                    fail("List end outside any list");
+                // A list is done once its last entry ends
+                if(--open.back() == 0)
+                    open.pop_back();
+                break;
+            
+            default:
+                if(open.empty())
+                    fail("Command outside the file list");
+                skip(static_cast<Command>(cmd), reader);
+                break;
         }
-        case FOX5Command::Command::CHANNEL_OFFSET:
+    }
+    if(!started)
+        throw std::runtime_error("Command block has no file list.");
+    if(!open.empty())
+        throw std::runtime_error("Command block ends inside a list.");
+}
+
+static std::string g_CacheDirectory;
+
+// Reads the LIST_START payload and checks it's the expected level. Every
+// entry takes at least its LIST_END, so a count past the end is bogus.
+static uint32_t readListStart(BigEndianReader& reader, uint8_t expectedLevel, const char* error)
+{
+    uint8_t level = reader.get<uint8_t>();
+    if(level != expectedLevel)
+        throw std::runtime_error(error);
+    uint32_t count = reader.get<uint32_t>();
+    if(count > reader.remaining())
+        throw std::runtime_error("List is longer than the data left.");
+    return count;
+}
+
+// Skips count list entries and everything nested in them. Every entry at
+// any depth ends in exactly one LIST_END.
+static void skipEntries(uint64_t count, BigEndianReader& reader)
+{
+    while(count > 0)
+    {
+        FOX5Command::Command cmd = reader.get<FOX5Command::Command>();
+        if(cmd == FOX5Command::Command::LIST_START)
         {
-            reserveValues(2);
-            addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-            addValue(FOX5Command::Type::Int16, static_cast<int16_t>(readInt16(dataPtr, dataEnd)));
-            break;
+            reader.get<uint8_t>();
+            count += reader.get<uint32_t>();
         }
-        
-        default:
-            throw std::runtime_error("Unknown command " + std::to_string(cmd));
+        else if(cmd == FOX5Command::Command::LIST_END)
+            count--;
+        else
+            FOX5Command::skip(cmd, reader);
     }
 }
 
-void FOX5Channel::parseData(uint8_t** dataPtr, uint8_t* dataEnd)
+// Parses count entries onto the end of pool. Grandchildren go to other
+// pools, so siblings always end up next to each other.
+template <typename T, typename... Args>
+static FOX5Range parseChildren(std::vector<T>& pool, uint32_t count, Args&&... args)
 {
-    while (*dataPtr < dataEnd)
+    FOX5Range range;
+    range.mStart = static_cast<uint32_t>(pool.size());
+    range.mCount = count;
+    for(uint32_t i = 0; i < count; i++)
     {
-        FOX5Command cmd = FOX5Command(dataPtr, dataEnd);
-        switch(cmd.mCommand)
+        T child(args...);
+        pool.push_back(std::move(child));
+    }
+    return range;
+}
+
+void FOX5Channel::parseData(BigEndianReader& reader)
+{
+    FOX5Command::parseEntry(reader, [&](FOX5Command::Command cmd)
+    {
+        switch(cmd)
         {
-            case FOX5Command::Command::NOP:
-                break;
-            
             case FOX5Command::Command::LIST_START:
-            {
                 throw std::runtime_error("FOX5Channel can't contain lists");
-                break;
-            }
-            
-            case FOX5Command::Command::LIST_END:
-                return;
-            
             
             case FOX5Command::Command::CHANNEL_PURPOSE:
-            {
-                mPurpose = cmd.getValue<uint16_t>();
-                break;
-            }
+                mPurpose = reader.get<uint16_t>();
+                return true;
+            
             case FOX5Command::Command::CHANNEL_IMAGE_ID:
-            {
-                mImageID = cmd.getValue<uint16_t>();
-                break;
-            }
+                mImageID = reader.get<uint16_t>();
+                return true;
+            
             case FOX5Command::Command::CHANNEL_OFFSET:
-            {
-                mOffset[0] = cmd.getValue<int16_t>();
-                mOffset[1] = cmd.getValue<int16_t>();
-                break;
-            }
+                reader.need(FOX5Schema::recordSize(FOX5Command::Command::CHANNEL_OFFSET));
+                mOffset[0] = reader.getUnchecked<int16_t>();
+                mOffset[1] = reader.getUnchecked<int16_t>();
+                return true;
+            
+            default:
+                return false;
         }
-    }
+    });
 }
 
-void FOX5Frame::parseData(uint8_t** dataPtr, uint8_t* dataEnd)
+void FOX5Frame::parseData(FOX5& fox, BigEndianReader& reader)
 {
-    while (*dataPtr < dataEnd)
+    FOX5Command::parseEntry(reader, [&](FOX5Command::Command cmd)
     {
-        FOX5Command cmd = FOX5Command(dataPtr, dataEnd);
-        switch(cmd.mCommand)
+        switch(cmd)
         {
-            case FOX5Command::Command::NOP:
-                break;
-            
             case FOX5Command::Command::LIST_START:
             {
-                uint8_t level = cmd.getValue<uint8_t>();
-                if(level != 4)
-                    throw std::runtime_error("Expected sprite level 4 in FOX5Frame");
-                
-                uint32_t count = cmd.getValue<uint32_t>();
-                
-                mSprites.resize(count);
-                for(uint32_t i = 0; i < count; i++)
-                {
-                    mSprites[i] = std::make_shared<FOX5Channel>(
-                        dataPtr, dataEnd
-                    );
-                }
-                break;
+                uint32_t count = readListStart(reader, 4, "Expected sprite level 4 in FOX5Frame");
+                mSprites = parseChildren(fox.mChannels, count, reader);
+                return true;
             }
             
-            case FOX5Command::Command::LIST_END:
-                return;
-            
-            
             case FOX5Command::Command::FRAME_OFFSET:
-            {
-                mFrameOffset[0] = cmd.getValue<int16_t>();
-                mFrameOffset[1] = cmd.getValue<int16_t>();
-                break;
-            }
+                reader.need(FOX5Schema::recordSize(FOX5Command::Command::FRAME_OFFSET));
+                mFrameOffset[0] = reader.getUnchecked<int16_t>();
+                mFrameOffset[1] = reader.getUnchecked<int16_t>();
+                return true;
+            
             case FOX5Command::Command::FRAME_FURRE_OFFSET:
-            {
-                mFurreOffset[0] = cmd.getValue<int16_t>();
-                mFurreOffset[1] = cmd.getValue<int16_t>();
-                break;
-            }
+                reader.need(FOX5Schema::recordSize(FOX5Command::Command::FRAME_FURRE_OFFSET));
+                mFurreOffset[0] = reader.getUnchecked<int16_t>();
+                mFurreOffset[1] = reader.getUnchecked<int16_t>();
+                return true;
+            
+            default:
+                return false;
         }
-    }
+    });
 }
 
-void FOX5Shape::parseData(uint8_t** dataPtr, uint8_t* dataEnd)
+void FOX5Shape::parseData(FOX5& fox, BigEndianReader& reader)
 {
-    while (*dataPtr < dataEnd)
+    FOX5Command::parseEntry(reader, [&](FOX5Command::Command cmd)
     {
-        FOX5Command cmd = FOX5Command(dataPtr, dataEnd);
-        switch(cmd.mCommand)
+        switch(cmd)
         {
-            case FOX5Command::Command::NOP:
-                break;
-            
             case FOX5Command::Command::LIST_START:
             {
-                uint8_t level = cmd.getValue<uint8_t>();
-                if(level != 3)
-                    throw std::runtime_error("Expected frame level 3 in FOX5Shape");
-                
-                uint32_t count = cmd.getValue<uint32_t>();
-                
-                mFrames.resize(count);
-                for(uint32_t i = 0; i < count; i++)
-                {
-                    mFrames[i] = std::make_shared<FOX5Frame>(
-                        dataPtr, dataEnd
-                    );
-                }
-                break;
+                uint32_t count = readListStart(reader, 3, "Expected frame level 3 in FOX5Shape");
+                mFrames = parseChildren(fox.mFrames, count, fox, reader);
+                return true;
             }
             
-            case FOX5Command::Command::LIST_END:
-                return;
-            
-                
             case FOX5Command::Command::SHAPE_PURPOSE:
-            {
-                mPurpose = static_cast<FOX5Shape::Purpose>(cmd.getValue<uint8_t>());
-                break;
-            }
+                mPurpose = static_cast<FOX5Shape::Purpose>(reader.get<uint8_t>());
+                return true;
+            
             case FOX5Command::Command::SHAPE_STATE:
-            {
-                mState = cmd.getValue<uint8_t>();
-                break;
-            }
+                mState = reader.get<uint8_t>();
+                return true;
+            
             case FOX5Command::Command::SHAPE_DIRECTION:
-            {
-                mDirection = static_cast<FOX5Shape::Direction>(cmd.getValue<uint8_t>());
-                break;
-            }
+                mDirection = static_cast<FOX5Shape::Direction>(reader.get<uint8_t>());
+                return true;
+            
             case FOX5Command::Command::SHAPE_RATIO:
-            {
-                mRatio[0] = cmd.getValue<uint8_t>();
-                mRatio[1] = cmd.getValue<uint8_t>();
-                break;
-            }
+                mRatio[0] = reader.get<uint8_t>();
+                mRatio[1] = reader.get<uint8_t>();
+                return true;
+            
             case FOX5Command::Command::SHAPE_KITTERSPEAK:
             {
-                uint16_t count = cmd.getValue<uint16_t>();
-                mKitterspeak.resize(count);
+                uint16_t count = reader.get<uint16_t>();
+                reader.need(count, FOX5Schema::recordSize(FOX5Command::Command::SHAPE_KITTERSPEAK));
+                mKitterspeak.mStart = static_cast<uint32_t>(fox.mKitterspeak.size());
+                mKitterspeak.mCount = count;
                 for(uint16_t i = 0; i < count; i++)
                 {
-                    uint16_t tmp = cmd.getValue<uint16_t>();
-                    mKitterspeak[i] = std::make_shared<Kitterspeak_t>(
-                        tmp,
-                        cmd.getValue<int16_t>(),
-                        cmd.getValue<int16_t>()
-                    );
+                    uint16_t command = reader.getUnchecked<uint16_t>();
+                    int16_t arg1 = reader.getUnchecked<int16_t>();
+                    int16_t arg2 = reader.getUnchecked<int16_t>();
+                    fox.mKitterspeak.emplace_back(command, arg1, arg2);
                 }
-                break;
+                return true;
             }
+            
+            default:
+                return false;
         }
-    }
+    });
 }
 
-void FOX5Object::parseData(uint8_t** dataPtr, uint8_t* dataEnd)
+void FOX5Object::parseData(FOX5& fox, BigEndianReader& reader)
 {
-    while (*dataPtr < dataEnd)
+    FOX5Command::parseEntry(reader, [&](FOX5Command::Command cmd)
     {
-        FOX5Command cmd = FOX5Command(dataPtr, dataEnd);
-        switch(cmd.mCommand)
+        switch(cmd)
         {
-            case FOX5Command::Command::NOP:
-                break;
-            
             case FOX5Command::Command::LIST_START:
             {
-                uint8_t level = cmd.getValue<uint8_t>();
-                if(level != 2)
-                    throw std::runtime_error("Expected shape level 2 in FOX5Object");
-                
-                uint32_t count = cmd.getValue<uint32_t>();
-                
-                mShapes.resize(count);
-                for(uint32_t i = 0; i < count; i++)
-                {
-                    mShapes[i] = std::make_shared<FOX5Shape>(
-                        dataPtr, dataEnd
-                    );
-                }
-                break;
+                uint32_t count = readListStart(reader, 2, "Expected shape level 2 in FOX5Object");
+                if(fox.parseMode() == FOX5::ParseMode::OBJECTS)
+                    skipEntries(count, reader);
+                else
+                    mShapes = parseChildren(fox.mShapes, count, fox, reader);
+                return true;
             }
             
-            case FOX5Command::Command::LIST_END:
-                return;
-            
-            
             case FOX5Command::Command::OBJECT_AUTHOR_REVISION:
-            {
-                mAuthorRevision = cmd.getValue<uint16_t>();
-                break;
-            }
+                mAuthorRevision = reader.get<uint16_t>();
+                return true;
+            
             case FOX5Command::Command::OBJECT_AUTHORS:
             {
-                // TODO: Actually add strings here
-                uint16_t count = cmd.getValue<uint16_t>();
-                mAuthors.resize(count);
+                uint16_t count = reader.get<uint16_t>();
+                mAuthors.reserve(mAuthors.size() + count);
                 for(uint16_t i = 0; i < count; i++)
                 {
-                    mAuthors.push_back(cmd.getValue<std::string>());
-                }
-                break;
-            }
-            /*
-            case FOX5Command::Command::AUTHORS_HASH:
-            {
-                // TODO: Actually add strings here
-                uint16_t count = cmd.getValue<uint16_t>();
-                mAuthors.resize(count);
-                for(uint16_t i; i < count; i++)
-                {
-                    mAuthors.push_back(cmd.getValue<std::string>());
+                    uint16_t size = reader.get<uint16_t>();
+                    mAuthors.emplace_back(reader.getString(size));
                 }
-                break;
+                return true;
             }
-            */
+            
             case FOX5Command::Command::OBJECT_LICENSE:
-            {
-                mLicense = static_cast<FOX5Object::License>(cmd.getValue<uint8_t>());
-                break;
-            }
+                mLicense = static_cast<FOX5Object::License>(reader.get<uint8_t>());
+                return true;
+            
             case FOX5Command::Command::OBJECT_KEYWORDS:
             {
-                // TODO: Actually add strings here
-                uint16_t count = cmd.getValue<uint16_t>();
-                mKeywords.resize(count);
+                uint16_t count = reader.get<uint16_t>();
+                mKeywords.reserve(mKeywords.size() + count);
                 for(uint16_t i = 0; i < count; i++)
                 {
-                    mKeywords.push_back(cmd.getValue<std::string>());
+                    uint16_t size = reader.get<uint16_t>();
+                    mKeywords.emplace_back(reader.getString(size));
                 }
-                break;
+                return true;
             }
+            
             case FOX5Command::Command::OBJECT_NAME:
-            {
-                mName = cmd.getValue<std::string>();
-                break;
-            }
+                mName = reader.getString(reader.get<uint16_t>());
+                return true;
+            
             case FOX5Command::Command::OBJECT_DESCRIPTION:
-            {
-                mDescription = cmd.getValue<std::string>();
-                break;
-            }
+                mDescription = reader.getString(reader.get<uint16_t>());
+                return true;
+            
             case FOX5Command::Command::OBJECT_FLAGS:
-            {
-                mFlags = cmd.getValue<uint8_t>();
-                break;
-            }
+                mFlags = reader.get<uint8_t>();
+                return true;
+            
             case FOX5Command::Command::OBJECT_URI:
-            {
-                mURI = cmd.getValue<std::string>();
-                break;
-            }
+                mURI = reader.getString(reader.get<uint16_t>());
+                return true;
+            
             case FOX5Command::Command::OBJECT_MORE_FLAGS:
-            {
-                mMoreFlags = cmd.getValue<uint32_t>();
-                break;
-            }
+                mMoreFlags = reader.get<uint32_t>();
+                return true;
+            
             case FOX5Command::Command::OBJECT_IDENTIFIER:
-            {
-                mObjectID = cmd.getValue<int32_t>();
-                break;
-            }
+                mObjectID = reader.get<int32_t>();
+                return true;
+            
             case FOX5Command::Command::OBJECT_EDIT_TYPE:
-            {
-                mEditType = cmd.getValue<uint8_t>();
-                break;
-            }
+                mEditType = reader.get<uint8_t>();
+                return true;
+            
             case FOX5Command::Command::OBJECT_FILTER:
-            {
-                mFilterTarget = cmd.getValue<uint8_t>();
-                mFilterMode = cmd.getValue<uint8_t>();
-                break;
-            }
+                mFilterTarget = reader.get<uint8_t>();
+                mFilterMode = reader.get<uint8_t>();
+                return true;
+            
+            default:
+                return false;
         }
-    }
+    });
 }
 
-void FOX5::parseData(uint8_t** dataPtr, uint8_t* dataEnd)
+void FOX5::parseData(BigEndianReader& reader)
 {
-    while (*dataPtr < dataEnd)
+    FOX5Command::parseEntry(reader, [&](FOX5Command::Command cmd)
     {
-        FOX5Command cmd = FOX5Command(dataPtr, dataEnd);
-        switch(cmd.mCommand)
+        switch(cmd)
         {
-            case FOX5Command::Command::NOP:
-                break;
-            
             case FOX5Command::Command::LIST_START:
             {
-                uint8_t level = cmd.getValue<uint8_t>();
-                if(level != 1)
-                    throw std::runtime_error("Expected object level 1 in FOX5File");
-                
-                uint32_t count = cmd.getValue<uint32_t>();
-                
-                mObjects.resize(count);
-                for(uint32_t i = 0; i < count; i++)
-                {
-                    mObjects[i] = std::make_shared<FOX5Object>(
-                        dataPtr, dataEnd
-                    );
-                }
-                break;
+                uint32_t count = readListStart(reader, 1, "Expected object level 1 in FOX5File");
+                if(mParseMode == ParseMode::LAZY)
+                    indexObjects(count, reader);
+                else
+                    parseChildren(mObjects, count, *this, reader);
+                return true;
             }
             
-            case FOX5Command::Command::LIST_END:
-                return;
-            
-            
             case FOX5Command::Command::FILE_IMAGE_LIST:
             {
-                uint32_t count = cmd.getValue<uint32_t>();
-                mImageList.resize(count);
-                uint32_t offset = 0;
+                uint32_t count = reader.get<uint32_t>();
+                reader.need(count, FOX5Schema::recordSize(FOX5Command::Command::FILE_IMAGE_LIST));
+                
+                mImages.resize(count);
+                uint64_t offset = 0;
                 for(uint32_t i = 0; i < count; i++)
                 {
-                    uint32_t compressedSize = cmd.getValue<uint32_t>();
-                    uint16_t width = cmd.getValue<uint16_t>();
-                    uint16_t height = cmd.getValue<uint16_t>();
-                    uint8_t format = cmd.getValue<uint8_t>();
-                    
-                    mImageList[i] = std::make_shared<FOX5Image>(
-                        offset,
-                        compressedSize,
-                        width, height,
-                        static_cast<FOX5Image::ImageFormat>(format)
-                    );
-                    offset += compressedSize;
+                    mImages.mOffsets[i] = static_cast<uint32_t>(offset);
+                    mImages.mCompressedSizes[i] = reader.getUnchecked<uint32_t>();
+                    mImages.mWidths[i] = reader.getUnchecked<uint16_t>();
+                    mImages.mHeights[i] = reader.getUnchecked<uint16_t>();
+                    mImages.mFormats[i] = reader.getUnchecked<FOX5Image::ImageFormat>();
+                    offset += mImages.mCompressedSizes[i];
                 }
-                break;
+                if(offset > UINT32_MAX)
+                    throw std::runtime_error("Image data exceeds 4 GiB.");
+                return true;
             }
             
             case FOX5Command::Command::FILE_GENERATOR:
+                mGenerator = reader.get<uint8_t>();
+                return true;
+            
+            default:
+                return false;
+        }
+    });
+}
+
+// Skims count objects, recording where each starts and ends. Every entry
+// at any depth ends in exactly one LIST_END, so counting the entries each
+// LIST_START opens is enough to find the end of an object.
+void FOX5::indexObjects(uint32_t count, BigEndianReader& reader)
+{
+    // Each object takes at least its LIST_END
+    if(count > reader.remaining())
+        throw std::runtime_error("Not enough data for object list.");
+    
+    mObjectIndex.resize(count);
+    mObjects.resize(count);
+    mObjectIDs.clear();
+    const uint8_t* blockStart = mCommandBlock.data();
+    
+    for(uint32_t i = 0; i < count; i++)
+    {
+        ObjectIndex_t& entry = mObjectIndex[i];
+        entry.mOffset = static_cast<uint32_t>(reader.mPointer - blockStart);
+        entry.mObjectID = 0;
+        entry.mHasID = false;
+        entry.mLoaded = false;
+        
+        uint64_t open = 1;
+        while(open > 0)
+        {
+            FOX5Command::Command cmd = reader.get<FOX5Command::Command>();
+            switch(cmd)
             {
-                mGenerator = cmd.getValue<uint8_t>();
-                break;
+                case FOX5Command::Command::LIST_START:
+                    reader.get<uint8_t>();
+                    open += reader.get<uint32_t>();
+                    break;
+                case FOX5Command::Command::LIST_END:
+                    open--;
+                    break;
+                case FOX5Command::Command::OBJECT_IDENTIFIER:
+                    entry.mObjectID = reader.get<int32_t>();
+                    entry.mHasID = true;
+                    break;
+                default:
+                    FOX5Command::skip(cmd, reader);
+                    break;
             }
         }
+        entry.mSize = static_cast<uint32_t>(reader.mPointer - blockStart) - entry.mOffset;
+        
+        if(entry.mHasID)
+            mObjectIDs.emplace_back(entry.mObjectID, i);
     }
+    
+    // Stable so the first of any duplicate IDs wins, like a linear search
+    std::stable_sort(mObjectIDs.begin(), mObjectIDs.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
 }
 
-FOX5Image FOX5::getImage(uint32_t id)
+FOX5Object& FOX5::object(uint32_t index)
+{
+    if(index >= mObjects.size())
+        throw std::out_of_range("Object index out of range.");
+    
+    if(mParseMode == ParseMode::LAZY && !mObjectIndex[index].mLoaded)
+    {
+        const ObjectIndex_t& entry = mObjectIndex[index];
+        BigEndianReader reader(mCommandBlock.data() + entry.mOffset, entry.mSize);
+        mObjects[index] = FOX5Object(*this, reader);
+        mObjectIndex[index].mLoaded = true;
+    }
+    return mObjects[index];
+}
+
+FOX5Object* FOX5::findObject(int32_t objectID)
+{
+    if(mParseMode == ParseMode::LAZY)
+    {
+        auto it = std::lower_bound(mObjectIDs.begin(), mObjectIDs.end(), objectID,
+                                   [](const auto& a, int32_t id) { return a.first < id; });
+        if(it == mObjectIDs.end() || it->first != objectID)
+            return nullptr;
+        return &object(it->second);
+    }
+    
+    for(auto& object : mObjects)
+    {
+        if(object.mObjectID == objectID)
+            return &object;
+    }
+    return nullptr;
+}
+
+size_t FOX5::loadedObjectCount() const
+{
+    if(mParseMode != ParseMode::LAZY)
+        return mObjects.size();
+    return std::count_if(mObjectIndex.begin(), mObjectIndex.end(),
+                         [](const ObjectIndex_t& entry) { return entry.mLoaded; });
+}
+
+size_t FOX5::treeMemoryUsage() const
+{
+    size_t size = mObjects.capacity() * sizeof(FOX5Object)
+        + mShapes.capacity() * sizeof(FOX5Shape)
+        + mFrames.capacity() * sizeof(FOX5Frame)
+        + mChannels.capacity() * sizeof(FOX5Channel)
+        + mKitterspeak.capacity() * sizeof(FOX5Shape::Kitterspeak_t)
+        + mImages.mOffsets.capacity() * sizeof(uint32_t)
+        + mImages.mCompressedSizes.capacity() * sizeof(uint32_t)
+        + mImages.mWidths.capacity() * sizeof(uint16_t)
+        + mImages.mHeights.capacity() * sizeof(uint16_t)
+        + mImages.mFormats.capacity() * sizeof(FOX5Image::ImageFormat)
+        + mCommandBlock.capacity()
+        + mObjectIndex.capacity() * sizeof(ObjectIndex_t)
+        + mObjectIDs.capacity() * sizeof(mObjectIDs[0]);
+    
+    // Strings short enough for SSO don't own any heap
+    auto stringSize = [](const std::string& string)
+    {
+        return string.capacity() > std::string().capacity() ? string.capacity() + 1 : 0;
+    };
+    for(auto& object : mObjects)
+    {
+        size += stringSize(object.mName) + stringSize(object.mDescription) + stringSize(object.mURI);
+        size += (object.mAuthors.capacity() + object.mKeywords.capacity()) * sizeof(std::string);
+        for(auto& author : object.mAuthors)
+            size += stringSize(author);
+        for(auto& keyword : object.mKeywords)
+            size += stringSize(keyword);
+    }
+    return size;
+}
+
+void FOX5::decodeBlock(std::vector<uint8_t>& data, [[maybe_unused]] uint32_t compressedSize, uint32_t uncompressedSize)
 {
-    if(id >= mImageList.size())
-        throw std::runtime_error("Image index out of bounds");
-    FOX5Image im = FOX5Image(*mImageList[id]);
-    im.mData.resize(im.getMemSize());
-    mFile.seekg(mImageStart + im.mOffset, std::ios::beg);
-    mFile.read(reinterpret_cast<char*>(im.mData.data()), im.mCompressedSize);
     if(mEncryptionType == EncryptionType::ENCRYPTED)
     {
 #ifdef HAS_CIPHER
-        Fox5Cipher(im.mData, im.mCompressedSize, im.mData.size(), mSeed);
+        Fox5Cipher(data, compressedSize, uncompressedSize, mSeed);
 #else
         throw std::runtime_error("Can't decrypt without fox5 cipher library");
 #endif
@@ -607,100 +656,372 @@ FOX5Image FOX5::getImage(uint32_t id)
     
     if(mCompressionType == FOX5::CompressionType::LZMA)
     {
-        im.mData = decompressLZMA(im.mData, im.mData.size());
+        data = decompressLZMA(data, uncompressedSize);
     }
     else if(mCompressionType != FOX5::CompressionType::NOT)
     {
         throw std::runtime_error("Unknown compression type");
     }
-    return im;
 }
 
-FOX5::FOX5(const std::string& filename) :
-    mFile(filename, std::ios::in | std::ios::binary)
+void FOX5::streamLZMA(size_t offset, uint32_t compressedSize, uint8_t* dest, size_t destSize)
 {
-    if (!mFile || !mFile.is_open()) throw std::runtime_error("Failed to open file.");
-    mFileName = getBasename(filename);
+    LZMAStream lzma(dest, destSize);
+    uint8_t chunk[FOX5_STREAM_CHUNK];
     
-    std::transform(mFileName.begin(), mFileName.end(), mFileName.begin(),
-                   [](unsigned char c) { return std::tolower(c); });
-    
-    mFile.seekg(0, std::ios::end);
-    if(mFile.tellg() < 20) throw std::runtime_error("Too small to be a FOX5 file.");
+    mFile.seekg(offset, std::ios::beg);
+    while(compressedSize > 0 && !lzma.finished())
+    {
+        uint32_t size = std::min<uint32_t>(compressedSize, sizeof(chunk));
+        mFile.read(reinterpret_cast<char*>(chunk), size);
+        if (!mFile) throw std::runtime_error("Failed to read LZMA data.");
+        compressedSize -= size;
+        lzma.write(chunk, size);
+    }
     
-    mFile.seekg(-20, std::ios::end);
+    if(!lzma.finished())
+        throw std::runtime_error("LZMA data ended early");
+}
+
+void FOX5::decodeImage(FOX5Image& image, const uint8_t* src)
+{
+    uint32_t memSize = image.getMemSize();
     
-    uint8_t uint8read;
-    mFile.read(reinterpret_cast<char*>(&uint8read), sizeof(uint8read));
-    if (!mFile) throw std::runtime_error("Failed to read compression type.");
-    mCompressionType = static_cast<CompressionType>(uint8read);
+    // Plain LZMA decodes straight out of src, no staging copy
+    if(mEncryptionType == EncryptionType::NOT && mCompressionType == FOX5::CompressionType::LZMA)
+    {
+        image.mData = decompressLZMA(src, image.mCompressedSize, memSize);
+        return;
+    }
     
-    mFile.read(reinterpret_cast<char*>(&uint8read), sizeof(uint8read));
-    if (!mFile) throw std::runtime_error("Failed to read encryption type.");
-    mEncryptionType = static_cast<EncryptionType>(uint8read);
+    image.mData.assign(src, src + image.mCompressedSize);
+    image.mData.resize(std::max(memSize, image.mCompressedSize));
+    decodeBlock(image.mData, image.mCompressedSize, memSize);
+}
 
+FOX5ImageInfo FOX5::imageInfo(uint32_t id) const
+{
+    if(id >= mImages.size())
+        throw std::runtime_error("Image index out of bounds");
+    return FOX5ImageInfo{
+        mImages.mOffsets[id],
+        mImages.mCompressedSizes[id],
+        mImages.mWidths[id],
+        mImages.mHeights[id],
+        mImages.mFormats[id],
+        mImages.memSize(id)
+    };
+}
+
+FOX5Image FOX5::imageHeader(uint32_t id) const
+{
+    if(id >= mImages.size())
+        throw std::runtime_error("Image index out of bounds");
+    return FOX5Image(mImages.mOffsets[id], mImages.mCompressedSizes[id],
+                     mImages.mWidths[id], mImages.mHeights[id], mImages.mFormats[id]);
+}
+
+FOX5Image FOX5::getImage(uint32_t id)
+{
+    FOX5Image im = imageHeader(id);
+    uint32_t memSize = im.getMemSize();
     
-    mFile.seekg(2, std::ios::cur); //Skip two reserved
+    if(mLoadMode == LoadMode::MAPPED)
+    {
+        // In 64 bits, a corrupt offset near 4 GiB mustn't wrap on the 3DS
+        if(uint64_t(mImageStart) + im.mOffset + im.mCompressedSize > mMapping->size())
+            throw std::runtime_error("Image data exceeds file size");
+        
+        decodeImage(im, mMapping->data() + mImageStart + im.mOffset);
+        return im;
+    }
+    else if(mEncryptionType == EncryptionType::NOT && mCompressionType == FOX5::CompressionType::LZMA)
+    {
+        // Decode in chunks straight from the file into the final buffer
+        im.mData.resize(memSize);
+        streamLZMA(mImageStart + im.mOffset, im.mCompressedSize, im.mData.data(), im.mData.size());
+        return im;
+    }
+    else
+    {
+        im.mData.resize(std::max(memSize, im.mCompressedSize));
+        mFile.seekg(mImageStart + im.mOffset, std::ios::beg);
+        mFile.read(reinterpret_cast<char*>(im.mData.data()), im.mCompressedSize);
+        if (!mFile) throw std::runtime_error("Failed to read image data.");
+    }
     
-    uint32_t dbCompressedSize = readUint32(mFile);
-    uint32_t dbUncompressedSize = readUint32(mFile);
+    decodeBlock(im.mData, im.mCompressedSize, memSize);
+    return im;
+}
+
+std::vector<FOX5Image> FOX5::getImages(std::span<const uint32_t> ids, unsigned threadCount)
+{
+    std::vector<FOX5Image> images;
+    images.reserve(ids.size());
+    for(uint32_t id : ids)
+    {
+        images.push_back(imageHeader(id));
+        
+        if(mLoadMode == LoadMode::MAPPED
+           && uint64_t(mImageStart) + images.back().mOffset + images.back().mCompressedSize > mMapping->size())
+            throw std::runtime_error("Image data exceeds file size");
+    }
     
-    char magic[8] = {0};
-    mFile.read(magic, 8);
-    if (!mFile) throw std::runtime_error("Failed to read magic from FOX5.");
+    // mFile can't be shared between threads, so stream mode reads every
+    // payload up front and only the decoding is spread out
+    std::vector<std::vector<uint8_t>> payloads;
+    if(mLoadMode == LoadMode::STREAM)
+    {
+        payloads.resize(images.size());
+        for(size_t i = 0; i < images.size(); i++)
+        {
+            payloads[i].resize(images[i].mCompressedSize);
+            mFile.seekg(mImageStart + images[i].mOffset, std::ios::beg);
+            mFile.read(reinterpret_cast<char*>(payloads[i].data()), payloads[i].size());
+            if (!mFile) throw std::runtime_error("Failed to read image data.");
+        }
+    }
     
-    if(std::string(magic, sizeof(magic)) != "FOX5.1.1")
-        throw std::runtime_error("Not a FOX5 file.");
+    auto decode = [&](size_t i)
+    {
+        if(payloads.empty())
+        {
+            decodeImage(images[i], mMapping->data() + mImageStart + images[i].mOffset);
+        }
+        else
+        {
+            decodeImage(images[i], payloads[i].data());
+            std::vector<uint8_t>().swap(payloads[i]);
+        }
+    };
     
+    if(threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    threadCount = std::min<size_t>(threadCount, images.size());
     
-    if(mEncryptionType == EncryptionType::ENCRYPTED)
+    if(threadCount <= 1)
     {
-        mFile.seekg(-36, std::ios::end);
-        mFile.read(reinterpret_cast<char*>(mSeed), sizeof(mSeed));
-        if (!mFile) throw std::runtime_error("Failed to read seed from FOX5.");
+        for(size_t i = 0; i < images.size(); i++)
+            decode(i);
+        return images;
     }
     
-    mFile.seekg(0, std::ios::beg);
+    std::atomic<size_t> next{0};
+    std::exception_ptr error;
+    std::mutex errorMutex;
     
-    std::vector<uint8_t> commandBlock(dbUncompressedSize);
-    mFile.read(reinterpret_cast<char*>(commandBlock.data()), dbCompressedSize);
+    auto worker = [&]()
+    {
+        try
+        {
+            for(size_t i = next++; i < images.size(); i = next++)
+                decode(i);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if(!error)
+                error = std::current_exception();
+            next = images.size(); // Stop handing out work
+        }
+    };
     
-    if(mEncryptionType == EncryptionType::ENCRYPTED)
+    // The calling thread works too instead of just waiting. If a thread
+    // can't be started the ones that did, and this one, do all the work;
+    // every started thread has to be joined either way.
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for(unsigned i = 1; i < threadCount; i++)
     {
-#ifdef HAS_CIPHER
-        Fox5Cipher(commandBlock, dbCompressedSize, dbUncompressedSize, mSeed);
-#else
-        throw std::runtime_error("Can't decrypt without fox5 cipher library");
-#endif
+        try
+        {
+            threads.emplace_back(worker);
+        }
+        catch(const std::system_error&)
+        {
+            break;
+        }
     }
+    worker();
+    for(auto& thread : threads)
+        thread.join();
     
-    if(mCompressionType == FOX5::CompressionType::LZMA)
+    if(error)
+        std::rethrow_exception(error);
+    return images;
+}
+
+void FOX5::readFooter(uint8_t* footer, uint32_t& dbCompressedSize, uint32_t& dbUncompressedSize)
+{
+    BigEndianReader reader(footer, FOX5_FOOTER_SIZE);
+    
+    mCompressionType = reader.get<CompressionType>();
+    mEncryptionType = reader.get<EncryptionType>();
+    reader.skip(2); //Skip two reserved
+    
+    dbCompressedSize = reader.get<uint32_t>();
+    dbUncompressedSize = reader.get<uint32_t>();
+    
+    if(reader.getString(8) != "FOX5.1.1")
+        throw std::runtime_error("Not a FOX5 file.");
+}
+
+void FOX5::setCacheDirectory(const std::string& dir)
+{
+    g_CacheDirectory = dir;
+}
+
+const std::string& FOX5::cacheDirectory()
+{
+    return g_CacheDirectory;
+}
+
+FOX5::FOX5(const std::string& filename, LoadMode mode, ParseMode parseMode) :
+    mLoadMode(mode),
+    mParseMode(parseMode)
+{
+    mFileName = getBasename(filename);
+    
+    std::transform(mFileName.begin(), mFileName.end(), mFileName.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    
+    uint8_t footer[FOX5_FOOTER_SIZE];
+    uint32_t dbCompressedSize;
+    uint32_t dbUncompressedSize;
+    
+    // The command block as stored in the file, when it is in memory anyway
+    const uint8_t* rawBlock = nullptr;
+    std::vector<uint8_t> rawBuffer;
+    
+    FOX5Cache::Key cacheKey;
+    std::string cachePath;
+    if(!g_CacheDirectory.empty() && FOX5Cache::statFile(filename, cacheKey))
+        cachePath = FOX5Cache::entryPath(g_CacheDirectory, filename);
+    
+    if(mLoadMode == LoadMode::MAPPED)
     {
-        commandBlock = decompressLZMA(commandBlock, dbUncompressedSize);
+        mMapping = std::make_shared<MappedFile>(filename);
+        const uint8_t* data = mMapping->data();
+        size_t size = mMapping->size();
+        
+        if(size < FOX5_FOOTER_SIZE) throw std::runtime_error("Too small to be a FOX5 file.");
+        std::memcpy(footer, data + size - FOX5_FOOTER_SIZE, FOX5_FOOTER_SIZE);
+        readFooter(footer, dbCompressedSize, dbUncompressedSize);
+        
+        if(mEncryptionType == EncryptionType::ENCRYPTED)
+        {
+            if(size < FOX5_FOOTER_SIZE + sizeof(mSeed))
+                throw std::runtime_error("Failed to read seed from FOX5.");
+            std::memcpy(mSeed, data + size - FOX5_FOOTER_SIZE - sizeof(mSeed), sizeof(mSeed));
+        }
+        
+        if(dbCompressedSize > size - FOX5_FOOTER_SIZE)
+            throw std::runtime_error("Command block exceeds file size.");
+        rawBlock = data;
     }
-    else if(mCompressionType != FOX5::CompressionType::NOT)
+    else
     {
-        throw std::runtime_error("Unknown compression type");
+        mFile.open(filename, std::ios::in | std::ios::binary);
+        if (!mFile || !mFile.is_open()) throw std::runtime_error("Failed to open file.");
+        
+        mFile.seekg(0, std::ios::end);
+        if(mFile.tellg() < FOX5_FOOTER_SIZE) throw std::runtime_error("Too small to be a FOX5 file.");
+        
+        mFile.seekg(-FOX5_FOOTER_SIZE, std::ios::end);
+        mFile.read(reinterpret_cast<char*>(footer), sizeof(footer));
+        if (!mFile) throw std::runtime_error("Failed to read FOX5 footer.");
+        readFooter(footer, dbCompressedSize, dbUncompressedSize);
+        
+        if(mEncryptionType == EncryptionType::ENCRYPTED)
+        {
+            mFile.seekg(-(FOX5_FOOTER_SIZE + static_cast<int>(sizeof(mSeed))), std::ios::end);
+            mFile.read(reinterpret_cast<char*>(mSeed), sizeof(mSeed));
+            if (!mFile) throw std::runtime_error("Failed to read seed from FOX5.");
+        }
+        
+        // Hashing needs the raw block, decoding can then work from memory
+        if(!cachePath.empty())
+        {
+            mFile.seekg(0, std::ios::beg);
+            rawBuffer.resize(dbCompressedSize);
+            mFile.read(reinterpret_cast<char*>(rawBuffer.data()), dbCompressedSize);
+            if (!mFile) throw std::runtime_error("Failed to read command block.");
+            rawBlock = rawBuffer.data();
+        }
     }
     
     mImageStart = dbCompressedSize;
     
-    uint8_t* pointer = commandBlock.data();
-    uint8_t* dataEnd = pointer + commandBlock.size();
-    pointer += 4;
+    if(!cachePath.empty())
+    {
+        uint64_t hash = hashBytes(footer, sizeof(footer));
+        hash = hashBytes(mSeed, sizeof(mSeed), hash);
+        cacheKey.mContentHash = hashBytes(rawBlock, dbCompressedSize, hash);
+        
+        if(FOX5Cache::load(*this, cachePath, cacheKey))
+        {
+            // Everything is parsed already, there is nothing left to be lazy about
+            mFromCache = true;
+            mParseMode = ParseMode::EAGER;
+            return;
+        }
+    }
     
-    FOX5Command cmd = FOX5Command(&pointer, dataEnd);
-    if(cmd.mCommand != FOX5Command::Command::LIST_START)
-        throw std::runtime_error("Expected list start as first entry");
+    if(rawBlock)
+    {
+        if(mEncryptionType == EncryptionType::NOT && mCompressionType == FOX5::CompressionType::LZMA)
+        {
+            mCommandBlock = decompressLZMA(rawBlock, dbCompressedSize, dbUncompressedSize);
+        }
+        else
+        {
+            mCommandBlock.assign(rawBlock, rawBlock + dbCompressedSize);
+            mCommandBlock.resize(std::max(dbCompressedSize, dbUncompressedSize));
+            decodeBlock(mCommandBlock, dbCompressedSize, dbUncompressedSize);
+        }
+        std::vector<uint8_t>().swap(rawBuffer);
+    }
+    else if(mEncryptionType == EncryptionType::NOT && mCompressionType == FOX5::CompressionType::LZMA)
+    {
+        mCommandBlock.resize(dbUncompressedSize);
+        streamLZMA(0, dbCompressedSize, mCommandBlock.data(), mCommandBlock.size());
+    }
+    else
+    {
+        mFile.seekg(0, std::ios::beg);
+        
+        mCommandBlock.resize(std::max(dbCompressedSize, dbUncompressedSize));
+        mFile.read(reinterpret_cast<char*>(mCommandBlock.data()), dbCompressedSize);
+        if (!mFile) throw std::runtime_error("Failed to read command block.");
+        
+        decodeBlock(mCommandBlock, dbCompressedSize, dbUncompressedSize);
+    }
+    
+    BigEndianReader reader(mCommandBlock.data(), mCommandBlock.size());
+    reader.skip(4);
     
-    if(cmd.getValue<uint8_t>() != 0)
-        throw std::runtime_error("Expected file level 0 at start");
+    if(reader.get<FOX5Command::Command>() != FOX5Command::Command::LIST_START)
+        throw std::runtime_error("Expected list start as first entry");
     
-    if(cmd.getValue<uint32_t>() != 1)
+    if(readListStart(reader, 0, "Expected file level 0 at start") != 1)
         throw std::runtime_error("File level list should always have 1 entry");
     
-    parseData(&pointer, dataEnd);
-    printf("Fox5 loaded\n");
+    parseData(reader);
+    
+    // Lazy objects are parsed straight out of the block later on
+    if(mParseMode != ParseMode::LAZY)
+        std::vector<uint8_t>().swap(mCommandBlock);
+    
+    // Growth slack isn't needed once the tree is complete
+    mObjects.shrink_to_fit();
+    mShapes.shrink_to_fit();
+    mFrames.shrink_to_fit();
+    mChannels.shrink_to_fit();
+    mKitterspeak.shrink_to_fit();
+    
+    // Only a complete tree is worth caching
+    if(!cachePath.empty() && mParseMode == ParseMode::EAGER)
+        FOX5Cache::store(*this, cachePath, cacheKey);
 }
 
 FOX5::~FOX5()
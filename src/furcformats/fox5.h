@@ -8,7 +8,10 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <span>
 #include <unordered_map>
+#include "bytereader.h"
+#include "filecommon.h"
 
 
 class FOX5Command
@@ -128,10 +131,37 @@ public:
         throw std::bad_variant_access();  // Safely handle wrong type access
     }
     
-    void parseData(uint8_t** dataPtr, uint8_t* dataEnd);
-    FOX5Command(uint8_t** dataPtr, uint8_t* dataEnd)
+    void parseData(BigEndianReader& reader);
+    FOX5Command(BigEndianReader& reader)
     {
-        parseData(dataPtr, dataEnd);
+        parseData(reader);
+    };
+    
+    // Steps over the payload of cmd (opcode already consumed)
+    static void skip(Command cmd, BigEndianReader& reader);
+    // Checks a whole decoded command block without building anything:
+    // known opcodes, payloads in bounds, lists nested by level and every
+    // command at the depth it belongs to. Throws on the first problem.
+    static void validate(std::span<const uint8_t> block);
+    
+    // SAX style decoding of one list entry, up to and including its
+    // LIST_END. handler(cmd) is called with the opcode consumed and reads
+    // the fields it wants straight off reader, returning false for
+    // commands it doesn't care about so they're skipped. Nothing is
+    // buffered in between, unlike the FOX5Value path above.
+    template <typename Handler>
+    static void parseEntry(BigEndianReader& reader, Handler&& handler)
+    {
+        while (!reader.empty())
+        {
+            Command cmd = reader.get<Command>();
+            if(cmd == Command::LIST_END)
+                return;
+            if(cmd == Command::NOP)
+                continue;
+            if(!handler(cmd))
+                skip(cmd, reader);
+        }
     };
 };
 
@@ -164,6 +194,48 @@ public:
     {}
 };
 
+// Image metadata as parallel arrays. Offsets are worked out once while
+// parsing, so any payload is a single seek away.
+class FOX5ImageDirectory
+{
+public:
+    std::vector<uint32_t> mOffsets; // From FOX5::mImageStart
+    std::vector<uint32_t> mCompressedSizes;
+    std::vector<uint16_t> mWidths;
+    std::vector<uint16_t> mHeights;
+    std::vector<FOX5Image::ImageFormat> mFormats;
+    
+    size_t size() const { return mOffsets.size(); };
+    
+    void resize(size_t count)
+    {
+        mOffsets.resize(count);
+        mCompressedSizes.resize(count);
+        mWidths.resize(count);
+        mHeights.resize(count);
+        mFormats.resize(count);
+    };
+    
+    // Decoded size in bytes
+    uint32_t memSize(uint32_t id) const
+    {
+        uint32_t s = uint32_t(mWidths[id]) * mHeights[id];
+        if(mFormats[id] == FOX5Image::ImageFormat::E_32BIT)
+            s *= 4;
+        return s;
+    };
+};
+
+struct FOX5ImageInfo
+{
+    uint32_t mOffset;
+    uint32_t mCompressedSize;
+    uint16_t mWidth;
+    uint16_t mHeight;
+    FOX5Image::ImageFormat mImageFormat;
+    uint32_t mMemSize;
+};
+
 class FOX5List
 {
 public:
@@ -171,6 +243,16 @@ public:
     FOX5List(const std::vector<uint8_t> data){};
 };
 
+class FOX5;
+
+// The parsed tree lives in one contiguous array per level, owned by FOX5.
+// A parent refers to its children by a range into the next level's array.
+struct FOX5Range
+{
+    uint32_t mStart = 0;
+    uint32_t mCount = 0;
+};
+
 
 class FOX5Channel : FOX5List
 {
@@ -190,10 +272,11 @@ public:
     uint16_t mImageID; //Number in FOX5File ImageList
     int16_t mOffset[2] = {0};
     
-    void parseData(uint8_t** dataPtr, uint8_t* dataEnd);
-    FOX5Channel(uint8_t** dataPtr, uint8_t* dataEnd)
+    void parseData(BigEndianReader& reader);
+    FOX5Channel() = default;
+    FOX5Channel(BigEndianReader& reader)
     {
-        parseData(dataPtr, dataEnd);
+        parseData(reader);
     };
 };
 
@@ -203,12 +286,13 @@ public:
     int16_t mFrameOffset[2] = {0};
     int16_t mFurreOffset[2] = {0};
     
-    std::vector<std::shared_ptr<FOX5Channel>> mSprites;
+    FOX5Range mSprites; // Into FOX5::mChannels
     
-    void parseData(uint8_t** dataPtr, uint8_t* dataEnd);
-    FOX5Frame(uint8_t** dataPtr, uint8_t* dataEnd)
+    void parseData(FOX5& fox, BigEndianReader& reader);
+    FOX5Frame() = default;
+    FOX5Frame(FOX5& fox, BigEndianReader& reader)
     {
-        parseData(dataPtr, dataEnd);
+        parseData(fox, reader);
     };
 };
 
@@ -283,25 +367,26 @@ public:
         uint16_t mCommand;
         int16_t mArg1;
         int16_t mArg2;
+        Kitterspeak_t() = default;
         Kitterspeak_t(uint16_t command, int16_t arg1, int16_t arg2)
             : mCommand(command), mArg1(arg1), mArg2(arg2) {}
     };
     
-    std::vector<std::shared_ptr<Kitterspeak_t>> mKitterspeak;
-    
-    std::vector<std::shared_ptr<FOX5Frame>> mFrames;
+    FOX5Range mKitterspeak; // Into FOX5::mKitterspeak
+    FOX5Range mFrames; // Into FOX5::mFrames
     
-    void parseData(uint8_t** dataPtr, uint8_t* dataEnd);
-    FOX5Shape(uint8_t** dataPtr, uint8_t* dataEnd)
+    void parseData(FOX5& fox, BigEndianReader& reader);
+    FOX5Shape() = default;
+    FOX5Shape(FOX5& fox, BigEndianReader& reader)
     {
-        parseData(dataPtr, dataEnd);
+        parseData(fox, reader);
     };
 };
 
 class FOX5Object : FOX5List
 {
 public:
-    uint32_t mAuthorRevision;
+    uint32_t mAuthorRevision = 0;
     std::vector<std::string> mAuthors;
     enum class License : uint8_t
     {
@@ -312,14 +397,14 @@ public:
         PRIVATE = 4,
         CONDITIONAL = 5
     };
-    License mLicense;
+    License mLicense = License::STANDARD;
     std::vector<std::string> mKeywords;
     std::string mName;
     std::string mDescription;
     
     union
     {
-        uint8_t mFlags;
+        uint8_t mFlags = 0;
         struct
         {
             bool mWalkable : 1;
@@ -335,7 +420,7 @@ public:
     std::string mURI;
     union
     {
-        uint32_t mMoreFlags;
+        uint32_t mMoreFlags = 0;
         struct
         {
             bool mDreamPadAll : 1;
@@ -353,24 +438,67 @@ public:
             bool mChild : 1;
         };
     };
-    int32_t mObjectID;
-    uint8_t mEditType;
-    uint8_t mFilterTarget;
-    uint8_t mFilterMode;
+    int32_t mObjectID = 0;
+    uint8_t mEditType = 0;
+    uint8_t mFilterTarget = 0;
+    uint8_t mFilterMode = 0;
     
-    std::vector<std::shared_ptr<FOX5Shape>> mShapes;
+    FOX5Range mShapes; // Into FOX5::mShapes
     
-    void parseData(uint8_t** dataPtr, uint8_t* dataEnd);
-    FOX5Object(uint8_t** dataPtr, uint8_t* dataEnd)
+    void parseData(FOX5& fox, BigEndianReader& reader);
+    FOX5Object() = default; // Placeholder until a lazy FOX5 materializes it
+    FOX5Object(FOX5& fox, BigEndianReader& reader)
     {
-        parseData(dataPtr, dataEnd);
+        parseData(fox, reader);
     };
 };
 
 class FOX5 : FOX5List
 {
+public:
+    enum class LoadMode : uint8_t
+    {
+        STREAM = 0, // Seek and read through mFile
+        MAPPED = 1  // Map (or buffer) the whole file and decode in place
+    };
+    
+    enum class ParseMode : uint8_t
+    {
+        EAGER = 0,  // Parse the whole tree in the constructor
+        LAZY = 1,   // Only index objects, parse each one on first access
+        OBJECTS = 2 // Object attributes only, shapes and below are skipped
+    };
+    
+    // Where a level-1 object lives in the decoded command block
+    struct ObjectIndex_t
+    {
+        uint32_t mOffset = 0;
+        uint32_t mSize = 0;
+        int32_t mObjectID = 0;
+        bool mHasID = false;
+        bool mLoaded = false;
+    };
+    
 protected:
+    LoadMode mLoadMode;
+    ParseMode mParseMode;
     std::ifstream mFile;
+    std::shared_ptr<MappedFile> mMapping;
+    
+    void readFooter(uint8_t* footer, uint32_t& dbCompressedSize, uint32_t& dbUncompressedSize);
+    void decodeBlock(std::vector<uint8_t>& data, uint32_t compressedSize, uint32_t uncompressedSize);
+    void streamLZMA(size_t offset, uint32_t compressedSize, uint8_t* dest, size_t destSize);
+    void decodeImage(FOX5Image& image, const uint8_t* src);
+    FOX5Image imageHeader(uint32_t id) const;
+    
+    bool mFromCache = false;
+    
+    // Only kept around in lazy mode
+    std::vector<uint8_t> mCommandBlock;
+    std::vector<ObjectIndex_t> mObjectIndex;
+    std::vector<std::pair<int32_t, uint32_t>> mObjectIDs; // Sorted by ID
+    
+    void indexObjects(uint32_t count, BigEndianReader& reader);
 
 public: // Footer
     std::string mFileName;
@@ -396,16 +524,65 @@ public: // FOX5List
     
     uint8_t mGenerator;
     size_t mImageStart;
-    std::vector<std::shared_ptr<FOX5Image>> mImageList;
-    std::vector<std::shared_ptr<FOX5Object>> mObjects;
+    FOX5ImageDirectory mImages;
+    
+    size_t imageCount() const { return mImages.size(); };
+    // Metadata only, nothing is read or decoded
+    FOX5ImageInfo imageInfo(uint32_t id) const;
+    
+public: // Tree, one array per level
+    std::vector<FOX5Object> mObjects;
+    std::vector<FOX5Shape> mShapes;
+    std::vector<FOX5Frame> mFrames;
+    std::vector<FOX5Channel> mChannels;
+    std::vector<FOX5Shape::Kitterspeak_t> mKitterspeak;
+    
+    std::span<FOX5Shape> shapes(const FOX5Object& object)
+    {
+        return std::span<FOX5Shape>(mShapes).subspan(object.mShapes.mStart, object.mShapes.mCount);
+    };
+    std::span<FOX5Frame> frames(const FOX5Shape& shape)
+    {
+        return std::span<FOX5Frame>(mFrames).subspan(shape.mFrames.mStart, shape.mFrames.mCount);
+    };
+    std::span<FOX5Channel> channels(const FOX5Frame& frame)
+    {
+        return std::span<FOX5Channel>(mChannels).subspan(frame.mSprites.mStart, frame.mSprites.mCount);
+    };
+    std::span<FOX5Shape::Kitterspeak_t> kitterspeak(const FOX5Shape& shape)
+    {
+        return std::span<FOX5Shape::Kitterspeak_t>(mKitterspeak).subspan(shape.mKitterspeak.mStart, shape.mKitterspeak.mCount);
+    };
+    
+    // In lazy mode mObjects holds placeholders until they are accessed
+    // through these. Materializing an object appends to the child pools,
+    // which invalidates spans taken from them earlier.
+    size_t objectCount() const { return mObjects.size(); };
+    FOX5Object& object(uint32_t index);
+    FOX5Object* findObject(int32_t objectID); // nullptr if there is none
+    size_t loadedObjectCount() const;
+    ParseMode parseMode() const { return mParseMode; };
+    
+    // Parsed trees are cached in dir (empty = off, the default) and reused
+    // while the file's size, mtime and command block hash still match.
+    // Set it before constructing any FOX5.
+    static void setCacheDirectory(const std::string& dir);
+    static const std::string& cacheDirectory();
+    bool loadedFromCache() const { return mFromCache; };
+    
+    // Approximate heap held by the parsed tree, in bytes
+    size_t treeMemoryUsage() const;
     
 public:
     FOX5Image getImage(uint32_t id);
+    // Decodes several images at once, spread over threadCount threads
+    // (0 = one per core). Results come back in the order of ids.
+    std::vector<FOX5Image> getImages(std::span<const uint32_t> ids, unsigned threadCount = 0);
 public:
-    FOX5(const std::string& filename);
+    FOX5(const std::string& filename, LoadMode mode = LoadMode::STREAM, ParseMode parseMode = ParseMode::EAGER);
     ~FOX5();
     
-    void parseData(uint8_t** dataPtr, uint8_t* dataEnd);
+    void parseData(BigEndianReader& reader);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <type_traits>
+#include "filecommon.h"
+#include "fox5.h"
+#include "fox5cache.h"
+
+static_assert(std::is_trivially_copyable_v<FOX5Shape>, "FOX5Shape is cached as raw bytes");
+static_assert(std::is_trivially_copyable_v<FOX5Frame>, "FOX5Frame is cached as raw bytes");
+static_assert(std::is_trivially_copyable_v<FOX5Channel>, "FOX5Channel is cached as raw bytes");
+static_assert(std::is_trivially_copyable_v<FOX5Shape::Kitterspeak_t>, "Kitterspeak_t is cached as raw bytes");
+
+namespace
+{
+    const char CACHE_MAGIC[4] = {'F', '5', 'T', 'C'};
+    // Native byte order and struct layout are cached as is, so an entry
+    // written by a different build must not be trusted
+    const uint32_t CACHE_LAYOUT = (sizeof(FOX5Shape) << 24) | (sizeof(FOX5Frame) << 16)
+                                | (sizeof(FOX5Channel) << 8) | sizeof(FOX5Shape::Kitterspeak_t);
+
+    struct CacheHeader
+    {
+        char mMagic[4];
+        uint32_t mVersion;
+        uint32_t mByteOrder;
+        uint32_t mLayout;
+        uint64_t mFileSize;
+        int64_t mModified;
+        uint64_t mContentHash;
+        uint64_t mPayloadSize;
+        uint64_t mPayloadHash;
+    };
+
+    class CacheWriter
+    {
+    public:
+        std::vector<uint8_t> mData;
+
+        template <typename T>
+        void put(const T& value)
+        {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+            mData.insert(mData.end(), bytes, bytes + sizeof(T));
+        };
+
+        template <typename T>
+        void putArray(const std::vector<T>& values)
+        {
+            put(static_cast<uint64_t>(values.size()));
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(values.data());
+            mData.insert(mData.end(), bytes, bytes + values.size() * sizeof(T));
+        };
+
+        void putString(const std::string& value)
+        {
+            put(static_cast<uint32_t>(value.size()));
+            mData.insert(mData.end(), value.begin(), value.end());
+        };
+
+        void putStrings(const std::vector<std::string>& values)
+        {
+            put(static_cast<uint32_t>(values.size()));
+            for(auto& value : values)
+                putString(value);
+        };
+    };
+
+    class CacheReader
+    {
+    public:
+        const uint8_t* mPointer;
+        const uint8_t* mEnd;
+
+        CacheReader(const uint8_t* data, size_t size) : mPointer(data), mEnd(data + size) {};
+
+        void need(uint64_t size)
+        {
+            if(size > static_cast<uint64_t>(mEnd - mPointer))
+                throw std::runtime_error("Truncated FOX5 cache entry.");
+        };
+
+        template <typename T>
+        T get()
+        {
+            need(sizeof(T));
+            T value;
+            std::memcpy(&value, mPointer, sizeof(T));
+            mPointer += sizeof(T);
+            return value;
+        };
+
+        template <typename T>
+        void getArray(std::vector<T>& values)
+        {
+            uint64_t count = get<uint64_t>();
+            if(count > static_cast<uint64_t>(mEnd - mPointer) / sizeof(T))
+                throw std::runtime_error("Truncated FOX5 cache entry.");
+            values.resize(count);
+            std::memcpy(values.data(), mPointer, count * sizeof(T));
+            mPointer += count * sizeof(T);
+        };
+
+        std::string getString()
+        {
+            uint32_t size = get<uint32_t>();
+            need(size);
+            std::string value(reinterpret_cast<const char*>(mPointer), size);
+            mPointer += size;
+            return value;
+        };
+
+        void getStrings(std::vector<std::string>& values)
+        {
+            uint32_t count = get<uint32_t>();
+            need(count * uint64_t(4));
+            values.reserve(count);
+            for(uint32_t i = 0; i < count; i++)
+                values.push_back(getString());
+        };
+    };
+
+    bool inRange(const FOX5Range& range, size_t poolSize)
+    {
+        return range.mStart <= poolSize && range.mCount <= poolSize - range.mStart;
+    }
+}
+
+bool FOX5Cache::statFile(const std::string& filename, Key& key)
+{
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(filename, error);
+    if(error)
+        return false;
+    auto modified = std::filesystem::last_write_time(filename, error);
+    if(error)
+        return false;
+
+    key.mFileSize = size;
+    key.mModified = static_cast<int64_t>(modified.time_since_epoch().count());
+    return true;
+}
+
+std::string FOX5Cache::entryPath(const std::string& cacheDir, const std::string& filename)
+{
+    // Same named patches from different folders must not share an entry
+    std::error_code error;
+    std::string absolute = std::filesystem::absolute(filename, error).string();
+    if(error)
+        absolute = filename;
+    uint64_t pathHash = hashBytes(reinterpret_cast<const uint8_t*>(absolute.data()), absolute.size());
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%016llx.f5c", static_cast<unsigned long long>(pathHash));
+    return (std::filesystem::path(cacheDir) / (getBasename(filename) + suffix)).string();
+}
+
+bool FOX5Cache::load(FOX5& fox, const std::string& path, const Key& key)
+{
+    try
+    {
+        std::error_code error;
+        if(!std::filesystem::exists(path, error))
+            return false;
+
+        MappedFile file(path);
+        if(file.size() < sizeof(CacheHeader))
+            return false;
+
+        CacheHeader header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if(std::memcmp(header.mMagic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+           || header.mVersion != VERSION
+           || header.mByteOrder != 0x01020304
+           || header.mLayout != CACHE_LAYOUT)
+            return false;
+
+        if(header.mFileSize != key.mFileSize
+           || header.mModified != key.mModified
+           || header.mContentHash != key.mContentHash)
+            return false;
+
+        const uint8_t* payload = file.data() + sizeof(header);
+        if(header.mPayloadSize != file.size() - sizeof(header)
+           || hashBytes(payload, header.mPayloadSize) != header.mPayloadHash)
+            return false;
+
+        CacheReader reader(payload, header.mPayloadSize);
+
+        auto compression = reader.get<FOX5::CompressionType>();
+        auto encryption = reader.get<FOX5::EncryptionType>();
+        uint8_t seed[sizeof(fox.mSeed)];
+        for(auto& byte : seed)
+            byte = reader.get<uint8_t>();
+        auto generator = reader.get<uint8_t>();
+        auto imageStart = reader.get<uint64_t>();
+
+        FOX5ImageDirectory images;
+        reader.getArray(images.mOffsets);
+        reader.getArray(images.mCompressedSizes);
+        reader.getArray(images.mWidths);
+        reader.getArray(images.mHeights);
+        reader.getArray(images.mFormats);
+        if(images.mCompressedSizes.size() != images.size() || images.mWidths.size() != images.size()
+           || images.mHeights.size() != images.size() || images.mFormats.size() != images.size())
+            return false;
+
+        std::vector<FOX5Shape> shapes;
+        std::vector<FOX5Frame> frames;
+        std::vector<FOX5Channel> channels;
+        std::vector<FOX5Shape::Kitterspeak_t> kitterspeak;
+        reader.getArray(shapes);
+        reader.getArray(frames);
+        reader.getArray(channels);
+        reader.getArray(kitterspeak);
+
+        uint32_t objectCount = reader.get<uint32_t>();
+        reader.need(objectCount * uint64_t(32));
+        std::vector<FOX5Object> objects(objectCount);
+        for(auto& object : objects)
+        {
+            object.mAuthorRevision = reader.get<uint32_t>();
+            reader.getStrings(object.mAuthors);
+            object.mLicense = reader.get<FOX5Object::License>();
+            reader.getStrings(object.mKeywords);
+            object.mName = reader.getString();
+            object.mDescription = reader.getString();
+            object.mFlags = reader.get<uint8_t>();
+            object.mURI = reader.getString();
+            object.mMoreFlags = reader.get<uint32_t>();
+            object.mObjectID = reader.get<int32_t>();
+            object.mEditType = reader.get<uint8_t>();
+            object.mFilterTarget = reader.get<uint8_t>();
+            object.mFilterMode = reader.get<uint8_t>();
+            object.mShapes = reader.get<FOX5Range>();
+            if(!inRange(object.mShapes, shapes.size()))
+                return false;
+        }
+        if(reader.mPointer != reader.mEnd)
+            return false;
+
+        for(auto& shape : shapes)
+        {
+            if(!inRange(shape.mFrames, frames.size()) || !inRange(shape.mKitterspeak, kitterspeak.size()))
+                return false;
+        }
+        for(auto& frame : frames)
+        {
+            if(!inRange(frame.mSprites, channels.size()))
+                return false;
+        }
+
+        fox.mCompressionType = compression;
+        fox.mEncryptionType = encryption;
+        std::memcpy(fox.mSeed, seed, sizeof(seed));
+        fox.mGenerator = generator;
+        fox.mImageStart = imageStart;
+        fox.mImages = std::move(images);
+        fox.mObjects = std::move(objects);
+        fox.mShapes = std::move(shapes);
+        fox.mFrames = std::move(frames);
+        fox.mChannels = std::move(channels);
+        fox.mKitterspeak = std::move(kitterspeak);
+        return true;
+    }
+    catch(const std::exception&)
+    {
+        return false;
+    }
+}
+
+bool FOX5Cache::store(const FOX5& fox, const std::string& path, const Key& key)
+{
+    CacheWriter writer;
+    writer.put(fox.mCompressionType);
+    writer.put(fox.mEncryptionType);
+    for(auto byte : fox.mSeed)
+        writer.put(byte);
+    writer.put(fox.mGenerator);
+    writer.put(static_cast<uint64_t>(fox.mImageStart));
+
+    writer.putArray(fox.mImages.mOffsets);
+    writer.putArray(fox.mImages.mCompressedSizes);
+    writer.putArray(fox.mImages.mWidths);
+    writer.putArray(fox.mImages.mHeights);
+    writer.putArray(fox.mImages.mFormats);
+
+    writer.putArray(fox.mShapes);
+    writer.putArray(fox.mFrames);
+    writer.putArray(fox.mChannels);
+    writer.putArray(fox.mKitterspeak);
+
+    writer.put(static_cast<uint32_t>(fox.mObjects.size()));
+    for(auto& object : fox.mObjects)
+    {
+        writer.put(object.mAuthorRevision);
+        writer.putStrings(object.mAuthors);
+        writer.put(object.mLicense);
+        writer.putStrings(object.mKeywords);
+        writer.putString(object.mName);
+        writer.putString(object.mDescription);
+        writer.put(object.mFlags);
+        writer.putString(object.mURI);
+        writer.put(object.mMoreFlags);
+        writer.put(object.mObjectID);
+        writer.put(object.mEditType);
+        writer.put(object.mFilterTarget);
+        writer.put(object.mFilterMode);
+        writer.put(object.mShapes);
+    }
+
+    CacheHeader header;
+    std::memcpy(header.mMagic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.mVersion = VERSION;
+    header.mByteOrder = 0x01020304;
+    header.mLayout = CACHE_LAYOUT;
+    header.mFileSize = key.mFileSize;
+    header.mModified = key.mModified;
+    header.mContentHash = key.mContentHash;
+    header.mPayloadSize = writer.mData.size();
+    header.mPayloadHash = hashBytes(writer.mData.data(), writer.mData.size());
+
+    // Written next to the entry and renamed over it, so a reader never
+    // sees half an entry
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    std::string tempPath = uniqueTempPath(path);
+    {
+        std::ofstream file(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!file || !file.is_open())
+            return false;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(writer.mData.data()), writer.mData.size());
+        if(!file)
+        {
+            file.close();
+            std::filesystem::remove(tempPath, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(tempPath, path, error);
+    if(error)
+    {
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef FOX5CACHE_H
+#define FOX5CACHE_H
+#include <cstdint>
+#include <string>
+
+class FOX5;
+
+// On-disk copy of a parsed FOX5 tree, see FOX5::setCacheDirectory. Entries
+// are a fixed header followed by the tree, with the fixed size pools stored
+// as raw arrays so loading is one read plus a few memcpys.
+class FOX5Cache
+{
+public:
+    static const uint32_t VERSION = 2;
+
+    struct Key
+    {
+        uint64_t mFileSize = 0;
+        int64_t mModified = 0;
+        uint64_t mContentHash = 0; // Footer, seed and raw command block
+    };
+
+    // Fills in size and mtime, false if the file can't be stat'd
+    static bool statFile(const std::string& filename, Key& key);
+    // Where the entry for filename lives inside cacheDir
+    static std::string entryPath(const std::string& cacheDir, const std::string& filename);
+
+    // Both return false instead of throwing. A failed load means the entry
+    // is missing, stale or corrupt and fox is left untouched.
+    static bool load(FOX5& fox, const std::string& path, const Key& key);
+    static bool store(const FOX5& fox, const std::string& path, const Key& key);
+};
+
+#endif
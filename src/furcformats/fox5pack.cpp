@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include "fox5pack.h"
+
+static_assert(std::is_trivially_copyable_v<FOX5Pack::Image>, "FOX5Pack::Image is read in place");
+static_assert(std::is_trivially_copyable_v<FOX5Pack::Object>, "FOX5Pack::Object is read in place");
+static_assert(std::is_trivially_copyable_v<FOX5Shape>, "FOX5Shape is read in place");
+static_assert(std::is_trivially_copyable_v<FOX5Frame>, "FOX5Frame is read in place");
+static_assert(std::is_trivially_copyable_v<FOX5Channel>, "FOX5Channel is read in place");
+
+namespace
+{
+    const char PACK_MAGIC[4] = {'F', '5', 'P', 'K'};
+    // Like the tree cache, a pack is only good for builds that agree on
+    // struct layout
+    const uint64_t PACK_LAYOUT = (uint64_t(sizeof(FOX5Pack::Image)) << 40) | (uint64_t(sizeof(FOX5Pack::Object)) << 32)
+                               | (sizeof(FOX5Shape) << 24) | (sizeof(FOX5Frame) << 16)
+                               | (sizeof(FOX5Channel) << 8) | sizeof(FOX5Shape::Kitterspeak_t);
+
+    const size_t SECTION_ALIGNMENT = 8;
+    // What C3D_TexInit hands out, so a mapped image could be DMA'd as is
+    const size_t TEXEL_ALIGNMENT = 0x80;
+    // Images decoded per getImages call while writing
+    const size_t IMAGE_BATCH = 256;
+
+    enum Section
+    {
+        IMAGES,
+        OBJECTS,
+        OBJECT_IDS,
+        SHAPES,
+        FRAMES,
+        CHANNELS,
+        KITTERSPEAK,
+        STRING_REFS,
+        STRINGS,
+        SECTION_COUNT
+    };
+
+    struct SectionEntry
+    {
+        uint64_t mOffset; // From the start of the file
+        uint64_t mSize;
+    };
+
+    struct PackHeader
+    {
+        char mMagic[4];
+        uint32_t mVersion;
+        uint32_t mByteOrder;
+        uint8_t mGenerator;
+        uint8_t mReserved[3];
+        uint64_t mLayout;
+        uint64_t mMetadataSize; // Header and sections, texels start after
+        uint64_t mMetadataHash; // Of the sections
+        SectionEntry mSections[SECTION_COUNT];
+    };
+
+    size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    bool inRange(const FOX5Range& range, size_t poolSize)
+    {
+        return range.mStart <= poolSize && range.mCount <= poolSize - range.mStart;
+    }
+
+    template <typename T>
+    void putSection(std::vector<uint8_t>& data, PackHeader& header, Section which, const T* values, size_t count)
+    {
+        data.resize(alignUp(data.size(), SECTION_ALIGNMENT));
+        header.mSections[which] = {data.size(), count * sizeof(T)};
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(values);
+        data.insert(data.end(), bytes, bytes + count * sizeof(T));
+    }
+
+    template <typename T>
+    std::span<const T> getSection(const uint8_t* data, const PackHeader& header, Section which)
+    {
+        const SectionEntry& entry = header.mSections[which];
+        if(entry.mOffset < sizeof(PackHeader) || entry.mOffset > header.mMetadataSize
+           || entry.mSize > header.mMetadataSize - entry.mOffset
+           || entry.mOffset % alignof(T) != 0 || entry.mSize % sizeof(T) != 0)
+            throw std::runtime_error("Corrupt FOX5 pack section.");
+        return std::span<const T>(reinterpret_cast<const T*>(data + entry.mOffset), entry.mSize / sizeof(T));
+    }
+}
+
+void FOX5Pack::write(FOX5& fox, const std::string& filename, unsigned threadCount, const TextureFormatPolicy& policy)
+{
+    PackHeader header = {};
+    std::memcpy(header.mMagic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    header.mVersion = VERSION;
+    header.mByteOrder = 0x01020304;
+    header.mGenerator = fox.mGenerator;
+    header.mLayout = PACK_LAYOUT;
+
+    std::vector<Image> images(fox.imageCount());
+    for(uint32_t id = 0; id < images.size(); id++)
+    {
+        FOX5ImageInfo info = fox.imageInfo(id);
+        Image& image = images[id];
+        image.mWidth = info.mWidth;
+        image.mHeight = info.mHeight;
+        image.mTexWidth = textureSize(info.mWidth);
+        image.mTexHeight = textureSize(info.mHeight);
+        if(image.mTexWidth > MAX_TEXTURE_SIZE || image.mTexHeight > MAX_TEXTURE_SIZE)
+            throw std::runtime_error("Image " + std::to_string(id) + " is too large for a texture.");
+        // Format, size and offset come once the image is decoded
+        image.mFormat = GPUFormat::RGBA8;
+        image.mSize = 0;
+    }
+
+    // Materializing lazy objects appends to the pools, so only read those
+    // once every object is in
+    std::vector<Object> objects(fox.objectCount());
+    std::vector<String> stringRefs;
+    std::string strings;
+    auto addString = [&](const std::string& value)
+    {
+        String ref = {static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(value.size())};
+        strings += value;
+        return ref;
+    };
+    auto addStrings = [&](const std::vector<std::string>& values)
+    {
+        FOX5Range range = {static_cast<uint32_t>(stringRefs.size()), static_cast<uint32_t>(values.size())};
+        for(auto& value : values)
+            stringRefs.push_back(addString(value));
+        return range;
+    };
+    for(uint32_t i = 0; i < objects.size(); i++)
+    {
+        const FOX5Object& source = fox.object(i);
+        Object& object = objects[i];
+        object.mObjectID = source.mObjectID;
+        object.mAuthorRevision = source.mAuthorRevision;
+        object.mMoreFlags = source.mMoreFlags;
+        object.mLicense = source.mLicense;
+        object.mFlags = source.mFlags;
+        object.mEditType = source.mEditType;
+        object.mFilterTarget = source.mFilterTarget;
+        object.mFilterMode = source.mFilterMode;
+        object.mName = addString(source.mName);
+        object.mDescription = addString(source.mDescription);
+        object.mURI = addString(source.mURI);
+        object.mAuthors = addStrings(source.mAuthors);
+        object.mKeywords = addStrings(source.mKeywords);
+        object.mShapes = source.mShapes;
+    }
+
+    std::vector<ObjectID> objectIDs(objects.size());
+    for(uint32_t i = 0; i < objects.size(); i++)
+        objectIDs[i] = {objects[i].mObjectID, i};
+    std::stable_sort(objectIDs.begin(), objectIDs.end(),
+                     [](const ObjectID& a, const ObjectID& b) { return a.mObjectID < b.mObjectID; });
+
+    std::vector<uint8_t> metadata(sizeof(PackHeader));
+    putSection(metadata, header, IMAGES, images.data(), images.size());
+    putSection(metadata, header, OBJECTS, objects.data(), objects.size());
+    putSection(metadata, header, OBJECT_IDS, objectIDs.data(), objectIDs.size());
+    putSection(metadata, header, SHAPES, fox.mShapes.data(), fox.mShapes.size());
+    putSection(metadata, header, FRAMES, fox.mFrames.data(), fox.mFrames.size());
+    putSection(metadata, header, CHANNELS, fox.mChannels.data(), fox.mChannels.size());
+    putSection(metadata, header, KITTERSPEAK, fox.mKitterspeak.data(), fox.mKitterspeak.size());
+    putSection(metadata, header, STRING_REFS, stringRefs.data(), stringRefs.size());
+    putSection(metadata, header, STRINGS, strings.data(), strings.size());
+    header.mMetadataSize = metadata.size();
+
+    Image* imageRecords = reinterpret_cast<Image*>(metadata.data() + header.mSections[IMAGES].mOffset);
+
+    // Written next to the target and renamed over it, like cache entries.
+    // The image section is rewritten once every format is known. Anything
+    // that fails from here on takes the temp file with it.
+    std::string tempPath = uniqueTempPath(filename);
+    std::ofstream file(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file || !file.is_open())
+        throw std::runtime_error("Failed to create " + tempPath);
+    try
+    {
+        file.write(reinterpret_cast<const char*>(metadata.data()), metadata.size());
+
+        const char padding[TEXEL_ALIGNMENT] = {0};
+        size_t position = metadata.size();
+        std::vector<uint32_t> ids;
+        std::vector<uint8_t> texels;
+        for(uint32_t first = 0; first < images.size(); first += IMAGE_BATCH)
+        {
+            ids.resize(std::min<size_t>(IMAGE_BATCH, images.size() - first));
+            std::iota(ids.begin(), ids.end(), first);
+            std::vector<FOX5Image> decoded = fox.getImages(ids, threadCount);
+            for(size_t i = 0; i < ids.size(); i++)
+            {
+                Image& image = imageRecords[ids[i]];
+                image.mFormat = policy.choose(ids[i], decoded[i]);
+                image.mSize = uint32_t(image.mTexWidth) * image.mTexHeight * gpuBitsPerPixel(image.mFormat) / 8;
+                size_t offset = alignUp(position, TEXEL_ALIGNMENT);
+                if(offset > UINT32_MAX - image.mSize)
+                    throw std::runtime_error("FOX5 pack would be larger than 4 GiB.");
+                image.mOffset = static_cast<uint32_t>(offset);
+                
+                texels.resize(image.mSize);
+                fox5TextureData(decoded[i], texels.data(), image.mTexWidth, image.mTexHeight, image.mFormat);
+                file.write(padding, offset - position);
+                file.write(reinterpret_cast<const char*>(texels.data()), texels.size());
+                position = offset + texels.size();
+            }
+        }
+        
+        header.mMetadataHash = hashBytes(metadata.data() + sizeof(PackHeader), metadata.size() - sizeof(PackHeader));
+        std::memcpy(metadata.data(), &header, sizeof(header));
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(metadata.data()), metadata.size());
+        file.close();
+        if(!file)
+            throw std::runtime_error("Failed to write " + tempPath);
+        std::filesystem::rename(tempPath, filename);
+    }
+    catch(...)
+    {
+        file.close();
+        std::error_code error;
+        std::filesystem::remove(tempPath, error);
+        throw;
+    }
+}
+
+FOX5Pack::FOX5Pack(const std::string& filename, FOX5::LoadMode mode) : mFileName(filename), mLoadMode(mode)
+{
+    if(mLoadMode == FOX5::LoadMode::MAPPED)
+    {
+        mMapping = std::make_unique<MappedFile>(filename);
+        parseMetadata(mMapping->data(), mMapping->size(), mMapping->size());
+        return;
+    }
+
+    mFile.open(filename, std::ios::in | std::ios::binary);
+    if(!mFile || !mFile.is_open())
+        throw std::runtime_error("Failed to open file.");
+    mFile.seekg(0, std::ios::end);
+    size_t fileSize = static_cast<size_t>(mFile.tellg());
+    mFile.seekg(0, std::ios::beg);
+
+    PackHeader header;
+    if(fileSize < sizeof(header) || !mFile.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        throw std::runtime_error("Not a FOX5 pack.");
+    if(header.mMetadataSize < sizeof(header) || header.mMetadataSize > fileSize)
+        throw std::runtime_error("Corrupt FOX5 pack.");
+
+    mMetadata.resize(header.mMetadataSize);
+    std::memcpy(mMetadata.data(), &header, sizeof(header));
+    if(!mFile.read(reinterpret_cast<char*>(mMetadata.data() + sizeof(header)), mMetadata.size() - sizeof(header)))
+        throw std::runtime_error("Failed to read FOX5 pack.");
+    parseMetadata(mMetadata.data(), mMetadata.size(), fileSize);
+}
+
+void FOX5Pack::parseMetadata(const uint8_t* data, size_t size, size_t fileSize)
+{
+    PackHeader header;
+    if(size < sizeof(header))
+        throw std::runtime_error("Not a FOX5 pack.");
+    std::memcpy(&header, data, sizeof(header));
+    if(std::memcmp(header.mMagic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0)
+        throw std::runtime_error("Not a FOX5 pack.");
+    if(header.mVersion != VERSION || header.mByteOrder != 0x01020304 || header.mLayout != PACK_LAYOUT)
+        throw std::runtime_error("FOX5 pack was written for a different build.");
+    if(header.mMetadataSize < sizeof(header) || header.mMetadataSize > size
+       || hashBytes(data + sizeof(header), header.mMetadataSize - sizeof(header)) != header.mMetadataHash)
+        throw std::runtime_error("Corrupt FOX5 pack.");
+
+    mGenerator = header.mGenerator;
+    mImages = getSection<Image>(data, header, IMAGES);
+    mObjects = getSection<Object>(data, header, OBJECTS);
+    mObjectIDs = getSection<ObjectID>(data, header, OBJECT_IDS);
+    mShapes = getSection<FOX5Shape>(data, header, SHAPES);
+    mFrames = getSection<FOX5Frame>(data, header, FRAMES);
+    mChannels = getSection<FOX5Channel>(data, header, CHANNELS);
+    mKitterspeak = getSection<FOX5Shape::Kitterspeak_t>(data, header, KITTERSPEAK);
+    mStringRefs = getSection<String>(data, header, STRING_REFS);
+    std::span<const char> strings = getSection<char>(data, header, STRINGS);
+    mStrings = std::string_view(strings.data(), strings.size());
+
+    // The hash only catches damage, ranges still have to be checked so a
+    // bad writer can't send the client out of bounds
+    for(auto& image : mImages)
+    {
+        if(std::popcount(image.mTexWidth) != 1 || std::popcount(image.mTexHeight) != 1
+           || image.mTexWidth < 8 || image.mTexHeight < 8
+           || image.mTexWidth > MAX_TEXTURE_SIZE || image.mTexHeight > MAX_TEXTURE_SIZE
+           || image.mWidth > image.mTexWidth || image.mHeight > image.mTexHeight
+           || image.mSize != uint32_t(image.mTexWidth) * image.mTexHeight * gpuBitsPerPixel(image.mFormat) / 8
+           || image.mOffset < header.mMetadataSize || image.mOffset > fileSize
+           || image.mSize > fileSize - image.mOffset)
+            throw std::runtime_error("Corrupt FOX5 pack image.");
+    }
+    auto validString = [&](const String& string)
+    {
+        return string.mOffset <= mStrings.size() && string.mSize <= mStrings.size() - string.mOffset;
+    };
+    for(auto& string : mStringRefs)
+    {
+        if(!validString(string))
+            throw std::runtime_error("Corrupt FOX5 pack string.");
+    }
+    if(mObjectIDs.size() != mObjects.size())
+        throw std::runtime_error("Corrupt FOX5 pack object IDs.");
+    for(auto& id : mObjectIDs)
+    {
+        if(id.mIndex >= mObjects.size() || mObjects[id.mIndex].mObjectID != id.mObjectID)
+            throw std::runtime_error("Corrupt FOX5 pack object IDs.");
+    }
+    for(auto& object : mObjects)
+    {
+        if(!validString(object.mName) || !validString(object.mDescription) || !validString(object.mURI)
+           || !inRange(object.mAuthors, mStringRefs.size()) || !inRange(object.mKeywords, mStringRefs.size())
+           || !inRange(object.mShapes, mShapes.size()))
+            throw std::runtime_error("Corrupt FOX5 pack object.");
+    }
+    for(auto& shape : mShapes)
+    {
+        if(!inRange(shape.mFrames, mFrames.size()) || !inRange(shape.mKitterspeak, mKitterspeak.size()))
+            throw std::runtime_error("Corrupt FOX5 pack shape.");
+    }
+    for(auto& frame : mFrames)
+    {
+        if(!inRange(frame.mSprites, mChannels.size()))
+            throw std::runtime_error("Corrupt FOX5 pack frame.");
+    }
+}
+
+const FOX5Pack::Image& FOX5Pack::image(uint32_t id) const
+{
+    if(id >= mImages.size())
+        throw std::runtime_error("Image index out of bounds");
+    return mImages[id];
+}
+
+void FOX5Pack::readImage(uint32_t id, uint8_t* dest)
+{
+    const Image& im = image(id);
+    if(mLoadMode == FOX5::LoadMode::MAPPED)
+    {
+        std::memcpy(dest, mMapping->data() + im.mOffset, im.mSize);
+        return;
+    }
+    mFile.seekg(im.mOffset, std::ios::beg);
+    mFile.read(reinterpret_cast<char*>(dest), im.mSize);
+    if(!mFile)
+        throw std::runtime_error("Failed to read image data.");
+}
+
+std::span<const uint8_t> FOX5Pack::imageData(uint32_t id) const
+{
+    if(mLoadMode != FOX5::LoadMode::MAPPED)
+        throw std::runtime_error("Image data views need a mapped FOX5 pack");
+    const Image& im = image(id);
+    return std::span<const uint8_t>(mMapping->data() + im.mOffset, im.mSize);
+}
+
+const FOX5Pack::Object& FOX5Pack::objectRecord(uint32_t index) const
+{
+    if(index >= mObjects.size())
+        throw std::runtime_error("Object index out of bounds");
+    return mObjects[index];
+}
+
+const FOX5Pack::Object* FOX5Pack::findObject(int32_t objectID) const
+{
+    auto it = std::lower_bound(mObjectIDs.begin(), mObjectIDs.end(), objectID,
+                               [](const ObjectID& entry, int32_t id) { return entry.mObjectID < id; });
+    if(it == mObjectIDs.end() || it->mObjectID != objectID)
+        return nullptr;
+    return &mObjects[it->mIndex];
+}
+
+FOX5Object FOX5Pack::object(uint32_t index) const
+{
+    const Object& record = objectRecord(index);
+    FOX5Object object;
+    object.mAuthorRevision = record.mAuthorRevision;
+    for(auto& author : strings(record.mAuthors))
+        object.mAuthors.emplace_back(string(author));
+    object.mLicense = record.mLicense;
+    for(auto& keyword : strings(record.mKeywords))
+        object.mKeywords.emplace_back(string(keyword));
+    object.mName = string(record.mName);
+    object.mDescription = string(record.mDescription);
+    object.mFlags = record.mFlags;
+    object.mURI = string(record.mURI);
+    object.mMoreFlags = record.mMoreFlags;
+    object.mObjectID = record.mObjectID;
+    object.mEditType = record.mEditType;
+    object.mFilterTarget = record.mFilterTarget;
+    object.mFilterMode = record.mFilterMode;
+    object.mShapes = record.mShapes;
+    return object;
+}
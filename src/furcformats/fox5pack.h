@@ -0,0 +1,145 @@
+#ifndef FOX5PACK_H
+#define FOX5PACK_H
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "filecommon.h"
+#include "fox5.h"
+#include "texturelayout.h"
+
+// A FOX5 file repacked for the console by the fox5pack tool. Images are
+// stored padded, tiled and in their final GPU format, so loading one is a
+// single read into texture memory. The tree is stored as the same flat
+// per-level arrays FOX5 uses and is read in place.
+//
+// Layout, native byte order and struct layout like FOX5Cache:
+//   Header
+//   Sections, each 8 byte aligned: images, objects, object IDs, shapes,
+//   frames, channels, kitterspeak, string refs, string data
+//   Image texels, each image 128 byte aligned
+class FOX5Pack
+{
+public:
+    static const uint32_t VERSION = 1;
+
+    struct Image
+    {
+        uint32_t mOffset; // From the start of the file
+        uint32_t mSize;
+        uint16_t mWidth;
+        uint16_t mHeight;
+        uint16_t mTexWidth;
+        uint16_t mTexHeight;
+        GPUFormat mFormat;
+        uint8_t mReserved[3] = {0};
+    };
+
+    struct String
+    {
+        uint32_t mOffset; // Into the string data
+        uint32_t mSize;
+    };
+
+    // FOX5Object without the heap, strings and string lists refer to the
+    // string tables
+    struct Object
+    {
+        int32_t mObjectID;
+        uint32_t mAuthorRevision;
+        uint32_t mMoreFlags;
+        FOX5Object::License mLicense;
+        uint8_t mFlags;
+        uint8_t mEditType;
+        uint8_t mFilterTarget;
+        uint8_t mFilterMode;
+        uint8_t mReserved[3] = {0};
+        String mName;
+        String mDescription;
+        String mURI;
+        FOX5Range mAuthors; // Into the string refs
+        FOX5Range mKeywords;
+        FOX5Range mShapes;
+    };
+
+    struct ObjectID
+    {
+        int32_t mObjectID;
+        uint32_t mIndex;
+    };
+
+    // Writes fox as a pack, decoding images on threadCount threads (0 = one
+    // per core). A lazy fox is loaded in full first. Each image is stored in
+    // the format policy chooses for it.
+    static void write(FOX5& fox, const std::string& filename, unsigned threadCount = 0,
+                      const TextureFormatPolicy& policy = {});
+
+    // STREAM keeps only the tree in memory and reads images on demand,
+    // MAPPED maps the whole file
+    FOX5Pack(const std::string& filename, FOX5::LoadMode mode = FOX5::LoadMode::STREAM);
+
+    std::string mFileName;
+    uint8_t mGenerator = 0;
+
+    size_t imageCount() const { return mImages.size(); };
+    const Image& image(uint32_t id) const;
+    // Copies image(id).mSize bytes of texels into dest
+    void readImage(uint32_t id, uint8_t* dest);
+    // MAPPED only, a view of the texels inside the mapping
+    std::span<const uint8_t> imageData(uint32_t id) const;
+
+    size_t objectCount() const { return mObjects.size(); };
+    const Object& objectRecord(uint32_t index) const;
+    const Object* findObject(int32_t objectID) const; // nullptr if there is none
+    // A heap copy of the object, for code written against FOX5Object
+    FOX5Object object(uint32_t index) const;
+
+    std::string_view string(const String& string) const
+    {
+        return std::string_view(mStrings.data() + string.mOffset, string.mSize);
+    };
+    std::span<const String> strings(const FOX5Range& range) const
+    {
+        return mStringRefs.subspan(range.mStart, range.mCount);
+    };
+
+    std::span<const FOX5Shape> shapes(const Object& object) const
+    {
+        return mShapes.subspan(object.mShapes.mStart, object.mShapes.mCount);
+    };
+    std::span<const FOX5Frame> frames(const FOX5Shape& shape) const
+    {
+        return mFrames.subspan(shape.mFrames.mStart, shape.mFrames.mCount);
+    };
+    std::span<const FOX5Channel> channels(const FOX5Frame& frame) const
+    {
+        return mChannels.subspan(frame.mSprites.mStart, frame.mSprites.mCount);
+    };
+    std::span<const FOX5Shape::Kitterspeak_t> kitterspeak(const FOX5Shape& shape) const
+    {
+        return mKitterspeak.subspan(shape.mKitterspeak.mStart, shape.mKitterspeak.mCount);
+    };
+
+protected:
+    FOX5::LoadMode mLoadMode;
+    std::ifstream mFile;
+    std::unique_ptr<MappedFile> mMapping;
+    std::vector<uint8_t> mMetadata; // Everything before the texels, STREAM only
+
+    std::span<const Image> mImages;
+    std::span<const Object> mObjects;
+    std::span<const ObjectID> mObjectIDs; // Sorted by ID
+    std::span<const FOX5Shape> mShapes;
+    std::span<const FOX5Frame> mFrames;
+    std::span<const FOX5Channel> mChannels;
+    std::span<const FOX5Shape::Kitterspeak_t> mKitterspeak;
+    std::span<const String> mStringRefs;
+    std::string_view mStrings;
+
+    void parseMetadata(const uint8_t* data, size_t size, size_t fileSize);
+};
+
+#endif // FOX5PACK_H
@@ -0,0 +1,138 @@
+#ifndef FOX5SCHEMA_H
+#define FOX5SCHEMA_H
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include "fox5.h"
+
+// Wire layout of every FOX5 command, the one place the format is written
+// down. The variant decoder, the skipper and the validator are all built
+// from this table.
+//
+// A command is an optional count followed by that many records, or by
+// exactly one record when it has no count. A record is up to four fields,
+// String and Bytes fields being a u16 length and then the data.
+namespace FOX5Schema
+{
+    using Command = FOX5Command::Command;
+    using Type = FOX5Command::Type;
+
+    // Entry depth a command belongs in, see FOX5Command::validate
+    const uint8_t ANY_LEVEL = 0xFF;
+    const uint8_t FILE_LEVEL = 1;
+    const uint8_t OBJECT_LEVEL = 2;
+    const uint8_t SHAPE_LEVEL = 3;
+    const uint8_t FRAME_LEVEL = 4;
+    const uint8_t CHANNEL_LEVEL = 5;
+
+    struct Layout
+    {
+        bool mKnown = false;
+        uint8_t mLevel = ANY_LEVEL;
+        uint8_t mCountSize = 0; // 0 = a single record, else 2 or 4
+        uint8_t mFieldCount = 0;
+        Type mFields[4] = {};
+        bool mHasStrings = false;
+        uint8_t mRecordSize = 0; // Bytes per record, not counting string data
+    };
+
+    constexpr uint8_t fieldSize(Type type)
+    {
+        switch(type)
+        {
+            case Type::UInt8:
+            case Type::Int8:
+                return 1;
+            case Type::UInt16:
+            case Type::Int16:
+            case Type::String: // Just the length
+            case Type::Bytes:
+                return 2;
+            case Type::UInt32:
+            case Type::Int32:
+                return 4;
+        }
+        return 0;
+    }
+
+    constexpr Layout layout(uint8_t level, uint8_t countSize, std::initializer_list<Type> fields)
+    {
+        Layout result;
+        result.mKnown = true;
+        result.mLevel = level;
+        result.mCountSize = countSize;
+        for(Type type : fields)
+        {
+            result.mFields[result.mFieldCount++] = type;
+            result.mHasStrings |= type == Type::String || type == Type::Bytes;
+            result.mRecordSize += fieldSize(type);
+        }
+        return result;
+    }
+
+    constexpr std::array<Layout, 256> makeTable()
+    {
+        std::array<Layout, 256> table{};
+        auto set = [&](Command command, Layout value) { table[static_cast<uint8_t>(command)] = value; };
+
+        // Shared
+        set(Command::NOP, layout(ANY_LEVEL, 0, {}));
+        set(Command::LIST_START, layout(ANY_LEVEL, 0, {Type::UInt8, Type::UInt32}));
+        set(Command::LIST_END, layout(ANY_LEVEL, 0, {}));
+
+        // File
+        set(Command::FILE_GENERATOR, layout(FILE_LEVEL, 0, {Type::UInt8}));
+        set(Command::FILE_IMAGE_LIST, layout(FILE_LEVEL, 4, {Type::UInt32, Type::UInt16, Type::UInt16, Type::UInt8}));
+
+        // Object
+        set(Command::OBJECT_AUTHOR_REVISION, layout(OBJECT_LEVEL, 0, {Type::UInt16}));
+        set(Command::OBJECT_AUTHORS, layout(OBJECT_LEVEL, 2, {Type::String}));
+        set(Command::OBJECT_AUTHORS_HASH, layout(OBJECT_LEVEL, 2, {Type::Bytes}));
+        set(Command::OBJECT_LICENSE, layout(OBJECT_LEVEL, 0, {Type::UInt8}));
+        set(Command::OBJECT_KEYWORDS, layout(OBJECT_LEVEL, 2, {Type::String}));
+        set(Command::OBJECT_NAME, layout(OBJECT_LEVEL, 0, {Type::String}));
+        set(Command::OBJECT_DESCRIPTION, layout(OBJECT_LEVEL, 0, {Type::String}));
+        set(Command::OBJECT_FLAGS, layout(OBJECT_LEVEL, 0, {Type::UInt8}));
+        set(Command::OBJECT_URI, layout(OBJECT_LEVEL, 0, {Type::String}));
+        set(Command::OBJECT_MORE_FLAGS, layout(OBJECT_LEVEL, 0, {Type::UInt32}));
+        set(Command::OBJECT_IDENTIFIER, layout(OBJECT_LEVEL, 0, {Type::Int32}));
+        set(Command::OBJECT_EDIT_TYPE, layout(OBJECT_LEVEL, 0, {Type::UInt8}));
+        set(Command::OBJECT_FILTER, layout(OBJECT_LEVEL, 0, {Type::UInt8, Type::UInt8}));
+
+        // Shape
+        set(Command::SHAPE_PURPOSE, layout(SHAPE_LEVEL, 0, {Type::UInt8}));
+        set(Command::SHAPE_STATE, layout(SHAPE_LEVEL, 0, {Type::UInt8}));
+        set(Command::SHAPE_DIRECTION, layout(SHAPE_LEVEL, 0, {Type::UInt8}));
+        set(Command::SHAPE_RATIO, layout(SHAPE_LEVEL, 0, {Type::UInt8, Type::UInt8}));
+        set(Command::SHAPE_KITTERSPEAK, layout(SHAPE_LEVEL, 2, {Type::UInt16, Type::Int16, Type::Int16}));
+
+        // Frame
+        set(Command::FRAME_OFFSET, layout(FRAME_LEVEL, 0, {Type::Int16, Type::Int16}));
+        set(Command::FRAME_FURRE_OFFSET, layout(FRAME_LEVEL, 0, {Type::Int16, Type::Int16}));
+        set(Command::FRAME_ATTACH_PLUGS, layout(FRAME_LEVEL, 0, {Type::UInt16, Type::Int16, Type::Int16, Type::Int16}));
+        set(Command::FRAME_ATTACH_SOCKETS, layout(FRAME_LEVEL, 2, {Type::UInt8, Type::Int16, Type::Int16, Type::Int16}));
+
+        // Sprite
+        set(Command::CHANNEL_PURPOSE, layout(CHANNEL_LEVEL, 0, {Type::UInt16}));
+        set(Command::CHANNEL_IMAGE_ID, layout(CHANNEL_LEVEL, 0, {Type::UInt16}));
+        set(Command::CHANNEL_OFFSET, layout(CHANNEL_LEVEL, 0, {Type::Int16, Type::Int16}));
+        return table;
+    }
+
+    inline constexpr std::array<Layout, 256> TABLE = makeTable();
+
+    constexpr const Layout& of(Command command)
+    {
+        return TABLE[static_cast<uint8_t>(command)];
+    }
+
+    // Bytes per record of a command made only of fixed size fields, so
+    // readers can check a whole record once
+    constexpr size_t recordSize(Command command)
+    {
+        return of(command).mHasStrings ? 0 : of(command).mRecordSize;
+    }
+}
+
+#endif // FOX5SCHEMA_H
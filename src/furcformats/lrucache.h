@@ -0,0 +1,174 @@
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// Values with a size in bytes, kept most recently used first. Anything used
+// during the current frame is pinned, trim() only evicts older entries and
+// only the ones its caller agrees to let go of.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LRUCache
+{
+public:
+    struct Stats
+    {
+        uint64_t mHits = 0;
+        uint64_t mMisses = 0;
+        uint64_t mEvictions = 0;
+        size_t mBytes = 0;
+        size_t mPeakBytes = 0;
+        size_t mEntries = 0;
+
+        double hitRate() const
+        {
+            return mHits + mMisses ? double(mHits) / double(mHits + mMisses) : 0.0;
+        };
+    };
+
+    explicit LRUCache(size_t budget = SIZE_MAX) : mBudget(budget)
+    {
+    };
+
+    // nullptr and a miss if key isn't cached, otherwise a hit that pins it
+    Value* find(const Key& key)
+    {
+        auto it = mIndex.find(key);
+        if(it == mIndex.end())
+        {
+            mStats.mMisses++;
+            return nullptr;
+        }
+        mStats.mHits++;
+        use(it->second);
+        return &it->second->mValue;
+    };
+
+    // Replaces whatever key held. Doesn't trim, the new entry is pinned
+    // either way.
+    Value& insert(const Key& key, Value value, size_t bytes)
+    {
+        erase(key);
+        mOrder.push_front({key, std::move(value), bytes, mFrame});
+        mIndex.emplace(key, mOrder.begin());
+        mStats.mBytes += bytes;
+        mStats.mPeakBytes = std::max(mStats.mPeakBytes, mStats.mBytes);
+        mStats.mEntries = mOrder.size();
+        return mOrder.front().mValue;
+    };
+
+    bool erase(const Key& key)
+    {
+        auto it = mIndex.find(key);
+        if(it == mIndex.end())
+            return false;
+        remove(it->second);
+        mIndex.erase(it);
+        return true;
+    };
+
+    void clear()
+    {
+        mOrder.clear();
+        mIndex.clear();
+        mStats.mBytes = 0;
+        mStats.mEntries = 0;
+    };
+
+    // Unpins everything used so far
+    void nextFrame()
+    {
+        mFrame++;
+    };
+
+    // Evicts least recently used entries until the cache is within budget.
+    // canEvict(key, value) can refuse an entry, such as one still drawn
+    // through a reference held elsewhere. Returns whether it got there.
+    template <typename CanEvict>
+    bool trim(CanEvict canEvict)
+    {
+        for(auto it = mOrder.end(); mStats.mBytes > mBudget && it != mOrder.begin();)
+        {
+            --it;
+            if(it->mLastUse == mFrame)
+                break; // Everything from here on is pinned
+            if(canEvict(it->mKey, it->mValue))
+                it = evict(it);
+        }
+        return mStats.mBytes <= mBudget;
+    };
+    bool trim()
+    {
+        return trim([](const Key&, const Value&) { return true; });
+    };
+
+    // Evicts whatever hasn't been used for more than frames frames, budget
+    // or not
+    template <typename CanEvict>
+    void dropUnused(uint32_t frames, CanEvict canEvict)
+    {
+        for(auto it = mOrder.end(); it != mOrder.begin();)
+        {
+            --it;
+            if(mFrame - it->mLastUse <= frames)
+                break;
+            if(canEvict(it->mKey, it->mValue))
+                it = evict(it);
+        }
+    };
+
+    void setBudget(size_t budget) { mBudget = budget; };
+    size_t budget() const { return mBudget; };
+    uint32_t frame() const { return mFrame; };
+    const Stats& stats() const { return mStats; };
+    void resetCounters()
+    {
+        mStats.mHits = mStats.mMisses = mStats.mEvictions = 0;
+        mStats.mPeakBytes = mStats.mBytes;
+    };
+
+protected:
+    struct Node
+    {
+        Key mKey;
+        Value mValue;
+        size_t mBytes;
+        uint32_t mLastUse;
+    };
+    using Iterator = typename std::list<Node>::iterator;
+
+    std::list<Node> mOrder; // Most recently used first
+    std::unordered_map<Key, Iterator, Hash> mIndex;
+    size_t mBudget;
+    uint32_t mFrame = 0;
+    Stats mStats;
+
+    void use(Iterator it)
+    {
+        it->mLastUse = mFrame;
+        mOrder.splice(mOrder.begin(), mOrder, it);
+    };
+
+    void remove(Iterator it)
+    {
+        mStats.mBytes -= it->mBytes;
+        mOrder.erase(it);
+        mStats.mEntries = mOrder.size();
+    };
+
+    // The entry after it, so a walk from the back carries on with --
+    Iterator evict(Iterator it)
+    {
+        Iterator next = std::next(it);
+        mIndex.erase(it->mKey);
+        remove(it);
+        mStats.mEvictions++;
+        return next;
+    };
+};
+
+#endif // LRUCACHE_H
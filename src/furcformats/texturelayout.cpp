@@ -0,0 +1,545 @@
+#include "texturelayout.h"
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <cstring>
+#include "texturepalette.h"
+
+namespace
+{
+    // Within a tile the texels of a row land in pairs, at these offsets
+    // from where its first texel goes
+    const int TILE_ROW_START[8] = {0, 2, 8, 10, 32, 34, 40, 42};
+    const int PAIR_OFFSET[4] = {0, 4, 16, 20};
+    
+    // Moves two neighbouring texels, reversing the bytes of each
+    template <int BPP>
+    inline void movePair(uint8_t* dest, const uint8_t* src)
+    {
+        if constexpr (BPP == 4 && std::endian::native == std::endian::little)
+        {
+            uint64_t texels;
+            std::memcpy(&texels, src, 8);
+            texels = std::rotl(__builtin_bswap64(texels), 32);
+            std::memcpy(dest, &texels, 8);
+        }
+        else if constexpr (BPP == 2)
+        {
+            uint32_t texels;
+            std::memcpy(&texels, src, 4);
+            texels = ((texels & 0x00FF00FFu) << 8) | ((texels >> 8) & 0x00FF00FFu);
+            std::memcpy(dest, &texels, 4);
+        }
+        else
+        {
+            for(int j = 0; j < BPP; j++)
+            {
+                dest[j] = src[BPP - 1 - j];
+                dest[BPP + j] = src[2 * BPP - 1 - j];
+            }
+        }
+    }
+    
+    template <GPUFormat Format>
+    constexpr int TEXEL_BYTES = Format == GPUFormat::RGBA8 ? 4 : 2;
+    
+    // Each channel's bits of a Format texel, the packed texel is the OR of
+    // its four channels
+    template <GPUFormat Format>
+    struct ChannelTables
+    {
+        uint16_t mR[256], mG[256], mB[256], mA[256];
+        
+        constexpr ChannelTables() : mR(), mG(), mB(), mA()
+        {
+            for(int value = 0; value < 256; value++)
+            {
+                uint8_t v = static_cast<uint8_t>(value);
+                mR[value] = static_cast<uint16_t>(packTexel<Format>(v, 0, 0, 0));
+                mG[value] = static_cast<uint16_t>(packTexel<Format>(0, v, 0, 0));
+                mB[value] = static_cast<uint16_t>(packTexel<Format>(0, 0, v, 0));
+                mA[value] = static_cast<uint16_t>(packTexel<Format>(0, 0, 0, v));
+            }
+        }
+    };
+    template <GPUFormat Format>
+    constexpr ChannelTables<Format> CHANNEL_TABLES;
+    
+    // Two FOX5 texels to GPU texels. 8-bit ones go through the palette,
+    // 32-bit ones are A, R, G, B in and packed to Format.
+    template <bool Indexed, GPUFormat Format>
+    inline void convertPair(uint8_t* dest, const uint8_t* src, const TexturePalette& palette)
+    {
+        const int BPP = TEXEL_BYTES<Format>;
+        if constexpr (Indexed)
+        {
+            uint8_t texels[2 * BPP];
+            std::memcpy(texels, palette.texel(src[0]), BPP);
+            std::memcpy(texels + BPP, palette.texel(src[1]), BPP);
+            std::memcpy(dest, texels, sizeof(texels));
+        }
+        else if constexpr (Format != GPUFormat::RGBA8)
+        {
+            const ChannelTables<Format>& tables = CHANNEL_TABLES<Format>;
+            uint32_t first = tables.mA[src[0]] | tables.mR[src[1]] | tables.mG[src[2]] | tables.mB[src[3]];
+            uint32_t second = tables.mA[src[4]] | tables.mR[src[5]] | tables.mG[src[6]] | tables.mB[src[7]];
+            uint8_t texels[4] = {uint8_t(first), uint8_t(first >> 8), uint8_t(second), uint8_t(second >> 8)};
+            std::memcpy(dest, texels, 4);
+        }
+        else if constexpr (std::endian::native == std::endian::little)
+        {
+            uint64_t texels;
+            std::memcpy(&texels, src, 8);
+            texels = (texels & 0x00FF00FF00FF00FFull) | ((texels & 0x0000FF000000FF00ull) << 16)
+                   | ((texels >> 16) & 0x0000FF000000FF00ull);
+            std::memcpy(dest, &texels, 8);
+        }
+        else
+        {
+            for(int i = 0; i < 8; i += 4)
+            {
+                dest[i] = src[i];
+                dest[i + 1] = src[i + 3];
+                dest[i + 2] = src[i + 2];
+                dest[i + 3] = src[i + 1];
+            }
+        }
+    }
+    
+    // Decoded FOX5 rows to tiled texels in one pass. Texels come straight
+    // from the image, pad is only written where the cell is larger than it.
+    template <bool Indexed, GPUFormat Format>
+    void convertTiles(uint8_t* texture, int texWidth, int texHeight, int x, int y,
+                      int cellWidth, int cellHeight, const FOX5Image& image, uint8_t pad,
+                      const TexturePalette& palette)
+    {
+        const int BPP = TEXEL_BYTES<Format>;
+        const int srcBPP = Indexed ? 1 : 4;
+        const int tilesX = texWidth / 8;
+        const size_t tileBytes = 64 * BPP;
+        const int fullPairs = image.mWidth / 2;
+        
+        for(int cellY = 0; cellY < cellHeight; cellY++)
+        {
+            int row = texHeight - 1 - (y + cellY);
+            uint8_t* destRow = texture + (size_t(row / 8) * tilesX * 64 + TILE_ROW_START[row % 8]) * BPP;
+            uint8_t* firstTile = destRow + size_t(x / 8) * tileBytes;
+            
+            if(cellY >= image.mHeight)
+            {
+                for(int pair = 0; pair < cellWidth / 2; pair++)
+                    std::memset(firstTile + (pair / 4) * tileBytes + PAIR_OFFSET[pair % 4] * BPP, pad, 2 * BPP);
+                continue;
+            }
+            
+            const uint8_t* srcRow = image.mData.data() + size_t(cellY) * image.mWidth * srcBPP;
+            int pair = 0;
+            for(; pair < fullPairs; pair++)
+                convertPair<Indexed, Format>(firstTile + (pair / 4) * tileBytes + PAIR_OFFSET[pair % 4] * BPP,
+                                          srcRow + pair * 2 * srcBPP, palette);
+            
+            // An odd width leaves half a pair of image
+            if(image.mWidth % 2)
+            {
+                uint8_t last[8] = {0};
+                std::memcpy(last, srcRow + (image.mWidth - 1) * srcBPP, srcBPP);
+                uint8_t halfPair[2 * BPP];
+                convertPair<Indexed, Format>(halfPair, last, palette);
+                std::memset(halfPair + BPP, pad, BPP);
+                std::memcpy(firstTile + (pair / 4) * tileBytes + PAIR_OFFSET[pair % 4] * BPP, halfPair, 2 * BPP);
+                pair++;
+            }
+            for(; pair < cellWidth / 2; pair++)
+                std::memset(firstTile + (pair / 4) * tileBytes + PAIR_OFFSET[pair % 4] * BPP, pad, 2 * BPP);
+        }
+    }
+    
+    // Walks src one row at a time, so reads stay linear and writes stay
+    // inside the 8 tiles of a tile row
+    template <int BPP>
+    void swizzleTiles(uint8_t* dest, const uint8_t* src, int width, int height)
+    {
+        const int tilesX = width / 8;
+        const size_t tileBytes = 64 * BPP;
+        for(int tileY = 0; tileY < height / 8; tileY++)
+        {
+            uint8_t* tileRow = dest + size_t(tileY) * tilesX * tileBytes;
+            for(int row = 0; row < 8; row++)
+            {
+                // Bottom up, the GPU's origin is the lower left
+                const uint8_t* srcRow = src + size_t(height - 1 - (tileY * 8 + row)) * width * BPP;
+                uint8_t* destRow = tileRow + TILE_ROW_START[row] * BPP;
+                for(int tileX = 0; tileX < tilesX; tileX++)
+                {
+                    const uint8_t* s = srcRow + tileX * 8 * BPP;
+                    uint8_t* d = destRow + tileX * tileBytes;
+                    movePair<BPP>(d + PAIR_OFFSET[0] * BPP, s);
+                    movePair<BPP>(d + PAIR_OFFSET[1] * BPP, s + 2 * BPP);
+                    movePair<BPP>(d + PAIR_OFFSET[2] * BPP, s + 4 * BPP);
+                    movePair<BPP>(d + PAIR_OFFSET[3] * BPP, s + 6 * BPP);
+                }
+            }
+        }
+    }
+    
+    // Texels in format, from palette for 8-bit images
+    void writeTiles(uint8_t* texture, uint16_t texWidth, uint16_t texHeight, uint16_t x, uint16_t y,
+                    uint16_t cellWidth, uint16_t cellHeight, const FOX5Image& image, uint8_t pad,
+                    GPUFormat format, const TexturePalette& palette)
+    {
+        if(x % 8 || y % 8 || cellWidth % 8 || cellHeight % 8 || texWidth % 8 || texHeight % 8)
+            throw std::invalid_argument("Cells must be whole 8x8 tiles.");
+        if(x + cellWidth > texWidth || y + cellHeight > texHeight
+           || image.mWidth > cellWidth || image.mHeight > cellHeight)
+            throw std::invalid_argument("Image doesn't fit its cell.");
+        bool indexed = image.mImageFormat == FOX5Image::ImageFormat::E_8BIT;
+        if(image.mData.size() < size_t(image.mWidth) * image.mHeight * (indexed ? 1 : 4))
+            throw std::runtime_error("Image data is smaller than its size.");
+        
+        auto convert = [&]<bool Indexed, GPUFormat Format>()
+        {
+            convertTiles<Indexed, Format>(texture, texWidth, texHeight, x, y, cellWidth, cellHeight, image, pad,
+                                          palette);
+        };
+        if(indexed)
+        {
+            if(palette.format() != format)
+                throw std::invalid_argument("Palette is in the wrong format.");
+            // Palette texels are ready made, the format only sets their size
+            if(palette.bytesPerTexel() == 4)
+                convert.template operator()<true, GPUFormat::RGBA8>();
+            else
+                convert.template operator()<true, GPUFormat::RGBA4>();
+            return;
+        }
+        switch(format)
+        {
+            case GPUFormat::RGBA8:
+                convert.template operator()<false, GPUFormat::RGBA8>();
+                break;
+            case GPUFormat::RGBA5551:
+                convert.template operator()<false, GPUFormat::RGBA5551>();
+                break;
+            case GPUFormat::RGB565:
+                convert.template operator()<false, GPUFormat::RGB565>();
+                break;
+            case GPUFormat::RGBA4:
+                convert.template operator()<false, GPUFormat::RGBA4>();
+                break;
+            default:
+                throw std::invalid_argument("FOX5 images convert to RGBA8, RGBA5551, RGB565 or RGBA4 only.");
+        }
+    }
+}
+
+void reverse_morton_order(uint8_t* buffer, int width, int height, int bytesPerPixel)
+{
+    if (width % 8 != 0 || height % 8 != 0) {
+        throw std::invalid_argument("Width and height must be multiples of 8.");
+    }
+
+    int tilesX = width / 8;
+    int tilesY = height / 8;
+
+    // Create a temporary buffer to hold the transformed data
+    std::vector<uint8_t> swizzled(width * height * bytesPerPixel);
+
+    // Iterate over each 8x8 tile
+    for (int tileX = 0; tileX < tilesX; ++tileX) {
+        int pixelX = tileX * 8;
+
+        for (int tileY = 0; tileY < tilesY; ++tileY) {
+            int pixelY = tileY * 8;
+
+            // Calculate the tile number
+            int tileNum = tileX + tileY * tilesX;
+
+            // Reorder the pixels within this tile
+            for (int i = 0; i < 64; ++i) {
+                int srcX = pixelX + (i % 8);
+                int srcY = height - (pixelY + (i / 8)) - 1; // Flip along the y-axis
+
+                int srcIdx = (srcY * width + srcX) * bytesPerPixel;
+                int destIdx = (tileNum * 64 + morton_order[i]) * bytesPerPixel;
+
+                // Copy pixel data and optionally reverse byte order
+                for (int j = 0; j < bytesPerPixel; ++j) {
+                    swizzled[destIdx + j] = buffer[srcIdx + bytesPerPixel - j - 1];
+                }
+            }
+        }
+    }
+
+    // Copy the transformed data back to the original buffer
+    std::memcpy(buffer, swizzled.data(), width * height * bytesPerPixel);
+}
+
+void swizzleTexture(uint8_t* dest, const uint8_t* src, int width, int height, int bytesPerPixel)
+{
+    if (width % 8 != 0 || height % 8 != 0) {
+        throw std::invalid_argument("Width and height must be multiples of 8.");
+    }
+    
+    switch(bytesPerPixel)
+    {
+        case 2:
+            swizzleTiles<2>(dest, src, width, height);
+            break;
+        case 3:
+            swizzleTiles<3>(dest, src, width, height);
+            break;
+        case 4:
+            swizzleTiles<4>(dest, src, width, height);
+            break;
+        default:
+            throw std::invalid_argument("Unsupported bytes per pixel.");
+    }
+}
+
+unsigned int nextPowerOf2(unsigned int n)
+{
+    if (n == 0) return 1; // Special case: 0 → 1
+    n--;                  // Decrement n to handle exact powers of 2
+    n |= n >> 1;
+    n |= n >> 2;
+    n |= n >> 4;
+    n |= n >> 8;
+    n |= n >> 16;         // Works up to 32-bit integers
+    return n + 1;         // Add 1 to get the next power of 2
+}
+
+uint8_t* padImage(const uint8_t* imageData, uint16_t inputWidth, uint16_t inputHeight, uint8_t bpp,
+                                            uint16_t targetWidth, uint16_t targetHeight, uint8_t pad)
+{
+    // Validate input dimensions
+    if (inputWidth > targetWidth || inputHeight > targetHeight) {
+        throw std::invalid_argument("Target dimensions must be greater than or equal to input dimensions.");
+    }
+    
+    // Calculate sizes
+    int inputRowBytes = inputWidth * bpp; // Bytes per row in input image
+    int targetRowBytes = targetWidth * bpp; // Bytes per row in padded image
+    int paddedImageSize = targetHeight * targetRowBytes;
+    
+    // Allocate buffer for the padded image
+    uint8_t* paddedImage = new uint8_t[paddedImageSize];
+
+    // Fill the entire buffer with the padding value
+    std::memset(paddedImage, pad, paddedImageSize);
+
+    // Copy the input image into the padded buffer row by row
+    for (uint16_t y = 0; y < inputHeight; ++y) {
+        const uint8_t* srcRow = imageData + y * inputRowBytes; // Source row in input image
+        uint8_t* destRow = paddedImage + y * targetRowBytes;  // Destination row in padded image
+        std::memcpy(destRow, srcRow, inputRowBytes);          // Copy the row
+    }
+
+    return paddedImage; // Caller must free this buffer when done
+}
+
+uint8_t gpuBitsPerPixel(GPUFormat format)
+{
+    switch(format)
+    {
+        case GPUFormat::RGBA8:
+            return 32;
+        case GPUFormat::RGB8:
+            return 24;
+        case GPUFormat::RGBA5551:
+        case GPUFormat::RGB565:
+        case GPUFormat::RGBA4:
+        case GPUFormat::LA8:
+        case GPUFormat::HILO8:
+            return 16;
+        case GPUFormat::L8:
+        case GPUFormat::A8:
+        case GPUFormat::LA4:
+        case GPUFormat::ETC1A4:
+            return 8;
+        case GPUFormat::L4:
+        case GPUFormat::A4:
+        case GPUFormat::ETC1:
+            return 4;
+    }
+    throw std::runtime_error("Invalid texture format");
+}
+
+uint16_t textureSize(uint16_t size)
+{
+    return static_cast<uint16_t>(std::max(8u, nextPowerOf2(size)));
+}
+
+TextureAnalysis analyzeTexture(const FOX5Image& image)
+{
+    TextureAnalysis result;
+    size_t count = size_t(image.mWidth) * image.mHeight;
+    
+    // Visible colors as 0xRRGGBBAA, 8-bit images through the palette
+    std::vector<uint32_t> colors;
+    if(image.mImageFormat == FOX5Image::ImageFormat::E_8BIT)
+    {
+        bool used[256] = {false};
+        for(size_t i = 0; i < count; i++)
+            used[image.mData[i]] = true;
+        if(used[0])
+            result.mAlpha = TextureAnalysis::Alpha::BINARY;
+        const TexturePalette& palette = TexturePalette::standard(GPUFormat::RGBA8);
+        for(int index = 1; index < 256; index++)
+        {
+            if(used[index])
+                colors.push_back(packTexel<GPUFormat::RGBA8>(palette.color(index)[0], palette.color(index)[1],
+                                                             palette.color(index)[2], 0xFF));
+        }
+    }
+    else
+    {
+        colors.reserve(count);
+        const uint8_t* texel = image.mData.data();
+        for(size_t i = 0; i < count; i++, texel += 4)
+        {
+            uint8_t alpha = texel[0];
+            if(alpha == 0)
+            {
+                if(result.mAlpha == TextureAnalysis::Alpha::OPAQUE)
+                    result.mAlpha = TextureAnalysis::Alpha::BINARY;
+                continue;
+            }
+            if(alpha != 0xFF)
+            {
+                result.mAlpha = TextureAnalysis::Alpha::SMOOTH;
+                if(alpha % 17)
+                {
+                    // Nothing but RGBA8 keeps that, colors aren't counted
+                    result.mAlpha4 = false;
+                    return result;
+                }
+            }
+            // Sprites are flat, most texels repeat the one before
+            uint32_t color = packTexel<GPUFormat::RGBA8>(texel[1], texel[2], texel[3], alpha);
+            if(colors.empty() || colors.back() != color)
+                colors.push_back(color);
+        }
+    }
+    std::sort(colors.begin(), colors.end());
+    colors.erase(std::unique(colors.begin(), colors.end()), colors.end());
+    result.mColors = static_cast<uint32_t>(colors.size());
+    
+    GPUFormat format = result.format16();
+    if(format == GPUFormat::RGBA8)
+        return result;
+    for(auto& color : colors)
+    {
+        uint8_t r = color >> 24, g = color >> 16, b = color >> 8, a = color;
+        switch(format)
+        {
+            case GPUFormat::RGB565:
+                color = packTexel<GPUFormat::RGB565>(r, g, b, a);
+                break;
+            case GPUFormat::RGBA5551:
+                color = packTexel<GPUFormat::RGBA5551>(r, g, b, a);
+                break;
+            default:
+                color = packTexel<GPUFormat::RGBA4>(r, g, b, a);
+                break;
+        }
+    }
+    std::sort(colors.begin(), colors.end());
+    result.mColors16 = static_cast<uint32_t>(std::unique(colors.begin(), colors.end()) - colors.begin());
+    return result;
+}
+
+GPUFormat TextureAnalysis::format16() const
+{
+    switch(mAlpha)
+    {
+        case Alpha::OPAQUE:
+            return GPUFormat::RGB565;
+        case Alpha::BINARY:
+            return GPUFormat::RGBA5551;
+        default:
+            return mAlpha4 ? GPUFormat::RGBA4 : GPUFormat::RGBA8;
+    }
+}
+
+GPUFormat selectTextureFormat(const TextureAnalysis& analysis)
+{
+    // Only worth it while no two colors of the image become one
+    GPUFormat format = analysis.format16();
+    return analysis.mColors16 == analysis.mColors ? format : GPUFormat::RGBA8;
+}
+
+GPUFormat TextureFormatPolicy::choose(uint32_t id, const FOX5Image& image) const
+{
+    auto it = mOverrides.find(id);
+    if(it != mOverrides.end())
+        return it->second;
+    if(mDefault)
+        return *mDefault;
+    return selectTextureFormat(analyzeTexture(image));
+}
+
+GPUFormat parseGPUFormat(const std::string& name)
+{
+    static const std::pair<const char*, GPUFormat> NAMES[] = {
+        {"rgba8", GPUFormat::RGBA8}, {"rgba5551", GPUFormat::RGBA5551},
+        {"rgb565", GPUFormat::RGB565}, {"rgba4", GPUFormat::RGBA4}};
+    for(auto& entry : NAMES)
+    {
+        if(name == entry.first)
+            return entry.second;
+    }
+    throw std::invalid_argument("Unknown texture format " + name);
+}
+
+const char* gpuFormatName(GPUFormat format)
+{
+    switch(format)
+    {
+        case GPUFormat::RGBA8:
+            return "rgba8";
+        case GPUFormat::RGBA5551:
+            return "rgba5551";
+        case GPUFormat::RGB565:
+            return "rgb565";
+        case GPUFormat::RGBA4:
+            return "rgba4";
+        default:
+            return "other";
+    }
+}
+
+std::vector<uint8_t> fox5TextureData(const FOX5Image& image, uint16_t texWidth, uint16_t texHeight)
+{
+    std::vector<uint8_t> result(size_t(texWidth) * texHeight * 4);
+    fox5TextureData(image, result.data(), texWidth, texHeight);
+    return result;
+}
+
+void fox5TextureData(const FOX5Image& image, uint8_t* dest, uint16_t texWidth, uint16_t texHeight)
+{
+    writeTiledRect(dest, texWidth, texHeight, 0, 0, texWidth, texHeight, image, 0xFF);
+}
+
+void fox5TextureData(const FOX5Image& image, uint8_t* dest, uint16_t texWidth, uint16_t texHeight,
+                     const TexturePalette& palette)
+{
+    writeTiledRect(dest, texWidth, texHeight, 0, 0, texWidth, texHeight, image, 0xFF, &palette);
+}
+
+void fox5TextureData(const FOX5Image& image, uint8_t* dest, uint16_t texWidth, uint16_t texHeight, GPUFormat format)
+{
+    const TexturePalette& palette = image.mImageFormat == FOX5Image::ImageFormat::E_8BIT
+                                    ? TexturePalette::standard(format) : TexturePalette::standard(GPUFormat::RGBA8);
+    writeTiles(dest, texWidth, texHeight, 0, 0, texWidth, texHeight, image, 0xFF, format, palette);
+}
+
+void writeTiledRect(uint8_t* texture, uint16_t texWidth, uint16_t texHeight, uint16_t x, uint16_t y,
+                    uint16_t cellWidth, uint16_t cellHeight, const FOX5Image& image, uint8_t pad,
+                    const TexturePalette* palette)
+{
+    if(!palette)
+        palette = &TexturePalette::standard(GPUFormat::RGBA8);
+    if(image.mImageFormat != FOX5Image::ImageFormat::E_8BIT && palette->format() != GPUFormat::RGBA8)
+        throw std::invalid_argument("32-bit images only convert to RGBA8.");
+    writeTiles(texture, texWidth, texHeight, x, y, cellWidth, cellHeight, image, pad, palette->format(), *palette);
+}
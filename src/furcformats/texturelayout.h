@@ -0,0 +1,142 @@
+#ifndef TEXTURELAYOUT_H
+#define TEXTURELAYOUT_H
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "fox5.h"
+
+// Texel layout the 3DS GPU samples from. Nothing in here needs citro3d, so
+// host tools produce exactly the bytes the client would upload.
+
+static const uint8_t morton_order[] = {
+     0,  1,  4,  5,  16, 17, 20, 21,
+     2,  3,  6,  7,  18, 19, 22, 23,
+     8,  9, 12, 13,  24, 25, 28, 29,
+    10, 11, 14, 15,  26, 27, 30, 31,
+    32, 33, 36, 37,  48, 49, 52, 53,
+    34, 35, 38, 39,  50, 51, 54, 55,
+    40, 41, 44, 45,  56, 57, 60, 61,
+    42, 43, 46, 47,  58, 59, 62, 63
+};
+
+// Same values as citro3d's GPU_TEXCOLOR
+enum class GPUFormat : uint8_t
+{
+    RGBA8 = 0x0,
+    RGB8 = 0x1,
+    RGBA5551 = 0x2,
+    RGB565 = 0x3,
+    RGBA4 = 0x4,
+    LA8 = 0x5,
+    HILO8 = 0x6,
+    L8 = 0x7,
+    A8 = 0x8,
+    LA4 = 0x9,
+    L4 = 0xA,
+    A4 = 0xB,
+    ETC1 = 0xC,
+    ETC1A4 = 0xD
+};
+
+const uint16_t MAX_TEXTURE_SIZE = 1024;
+
+// A texel of Format as the little endian word the GPU reads, A in the
+// lowest bits. Channels are rounded to the nearest level.
+template <GPUFormat Format>
+constexpr uint32_t packTexel(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    // value * max / 255 rounded, without the divide
+    auto scale = [](uint32_t value, uint32_t max)
+    {
+        uint32_t scaled = value * max + 128;
+        return (scaled + (scaled >> 8)) >> 8;
+    };
+    if constexpr (Format == GPUFormat::RGBA8)
+        return (uint32_t(r) << 24) | (uint32_t(g) << 16) | (uint32_t(b) << 8) | a;
+    else if constexpr (Format == GPUFormat::RGBA5551)
+        return (scale(r, 31) << 11) | (scale(g, 31) << 6) | (scale(b, 31) << 1) | (a >> 7);
+    else if constexpr (Format == GPUFormat::RGB565)
+        return (scale(r, 31) << 11) | (scale(g, 63) << 5) | scale(b, 31);
+    else
+    {
+        static_assert(Format == GPUFormat::RGBA4, "No packing for this format");
+        return (scale(r, 15) << 12) | (scale(g, 15) << 8) | (scale(b, 15) << 4) | scale(a, 15);
+    }
+}
+
+class TexturePalette;
+
+// Reference version, texel by texel through a scratch copy. swizzleTexture
+// gives the same bytes and is what the client uses.
+void reverse_morton_order(uint8_t* buffer, int width, int height, int bytesPerPixel);
+// Tiles a top down width x height image from src into dest (which may be
+// the upload buffer itself), reversing the bytes of every texel. Sides
+// must be multiples of 8, src and dest must not overlap.
+void swizzleTexture(uint8_t* dest, const uint8_t* src, int width, int height, int bytesPerPixel);
+unsigned int nextPowerOf2(unsigned int n);
+uint8_t* padImage(const uint8_t* imageData, uint16_t inputWidth, uint16_t inputHeight, uint8_t bpp,
+                                            uint16_t targetWidth, uint16_t targetHeight, uint8_t pad = 0);
+
+uint8_t gpuBitsPerPixel(GPUFormat format);
+// Smallest texture side that holds size texels, the GPU wants a power of
+// two and at least one 8x8 tile
+uint16_t textureSize(uint16_t size);
+
+// A decoded FOX5 image as GPU_RGBA8 texels, padded out to
+// texWidth x texHeight and tiled. 8-bit images go through fox5palette.
+std::vector<uint8_t> fox5TextureData(const FOX5Image& image, uint16_t texWidth, uint16_t texHeight);
+// The same in one pass straight into dest, such as a texture's own buffer
+void fox5TextureData(const FOX5Image& image, uint8_t* dest, uint16_t texWidth, uint16_t texHeight);
+// An 8-bit image expanded through palette, in the palette's format
+void fox5TextureData(const FOX5Image& image, uint8_t* dest, uint16_t texWidth, uint16_t texHeight,
+                     const TexturePalette& palette);
+// The same in format, one of RGBA8, RGBA5551, RGB565 or RGBA4. 8-bit
+// images go through the standard palette for it.
+void fox5TextureData(const FOX5Image& image, uint8_t* dest, uint16_t texWidth, uint16_t texHeight, GPUFormat format);
+// Writes image into a tile aligned cell of an existing texture, the same
+// texels fox5TextureData would put there. x, y is the cell's top left in
+// image space and the rest of the cell is filled with pad. The texture is
+// in palette's format, GPU_RGBA8 through fox5palette when it's null.
+void writeTiledRect(uint8_t* texture, uint16_t texWidth, uint16_t texHeight, uint16_t x, uint16_t y,
+                    uint16_t cellWidth, uint16_t cellHeight, const FOX5Image& image, uint8_t pad = 0,
+                    const TexturePalette* palette = nullptr);
+
+// What an image needs from its texture format
+struct TextureAnalysis
+{
+    enum class Alpha : uint8_t
+    {
+        OPAQUE,
+        BINARY, // Only fully transparent or fully opaque
+        SMOOTH
+    };
+    Alpha mAlpha = Alpha::OPAQUE;
+    bool mAlpha4 = true; // Every alpha level is exact in 4 bits
+    uint32_t mColors = 0; // Distinct visible colors, 0 if the alpha rules out 16 bits
+    uint32_t mColors16 = 0; // Of those, still distinct in format16()
+    
+    // The 16-bit format the alpha fits, RGBA8 if none does
+    GPUFormat format16() const;
+};
+
+TextureAnalysis analyzeTexture(const FOX5Image& image);
+// format16() where that keeps every color distinct, RGBA8 otherwise
+GPUFormat selectTextureFormat(const TextureAnalysis& analysis);
+
+// Which format each image of a file is converted to: its override, else
+// mDefault, else selectTextureFormat
+struct TextureFormatPolicy
+{
+    std::optional<GPUFormat> mDefault;
+    std::unordered_map<uint32_t, GPUFormat> mOverrides; // By image ID
+    
+    GPUFormat choose(uint32_t id, const FOX5Image& image) const;
+};
+
+// "rgba8", "rgba5551", "rgb565" or "rgba4"
+GPUFormat parseGPUFormat(const std::string& name);
+const char* gpuFormatName(GPUFormat format);
+
+#endif // TEXTURELAYOUT_H
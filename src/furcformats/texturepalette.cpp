@@ -0,0 +1,119 @@
+#include "texturepalette.h"
+#include <stdexcept>
+#include "fox5palette.h"
+
+namespace
+{
+    // Four lookups to one store, the tables are too small to be worth a
+    // gather even where there is one
+    template <int BPT>
+    void expandTexels(uint8_t* dest, const uint8_t* indices, size_t count, const uint8_t (*texels)[4])
+    {
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4)
+        {
+            uint8_t block[4 * BPT];
+            std::memcpy(block, texels[indices[i]], BPT);
+            std::memcpy(block + BPT, texels[indices[i + 1]], BPT);
+            std::memcpy(block + 2 * BPT, texels[indices[i + 2]], BPT);
+            std::memcpy(block + 3 * BPT, texels[indices[i + 3]], BPT);
+            std::memcpy(dest + i * BPT, block, sizeof(block));
+        }
+        for(; i < count; i++)
+            std::memcpy(dest + i * BPT, texels[indices[i]], BPT);
+    }
+}
+
+TexturePalette::TexturePalette(GPUFormat format) : TexturePalette(format, fox5palette)
+{
+}
+
+TexturePalette::TexturePalette(GPUFormat format, const uint8_t colors[256][3]) : mFormat(format)
+{
+    if(format != GPUFormat::RGBA8 && format != GPUFormat::RGBA5551 && format != GPUFormat::RGB565
+       && format != GPUFormat::RGBA4)
+        throw std::invalid_argument("Palettes expand to RGBA8, RGBA5551, RGB565 or RGBA4 only.");
+    mBytesPerTexel = gpuBitsPerPixel(format) / 8;
+    std::memcpy(mColors, colors, sizeof(mColors));
+    buildTexels();
+}
+
+const TexturePalette& TexturePalette::standard(GPUFormat format)
+{
+    static const TexturePalette rgba8(GPUFormat::RGBA8);
+    static const TexturePalette rgba5551(GPUFormat::RGBA5551);
+    static const TexturePalette rgb565(GPUFormat::RGB565);
+    static const TexturePalette rgba4(GPUFormat::RGBA4);
+    switch(format)
+    {
+        case GPUFormat::RGBA8:
+            return rgba8;
+        case GPUFormat::RGBA5551:
+            return rgba5551;
+        case GPUFormat::RGB565:
+            return rgb565;
+        case GPUFormat::RGBA4:
+            return rgba4;
+        default:
+            throw std::invalid_argument("Palettes expand to RGBA8, RGBA5551, RGB565 or RGBA4 only.");
+    }
+}
+
+TexturePalette TexturePalette::remapped(const uint8_t map[256]) const
+{
+    TexturePalette result = *this;
+    for(int index = 0; index < 256; index++)
+        std::memcpy(result.mColors[index], mColors[map[index]], 3);
+    result.buildTexels();
+    return result;
+}
+
+TexturePalette TexturePalette::recolored(uint8_t first, const uint8_t colors[][3], size_t count) const
+{
+    if(first + count > 256)
+        throw std::invalid_argument("Recolor runs past the end of the palette.");
+    TexturePalette result = *this;
+    std::memcpy(result.mColors[first], colors, count * 3);
+    result.buildTexels();
+    return result;
+}
+
+void TexturePalette::expand(uint8_t* dest, const uint8_t* indices, size_t count) const
+{
+    if(mBytesPerTexel == 4)
+        expandTexels<4>(dest, indices, count, mTexels);
+    else
+        expandTexels<2>(dest, indices, count, mTexels);
+}
+
+void TexturePalette::buildTexels()
+{
+    for(int index = 0; index < 256; index++)
+    {
+        uint8_t r = mColors[index][0];
+        uint8_t g = mColors[index][1];
+        uint8_t b = mColors[index][2];
+        uint8_t a = index == 0 ? 0x00 : 0xFF;
+        uint8_t* texel = mTexels[index];
+        
+        uint32_t value;
+        switch(mFormat)
+        {
+            case GPUFormat::RGBA8:
+                value = packTexel<GPUFormat::RGBA8>(r, g, b, a);
+                break;
+            case GPUFormat::RGBA5551:
+                value = packTexel<GPUFormat::RGBA5551>(r, g, b, a);
+                break;
+            case GPUFormat::RGB565:
+                value = packTexel<GPUFormat::RGB565>(r, g, b, a);
+                break;
+            default:
+                value = packTexel<GPUFormat::RGBA4>(r, g, b, a);
+                break;
+        }
+        
+        for(int i = 0; i < 4; i++)
+            texel[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
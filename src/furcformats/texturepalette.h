@@ -0,0 +1,45 @@
+#ifndef TEXTUREPALETTE_H
+#define TEXTUREPALETTE_H
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "texturelayout.h"
+
+// The 256 colors of an 8-bit FOX5 image as ready made GPU texels, index 0
+// being transparent. Remapped sprites keep their decoded indices and only
+// swap the palette they're expanded through.
+class TexturePalette
+{
+public:
+    // fox5palette in format, one of RGBA8, RGBA5551, RGB565 or RGBA4. RGB565
+    // has no alpha, index 0 comes out black.
+    explicit TexturePalette(GPUFormat format = GPUFormat::RGBA8);
+    TexturePalette(GPUFormat format, const uint8_t colors[256][3]);
+    
+    // Shared, immutable fox5palette tables
+    static const TexturePalette& standard(GPUFormat format);
+    
+    // A copy where index i shows the color of index map[i], which is how
+    // Furcadia color codes recolor the remap ranges
+    TexturePalette remapped(const uint8_t map[256]) const;
+    // A copy with entries first.. set to colors
+    TexturePalette recolored(uint8_t first, const uint8_t colors[][3], size_t count) const;
+    
+    GPUFormat format() const { return mFormat; };
+    uint8_t bytesPerTexel() const { return mBytesPerTexel; };
+    const uint8_t* texel(uint8_t index) const { return mTexels[index]; };
+    const uint8_t* color(uint8_t index) const { return mColors[index]; };
+    
+    // count indices to count texels, top down and untiled
+    void expand(uint8_t* dest, const uint8_t* indices, size_t count) const;
+    
+protected:
+    GPUFormat mFormat;
+    uint8_t mBytesPerTexel;
+    uint8_t mColors[256][3];
+    uint8_t mTexels[256][4]; // GPU byte order, bytesPerTexel of them used
+    
+    void buildTexels();
+};
+
+#endif // TEXTUREPALETTE_H
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "dreamfile.h"
+#include "fox5.h"
+#include "indexer.h"
+
+namespace
+{
+    std::string lowercaseExtension(const std::filesystem::path& file)
+    {
+        std::string extension = file.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        return extension;
+    }
+
+    void indexDream(IndexEntry& entry, const std::filesystem::path& file)
+    {
+        Dream dream(file.string(), Dream::ParseMode::HEADER);
+        entry.mType = IndexEntry::Type::DREAM;
+        entry.mVersionMajor = dream.mVersionMajor;
+        entry.mVersionMinor = dream.mVersionMinor;
+        entry.mWidth = dream.mWidth;
+        entry.mHeight = dream.mHeight;
+        entry.mRevision = dream.mRevision;
+        entry.mName = dream.mName;
+        entry.mPatchs = dream.mPatchs;
+        entry.mRating = dream.mRating;
+        entry.mSwearFilter = dream.mSwearFilter;
+        
+        const std::pair<bool, uint32_t> flags[] = {
+            {dream.mEncoded, DREAM_ENCODED},
+            {dream.mPatcht, DREAM_PATCHT},
+            {dream.mNoLoad, DREAM_NOLOAD},
+            {dream.mAllowJS, DREAM_ALLOWJS},
+            {dream.mAllowLF, DREAM_ALLOWLF},
+            {dream.mAllowFURL, DREAM_ALLOWFURL},
+            {dream.mAllowShouts, DREAM_ALLOWSHOUTS},
+            {dream.mAllowLarge, DREAM_ALLOWLARGE},
+            {dream.mNoWho, DREAM_NOWHO},
+            {dream.mForceSittable, DREAM_FORCESITTABLE},
+            {dream.mNoTab, DREAM_NOTAB},
+            {dream.mNoNovelty, DREAM_NONOVELTY},
+            {dream.mAllow32BitArt, DREAM_ALLOW32BITART},
+            {dream.mIsModern, DREAM_ISMODERN},
+            {dream.mParentalControls, DREAM_PARENTALCONTROLS}
+        };
+        for(auto& flag : flags)
+        {
+            if(flag.first)
+                entry.mDreamFlags |= flag.second;
+        }
+    }
+
+    void indexFox5(IndexEntry& entry, const std::filesystem::path& file)
+    {
+        FOX5 fox(file.string(), FOX5::LoadMode::MAPPED, FOX5::ParseMode::OBJECTS);
+        entry.mType = IndexEntry::Type::FOX5;
+        entry.mImageCount = static_cast<uint32_t>(fox.imageCount());
+        entry.mObjects.resize(fox.objectCount());
+        for(size_t i = 0; i < fox.objectCount(); i++)
+        {
+            FOX5Object& object = fox.object(static_cast<uint32_t>(i));
+            entry.mObjects[i].mObjectID = object.mObjectID;
+            entry.mObjects[i].mName = std::move(object.mName);
+            entry.mObjects[i].mKeywords = std::move(object.mKeywords);
+        }
+    }
+}
+
+std::vector<std::filesystem::path> findIndexableFiles(const std::filesystem::path& root)
+{
+    std::vector<std::filesystem::path> files;
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for(auto& item : std::filesystem::recursive_directory_iterator(root, options))
+    {
+        if(!item.is_regular_file())
+            continue;
+        std::string extension = lowercaseExtension(item.path());
+        if(extension == ".map" || extension == ".fox")
+            files.push_back(item.path());
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+IndexEntry indexFile(const std::filesystem::path& root, const std::filesystem::path& file)
+{
+    IndexEntry entry;
+    entry.mPath = file.lexically_relative(root).generic_string();
+    
+    try
+    {
+        entry.mFileSize = std::filesystem::file_size(file);
+        entry.mModified = static_cast<int64_t>(std::filesystem::last_write_time(file).time_since_epoch().count());
+        
+        if(lowercaseExtension(file) == ".map")
+            indexDream(entry, file);
+        else
+            indexFox5(entry, file);
+    }
+    catch(const std::exception& e)
+    {
+        entry.mType = IndexEntry::Type::FAILED;
+        entry.mError = e.what();
+    }
+    return entry;
+}
+
+std::vector<IndexEntry> indexFiles(const std::filesystem::path& root,
+                                   const std::vector<std::filesystem::path>& files,
+                                   unsigned threadCount)
+{
+    std::vector<IndexEntry> entries(files.size());
+    
+    if(threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    threadCount = std::max<size_t>(1, std::min<size_t>(threadCount, files.size()));
+    
+    // Failures are caught per file, so workers never throw
+    std::atomic<size_t> next{0};
+    auto worker = [&]()
+    {
+        for(size_t i = next++; i < files.size(); i = next++)
+            entries[i] = indexFile(root, files[i]);
+    };
+    
+    std::vector<std::thread> threads;
+    for(unsigned i = 1; i < threadCount; i++)
+        threads.emplace_back(worker);
+    worker();
+    for(auto& thread : threads)
+        thread.join();
+    return entries;
+}
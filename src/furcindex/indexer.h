@@ -0,0 +1,77 @@
+#ifndef INDEXER_H
+#define INDEXER_H
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Dream header switches, packed into IndexEntry::mDreamFlags
+enum DreamIndexFlags : uint32_t
+{
+    DREAM_ENCODED = 1 << 0,
+    DREAM_PATCHT = 1 << 1,
+    DREAM_NOLOAD = 1 << 2,
+    DREAM_ALLOWJS = 1 << 3,
+    DREAM_ALLOWLF = 1 << 4,
+    DREAM_ALLOWFURL = 1 << 5,
+    DREAM_ALLOWSHOUTS = 1 << 6,
+    DREAM_ALLOWLARGE = 1 << 7,
+    DREAM_NOWHO = 1 << 8,
+    DREAM_FORCESITTABLE = 1 << 9,
+    DREAM_NOTAB = 1 << 10,
+    DREAM_NONOVELTY = 1 << 11,
+    DREAM_ALLOW32BITART = 1 << 12,
+    DREAM_ISMODERN = 1 << 13,
+    DREAM_PARENTALCONTROLS = 1 << 14
+};
+
+struct IndexedObject
+{
+    int32_t mObjectID = 0;
+    std::string mName;
+    std::vector<std::string> mKeywords;
+};
+
+struct IndexEntry
+{
+    enum class Type : uint8_t
+    {
+        DREAM = 0,
+        FOX5 = 1,
+        FAILED = 2 // mError says why
+    };
+    Type mType = Type::FAILED;
+    std::string mPath; // Relative to the scanned folder
+    uint64_t mFileSize = 0;
+    int64_t mModified = 0;
+    std::string mError;
+    
+    // Dream
+    uint8_t mVersionMajor = 0;
+    uint8_t mVersionMinor = 0;
+    uint16_t mWidth = 0;
+    uint16_t mHeight = 0;
+    uint32_t mRevision = 0;
+    std::string mName;
+    std::string mPatchs;
+    std::string mRating;
+    uint32_t mDreamFlags = 0;
+    uint8_t mSwearFilter = 0;
+    
+    // FOX5
+    uint32_t mImageCount = 0;
+    std::vector<IndexedObject> mObjects;
+};
+
+// Every .map and .fox below root, sorted so the index comes out the same
+// on every run
+std::vector<std::filesystem::path> findIndexableFiles(const std::filesystem::path& root);
+
+// Reads headers and object metadata only. Files that fail to parse come
+// back as FAILED entries instead of stopping the run.
+IndexEntry indexFile(const std::filesystem::path& root, const std::filesystem::path& file);
+std::vector<IndexEntry> indexFiles(const std::filesystem::path& root,
+                                   const std::vector<std::filesystem::path>& files,
+                                   unsigned threadCount = 0);
+
+#endif // INDEXER_H
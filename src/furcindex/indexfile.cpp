@@ -0,0 +1,235 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include "bytereader.h"
+#include "filecommon.h"
+#include "indexfile.h"
+
+namespace
+{
+    class IndexWriter
+    {
+    public:
+        std::vector<uint8_t> mData;
+
+        void putByte(uint8_t value)
+        {
+            mData.push_back(value);
+        };
+
+        void putVarint(uint64_t value)
+        {
+            while(value >= 0x80)
+            {
+                mData.push_back(static_cast<uint8_t>(value) | 0x80);
+                value >>= 7;
+            }
+            mData.push_back(static_cast<uint8_t>(value));
+        };
+
+        void putSigned(int64_t value)
+        {
+            putVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+        };
+    };
+
+    // Varints are read a byte at a time, so the byte order doesn't matter
+    class IndexReader : public LittleEndianReader
+    {
+    public:
+        using LittleEndianReader::LittleEndianReader;
+
+        uint8_t getByte()
+        {
+            return get<uint8_t>();
+        };
+
+        uint64_t getVarint()
+        {
+            uint64_t value = 0;
+            for(int shift = 0; shift < 64; shift += 7)
+            {
+                uint8_t byte = getByte();
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if(!(byte & 0x80))
+                    return value;
+            }
+            throw std::runtime_error("Bad varint in index.");
+        };
+
+        int64_t getSigned()
+        {
+            uint64_t value = getVarint();
+            return static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+        };
+    };
+
+    // Hands out table positions, first use first
+    class StringTable
+    {
+    public:
+        std::unordered_map<std::string, uint32_t> mIDs;
+        std::vector<const std::string*> mStrings;
+
+        uint32_t add(const std::string& value)
+        {
+            auto result = mIDs.emplace(value, static_cast<uint32_t>(mStrings.size()));
+            if(result.second)
+                mStrings.push_back(&result.first->first);
+            return result.first->second;
+        };
+    };
+}
+
+size_t writeIndex(const std::string& filename, const std::vector<IndexEntry>& entries)
+{
+    StringTable strings;
+    IndexWriter body;
+    body.putVarint(entries.size());
+    for(auto& entry : entries)
+    {
+        body.putByte(static_cast<uint8_t>(entry.mType));
+        body.putVarint(strings.add(entry.mPath));
+        body.putVarint(entry.mFileSize);
+        body.putSigned(entry.mModified);
+        
+        switch(entry.mType)
+        {
+            case IndexEntry::Type::DREAM:
+                body.putByte(entry.mVersionMajor);
+                body.putByte(entry.mVersionMinor);
+                body.putVarint(entry.mWidth);
+                body.putVarint(entry.mHeight);
+                body.putVarint(entry.mRevision);
+                body.putVarint(strings.add(entry.mName));
+                body.putVarint(strings.add(entry.mPatchs));
+                body.putVarint(strings.add(entry.mRating));
+                body.putVarint(entry.mDreamFlags);
+                body.putByte(entry.mSwearFilter);
+                break;
+            
+            case IndexEntry::Type::FOX5:
+                body.putVarint(entry.mImageCount);
+                body.putVarint(entry.mObjects.size());
+                for(auto& object : entry.mObjects)
+                {
+                    body.putSigned(object.mObjectID);
+                    body.putVarint(strings.add(object.mName));
+                    body.putVarint(object.mKeywords.size());
+                    for(auto& keyword : object.mKeywords)
+                        body.putVarint(strings.add(keyword));
+                }
+                break;
+            
+            case IndexEntry::Type::FAILED:
+                body.putVarint(strings.add(entry.mError));
+                break;
+        }
+    }
+    
+    IndexWriter head;
+    head.mData = {'F', 'I', 'D', 'X'};
+    head.putVarint(INDEX_FILE_VERSION);
+    head.putVarint(strings.mStrings.size());
+    for(const std::string* value : strings.mStrings)
+    {
+        head.putVarint(value->size());
+        head.mData.insert(head.mData.end(), value->begin(), value->end());
+    }
+    
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file || !file.is_open())
+        throw std::runtime_error("Failed to open " + filename + " for writing.");
+    file.write(reinterpret_cast<const char*>(head.mData.data()), head.mData.size());
+    file.write(reinterpret_cast<const char*>(body.mData.data()), body.mData.size());
+    if (!file)
+        throw std::runtime_error("Failed to write " + filename + ".");
+    return head.mData.size() + body.mData.size();
+}
+
+std::vector<IndexEntry> readIndex(const std::string& filename)
+{
+    MappedFile file(filename);
+    IndexReader reader(file.data(), file.size());
+    
+    if(file.size() < 4 || std::memcmp(file.data(), "FIDX", 4) != 0)
+        throw std::runtime_error("Not an index file.");
+    reader.skip(4);
+    if(reader.getVarint() != INDEX_FILE_VERSION)
+        throw std::runtime_error("Unsupported index version.");
+    
+    uint64_t stringCount = reader.getVarint();
+    if(stringCount > file.size())
+        throw std::runtime_error("Bad string count in index.");
+    std::vector<std::string> strings(stringCount);
+    for(auto& value : strings)
+    {
+        uint64_t size = reader.getVarint();
+        value = reader.getString(size);
+    }
+    auto getString = [&]() -> const std::string&
+    {
+        uint64_t id = reader.getVarint();
+        if(id >= strings.size())
+            throw std::runtime_error("Bad string reference in index.");
+        return strings[id];
+    };
+    
+    uint64_t entryCount = reader.getVarint();
+    if(entryCount > file.size())
+        throw std::runtime_error("Bad entry count in index.");
+    std::vector<IndexEntry> entries(entryCount);
+    for(auto& entry : entries)
+    {
+        entry.mType = static_cast<IndexEntry::Type>(reader.getByte());
+        entry.mPath = getString();
+        entry.mFileSize = reader.getVarint();
+        entry.mModified = reader.getSigned();
+        
+        switch(entry.mType)
+        {
+            case IndexEntry::Type::DREAM:
+                entry.mVersionMajor = reader.getByte();
+                entry.mVersionMinor = reader.getByte();
+                entry.mWidth = static_cast<uint16_t>(reader.getVarint());
+                entry.mHeight = static_cast<uint16_t>(reader.getVarint());
+                entry.mRevision = static_cast<uint32_t>(reader.getVarint());
+                entry.mName = getString();
+                entry.mPatchs = getString();
+                entry.mRating = getString();
+                entry.mDreamFlags = static_cast<uint32_t>(reader.getVarint());
+                entry.mSwearFilter = reader.getByte();
+                break;
+            
+            case IndexEntry::Type::FOX5:
+            {
+                entry.mImageCount = static_cast<uint32_t>(reader.getVarint());
+                uint64_t objectCount = reader.getVarint();
+                if(objectCount > file.size())
+                    throw std::runtime_error("Bad object count in index.");
+                entry.mObjects.resize(objectCount);
+                for(auto& object : entry.mObjects)
+                {
+                    object.mObjectID = static_cast<int32_t>(reader.getSigned());
+                    object.mName = getString();
+                    uint64_t keywordCount = reader.getVarint();
+                    if(keywordCount > file.size())
+                        throw std::runtime_error("Bad keyword count in index.");
+                    object.mKeywords.reserve(keywordCount);
+                    for(uint64_t i = 0; i < keywordCount; i++)
+                        object.mKeywords.push_back(getString());
+                }
+                break;
+            }
+            
+            case IndexEntry::Type::FAILED:
+                entry.mError = getString();
+                break;
+            
+            default:
+                throw std::runtime_error("Unknown entry type in index.");
+        }
+    }
+    return entries;
+}
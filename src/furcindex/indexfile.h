@@ -0,0 +1,17 @@
+#ifndef INDEXFILE_H
+#define INDEXFILE_H
+#include <string>
+#include <vector>
+#include "indexer.h"
+
+// Index files start with "FIDX" and a version, then a table of every
+// distinct string followed by the entries. Numbers are LEB128 varints
+// (signed ones zigzagged) and strings are stored once and referred to by
+// their position in the table, so repeated keywords cost a byte or two.
+#define INDEX_FILE_VERSION 1
+
+// Returns the size of the index in bytes
+size_t writeIndex(const std::string& filename, const std::vector<IndexEntry>& entries);
+std::vector<IndexEntry> readIndex(const std::string& filename);
+
+#endif // INDEXFILE_H
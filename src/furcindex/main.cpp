@@ -0,0 +1,92 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "indexer.h"
+#include "indexfile.h"
+
+static void printUsage()
+{
+    fprintf(stderr,
+            "Usage: furcindex [-j threads] <folder> <index file>\n"
+            "       furcindex --dump <index file>\n");
+}
+
+static void dumpIndex(const std::string& filename)
+{
+    for(auto& entry : readIndex(filename))
+    {
+        switch(entry.mType)
+        {
+            case IndexEntry::Type::DREAM:
+                printf("map  %s  V%02u.%02u %ux%u rev %u \"%s\" rating \"%s\" flags %#x\n",
+                       entry.mPath.c_str(), entry.mVersionMajor, entry.mVersionMinor,
+                       entry.mWidth, entry.mHeight, entry.mRevision,
+                       entry.mName.c_str(), entry.mRating.c_str(), entry.mDreamFlags);
+                break;
+            
+            case IndexEntry::Type::FOX5:
+                printf("fox  %s  %u images, %zu objects\n",
+                       entry.mPath.c_str(), entry.mImageCount, entry.mObjects.size());
+                for(auto& object : entry.mObjects)
+                {
+                    printf("       %d \"%s\"", object.mObjectID, object.mName.c_str());
+                    for(auto& keyword : object.mKeywords)
+                        printf(" #%s", keyword.c_str());
+                    printf("\n");
+                }
+                break;
+            
+            case IndexEntry::Type::FAILED:
+                printf("fail %s  %s\n", entry.mPath.c_str(), entry.mError.c_str());
+                break;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        if(argc == 3 && strcmp(argv[1], "--dump") == 0)
+        {
+            dumpIndex(argv[2]);
+            return 0;
+        }
+        
+        unsigned threads = 0;
+        int arg = 1;
+        if(argc > 2 && strcmp(argv[1], "-j") == 0)
+        {
+            threads = static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10));
+            arg += 2;
+        }
+        if(argc - arg != 2)
+        {
+            printUsage();
+            return 2;
+        }
+        std::filesystem::path root = argv[arg];
+        std::string output = argv[arg + 1];
+        
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::filesystem::path> files = findIndexableFiles(root);
+        std::vector<IndexEntry> entries = indexFiles(root, files, threads);
+        size_t indexSize = writeIndex(output, entries);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        
+        size_t counts[3] = {0, 0, 0};
+        for(auto& entry : entries)
+            counts[static_cast<size_t>(entry.mType)]++;
+        printf("Indexed %zu files (%zu maps, %zu fox, %zu failed) in %.3f s, %.0f files/s, %zu byte index\n",
+               entries.size(), counts[0], counts[1], counts[2], seconds,
+               seconds > 0 ? entries.size() / seconds : 0.0, indexSize);
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "furcindex failed: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
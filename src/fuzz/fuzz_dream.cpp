@@ -0,0 +1,30 @@
+#include <cstdint>
+#include <cstddef>
+#include <exception>
+#include "dreamfile.h"
+
+// Anything may be rejected with an exception, but a map that loads must
+// be safe to read back everywhere
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    try
+    {
+        Dream header(data, size, Dream::ParseMode::HEADER);
+        Dream dream(data, size);
+
+        uint64_t sum = 0;
+        for(uint16_t x = 0; x < dream.mWidth; x += 7)
+            for(uint16_t y = 0; y < dream.mHeight; y += 7)
+                sum += dream.get(x, y).mFloor;
+        dream.forEachTileInView(-100, -100, 400, 240, [&](uint16_t x, uint16_t y, size_t index)
+        {
+            sum += dream.mObjects[index];
+        });
+        if(dream.mWidth && dream.mHeight)
+            dream.fill(DreamLayer::FLOOR, 0, 0, 20, 20, static_cast<uint16_t>(sum));
+    }
+    catch(const std::exception&)
+    {
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <cstdint>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "fox5.h"
+
+namespace
+{
+    // Images bigger than this aren't decoded, a fuzzed header can ask for 16 GiB
+    const uint32_t MAX_IMAGE_SIZE = 16 * 1024 * 1024;
+
+    const std::string& scratchFile()
+    {
+        static const std::string path = (std::filesystem::temp_directory_path()
+                                         / ("fuzz_fox5_" + std::to_string(getpid()) + ".fox")).string();
+        return path;
+    }
+
+    // Most inputs would die on the footer check, so the first byte picks
+    // between the input as a whole file and the input as a raw command
+    // block behind a valid uncompressed footer
+    std::vector<uint8_t> makeFile(const uint8_t* data, size_t size)
+    {
+        if(size == 0 || data[0] & 1)
+            return std::vector<uint8_t>(data, data + size);
+
+        std::vector<uint8_t> file(data + 1, data + size);
+        uint32_t blockSize = static_cast<uint32_t>(file.size());
+        const uint8_t footer[] = {
+            0, 0, 0, 0,
+            uint8_t(blockSize >> 24), uint8_t(blockSize >> 16), uint8_t(blockSize >> 8), uint8_t(blockSize),
+            uint8_t(blockSize >> 24), uint8_t(blockSize >> 16), uint8_t(blockSize >> 8), uint8_t(blockSize),
+            'F', 'O', 'X', '5', '.', '1', '.', '1'
+        };
+        file.insert(file.end(), footer, footer + sizeof(footer));
+        return file;
+    }
+
+    void walk(FOX5& fox)
+    {
+        for(uint32_t i = 0; i < fox.objectCount(); i++)
+        {
+            FOX5Object& object = fox.object(i);
+            for(auto& shape : fox.shapes(object))
+                for(auto& frame : fox.frames(shape))
+                    for(auto& channel : fox.channels(frame))
+                        (void)channel.mImageID;
+        }
+        for(uint32_t i = 0; i < fox.imageCount(); i++)
+        {
+            if(fox.imageInfo(i).mMemSize > MAX_IMAGE_SIZE)
+                continue;
+            try
+            {
+                fox.getImage(i);
+            }
+            catch(const std::exception&)
+            {
+            }
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    std::vector<uint8_t> file = makeFile(data, size);
+    if(size > 0 && !(data[0] & 1))
+    {
+        try
+        {
+            FOX5Command::validate(std::span<const uint8_t>(data + 1, size - 1));
+        }
+        catch(const std::exception&)
+        {
+        }
+    }
+    {
+        std::ofstream out(scratchFile(), std::ios::out | std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(file.data()), file.size());
+    }
+
+    for(auto parseMode : {FOX5::ParseMode::EAGER, FOX5::ParseMode::LAZY, FOX5::ParseMode::OBJECTS})
+    {
+        try
+        {
+            FOX5 fox(scratchFile(), FOX5::LoadMode::MAPPED, parseMode);
+            walk(fox);
+        }
+        catch(const std::exception&)
+        {
+        }
+    }
+    return 0;
+}
@@ -3,90 +3,6 @@
 #include <vector>
 #include <cstring>
 
-void reverse_morton_order(uint8_t* buffer, int width, int height, int bytesPerPixel)
-{
-    if (width % 8 != 0 || height % 8 != 0) {
-        throw std::invalid_argument("Width and height must be multiples of 8.");
-    }
-
-    int tilesX = width / 8;
-    int tilesY = height / 8;
-
-    // Create a temporary buffer to hold the transformed data
-    std::vector<uint8_t> swizzled(width * height * bytesPerPixel);
-
-    // Iterate over each 8x8 tile
-    for (int tileX = 0; tileX < tilesX; ++tileX) {
-        int pixelX = tileX * 8;
-
-        for (int tileY = 0; tileY < tilesY; ++tileY) {
-            int pixelY = tileY * 8;
-
-            // Calculate the tile number
-            int tileNum = tileX + tileY * tilesX;
-
-            // Reorder the pixels within this tile
-            for (int i = 0; i < 64; ++i) {
-                int srcX = pixelX + (i % 8);
-                int srcY = height - (pixelY + (i / 8)) - 1; // Flip along the y-axis
-
-                int srcIdx = (srcY * width + srcX) * bytesPerPixel;
-                int destIdx = (tileNum * 64 + morton_order[i]) * bytesPerPixel;
-
-                // Copy pixel data and optionally reverse byte order
-                for (int j = 0; j < bytesPerPixel; ++j) {
-                    swizzled[destIdx + j] = buffer[srcIdx + bytesPerPixel - j - 1];
-                }
-            }
-        }
-    }
-
-    // Copy the transformed data back to the original buffer
-    std::memcpy(buffer, swizzled.data(), width * height * bytesPerPixel);
-}
-
-unsigned int nextPowerOf2(unsigned int n)
-{
-    if (n == 0) return 1; // Special case: 0 → 1
-    n--;                  // Decrement n to handle exact powers of 2
-    n |= n >> 1;
-    n |= n >> 2;
-    n |= n >> 4;
-    n |= n >> 8;
-    n |= n >> 16;         // Works up to 32-bit integers
-    return n + 1;         // Add 1 to get the next power of 2
-}
-
-uint8_t* padImage(const uint8_t* imageData, uint16_t inputWidth, uint16_t inputHeight, uint8_t bpp,
-                                            uint16_t targetWidth, uint16_t targetHeight, uint8_t pad)
-{
-    // Validate input dimensions
-    if (inputWidth > targetWidth || inputHeight > targetHeight) {
-        throw std::invalid_argument("Target dimensions must be greater than or equal to input dimensions.");
-    }
-    
-    // Calculate sizes
-    int inputRowBytes = inputWidth * bpp; // Bytes per row in input image
-    int targetRowBytes = targetWidth * bpp; // Bytes per row in padded image
-    int paddedImageSize = targetHeight * targetRowBytes;
-    
-    // Allocate buffer for the padded image
-    uint8_t* paddedImage = new uint8_t[paddedImageSize];
-
-    // Fill the entire buffer with the padding value
-    std::memset(paddedImage, pad, paddedImageSize);
-
-    // Copy the input image into the padded buffer row by row
-    for (uint16_t y = 0; y < inputHeight; ++y) {
-        const uint8_t* srcRow = imageData + y * inputRowBytes; // Source row in input image
-        uint8_t* destRow = paddedImage + y * targetRowBytes;  // Destination row in padded image
-        std::memcpy(destRow, srcRow, inputRowBytes);          // Copy the row
-    }
-
-    return paddedImage; // Caller must free this buffer when done
-}
-
-
 Texture::Texture(uint8_t* data, uint16_t width, uint16_t height, GPU_TEXCOLOR mode)
 {
     int bpp = 3;
@@ -118,74 +34,143 @@ Texture::Texture(uint8_t* data, uint16_t width, uint16_t height, GPU_TEXCOLOR mo
     
     uint8_t* pixelSrcData = padImage(data, width, height, bpp, mWidth, mHeight, 0);
 
-    reverse_morton_order(pixelSrcData, mWidth, mHeight, bpp);
+    // Tiled straight into the texture's linear memory
     C3D_TexInit(&mTexture, mWidth, mHeight, mode);
-    C3D_TexUpload(&mTexture, pixelSrcData);
+    swizzleTexture(static_cast<uint8_t*>(mTexture.data), pixelSrcData, mWidth, mHeight, bpp);
     C3D_TexFlush(&mTexture);
 
     delete[] pixelSrcData;
 }
 
-Texture::Texture(FOX5Image image)
+Texture::Texture(FOX5Image image, GPUFormat format)
 {
-    int bpp = 4;
-    GPU_TEXCOLOR mode = GPU_RGBA8;
     
     mOriginalWidth = image.mWidth;
     mOriginalHeight = image.mHeight;
     
-    mWidth = nextPowerOf2(image.mWidth);
-    mHeight = nextPowerOf2(image.mHeight);
+    mWidth = textureSize(image.mWidth);
+    mHeight = textureSize(image.mHeight);
     
     mClip[2] = (float)mOriginalWidth / (float)mWidth;
     mClip[3] = (float)mOriginalHeight / (float)mHeight;
     
-    uint8_t* pixelSrcData = padImage(image.mData.data(), mOriginalWidth, mOriginalHeight, bpp, mWidth, mHeight, 0xFF);
+    // Converted, padded and tiled in one pass into the texture's own
+    // linear memory, nothing in between
+    if(!C3D_TexInit(&mTexture, mWidth, mHeight, static_cast<GPU_TEXCOLOR>(format)))
+        throw std::runtime_error("Failed to allocate texture");
+    try
+    {
+        fox5TextureData(image, static_cast<uint8_t*>(mTexture.data), mWidth, mHeight, format);
+    }
+    catch(...)
+    {
+        // The destructor doesn't run for a constructor that throws
+        C3D_TexDelete(&mTexture);
+        throw;
+    }
+    C3D_TexFlush(&mTexture);
     
-    // Perform swizzling for RGBA8 mode
-    if (mode == GPU_RGBA8)
+    setFilter(GPU_NEAREST, GPU_NEAREST);
+    setWrap(GPU_CLAMP_TO_EDGE, GPU_CLAMP_TO_EDGE);
+}
+
+Texture::Texture(const FOX5Image& image, const TexturePalette& palette)
+{
+    mOriginalWidth = image.mWidth;
+    mOriginalHeight = image.mHeight;
+    
+    mWidth = textureSize(image.mWidth);
+    mHeight = textureSize(image.mHeight);
+    
+    mClip[2] = (float)mOriginalWidth / (float)mWidth;
+    mClip[3] = (float)mOriginalHeight / (float)mHeight;
+    
+    if(!C3D_TexInit(&mTexture, mWidth, mHeight, static_cast<GPU_TEXCOLOR>(palette.format())))
+        throw std::runtime_error("Failed to allocate texture");
+    try
     {
-        size_t dataSize = mWidth * mHeight * bpp;
-        for (size_t i = 0; i < dataSize; i += 4) // Assuming 4 bytes per pixel
-        {
-            // This can be simplified
-            uint8_t temp1 = pixelSrcData[i];
-            uint8_t temp2 = pixelSrcData[i+1];
-            uint8_t temp3 = pixelSrcData[i+2];
-            uint8_t temp4 = pixelSrcData[i+3];
-            pixelSrcData[i] = temp2;
-            pixelSrcData[i + 1] = temp3;
-            pixelSrcData[i + 2] = temp4;
-            pixelSrcData[i + 3] = temp1;
-        }
+        fox5TextureData(image, static_cast<uint8_t*>(mTexture.data), mWidth, mHeight, palette);
     }
+    catch(...)
+    {
+        C3D_TexDelete(&mTexture);
+        throw;
+    }
+    C3D_TexFlush(&mTexture);
     
-    reverse_morton_order(pixelSrcData, mWidth, mHeight, bpp);
-    C3D_TexInit(&mTexture, mWidth, mHeight, mode);
-    C3D_TexUpload(&mTexture, pixelSrcData);
+    setFilter(GPU_NEAREST, GPU_NEAREST);
+    setWrap(GPU_CLAMP_TO_EDGE, GPU_CLAMP_TO_EDGE);
+}
+
+Texture::Texture(FOX5Pack& pack, uint32_t id)
+{
+    const FOX5Pack::Image& image = pack.image(id);
+    
+    mOriginalWidth = image.mWidth;
+    mOriginalHeight = image.mHeight;
+    
+    mWidth = image.mTexWidth;
+    mHeight = image.mTexHeight;
+    
+    mClip[2] = (float)mOriginalWidth / (float)mWidth;
+    mClip[3] = (float)mOriginalHeight / (float)mHeight;
+    
+    if(!C3D_TexInit(&mTexture, mWidth, mHeight, static_cast<GPU_TEXCOLOR>(image.mFormat)))
+        throw std::runtime_error("Failed to allocate texture");
+    try
+    {
+        if(mTexture.size != image.mSize)
+            throw std::runtime_error("Packed image size doesn't match its texture");
+        
+        // No staging buffer, the texels go from the file into linear memory
+        pack.readImage(id, static_cast<uint8_t*>(mTexture.data));
+    }
+    catch(...)
+    {
+        C3D_TexDelete(&mTexture);
+        throw;
+    }
     C3D_TexFlush(&mTexture);
-    delete[] pixelSrcData;
     
     setFilter(GPU_NEAREST, GPU_NEAREST);
     setWrap(GPU_CLAMP_TO_EDGE, GPU_CLAMP_TO_EDGE);
 }
 
+Texture::Texture(std::shared_ptr<C3D_Tex> page, uint16_t pageSize, const float clip[4], uint16_t width, uint16_t height)
+    : mPage(page)
+{
+    mTexture = *page;
+    mWidth = pageSize;
+    mHeight = pageSize;
+    mOriginalWidth = width;
+    mOriginalHeight = height;
+    std::memcpy(mClip, clip, sizeof(mClip));
+}
+
+size_t Texture::memorySize() const
+{
+    if(mPage)
+        return 0;
+    return size_t(mWidth) * mHeight * gpuBitsPerPixel(static_cast<GPUFormat>(mTexture.fmt)) / 8;
+}
+
 Texture::~Texture()
 {
-    C3D_TexDelete(&mTexture);
+    if(!mPage)
+        C3D_TexDelete(&mTexture);
 }
 
 void Texture::setFilter(GPU_TEXTURE_FILTER_PARAM magFilter, GPU_TEXTURE_FILTER_PARAM minFilter)
 {
-    C3D_TexSetFilter(&mTexture, magFilter, minFilter);
+    C3D_TexSetFilter(mPage ? mPage.get() : &mTexture, magFilter, minFilter);
 }
 
 void Texture::setWrap(GPU_TEXTURE_WRAP_PARAM wrapS, GPU_TEXTURE_WRAP_PARAM wrapT)
 {
-    C3D_TexSetWrap(&mTexture, wrapS, wrapT);
+    C3D_TexSetWrap(mPage ? mPage.get() : &mTexture, wrapS, wrapT);
 }
 
 void Texture::bind(uint8_t unit)
 {
-    C3D_TexBind(unit, &mTexture);
+    C3D_TexBind(unit, mPage ? mPage.get() : &mTexture);
 }
@@ -16,6 +16,7 @@
 #include "testimg.h"
 #include "3dstexture.h"
 #include "3dsshader.h"
+#include "texturecache.h"
 #include "demoscene.h"
 
 void Furcadia::initialize()
@@ -109,6 +110,7 @@ void Furcadia::render()
         mRootScene->renderBottom();
     }
     C3D_FrameEnd(0);
+    TextureCache::instance().nextFrame();
     
     // printf("FPS %f; Update time: %f; Render time: %f\n", mFPS, mUpdateTime, mRenderTime);
 }
@@ -0,0 +1,110 @@
+#include "textureatlas.h"
+#include <cstring>
+#include <stdexcept>
+#include "texturelayout.h"
+
+TextureAtlas::TextureAtlas(uint16_t pageSize, uint32_t maxPages)
+    : mPacker(pageSize, maxPages)
+{
+}
+
+std::shared_ptr<C3D_Tex> TextureAtlas::page(uint32_t index)
+{
+    while(mPages.size() <= index)
+    {
+        std::shared_ptr<C3D_Tex> page(new C3D_Tex, [](C3D_Tex* texture)
+        {
+            C3D_TexDelete(texture);
+            delete texture;
+        });
+        if(!C3D_TexInit(page.get(), mPacker.pageSize(), mPacker.pageSize(), GPU_RGBA8))
+            throw std::runtime_error("Failed to allocate atlas page");
+        std::memset(page->data, 0, page->size);
+        C3D_TexSetFilter(page.get(), GPU_NEAREST, GPU_NEAREST);
+        C3D_TexSetWrap(page.get(), GPU_CLAMP_TO_EDGE, GPU_CLAMP_TO_EDGE);
+        mPages.push_back(page);
+    }
+    return mPages[index];
+}
+
+std::shared_ptr<Texture> TextureAtlas::getFromFox(FOX5& fox, uint32_t id)
+{
+    auto& entries = mEntries[fox.mFileName];
+    auto it = entries.find(id);
+    if(it != entries.end())
+    {
+        if(std::shared_ptr<Texture> texture = it->second.mTexture.lock())
+            return texture;
+        mPacker.remove(it->second.mPlacement);
+        entries.erase(it);
+    }
+    
+    FOX5ImageInfo info = fox.imageInfo(id);
+    std::optional<AtlasPacker::Placement> placement = mPacker.insert(info.mWidth, info.mHeight);
+    if(!placement && info.mWidth <= mPacker.pageSize() && info.mHeight <= mPacker.pageSize())
+    {
+        collect();
+        placement = mPacker.insert(info.mWidth, info.mHeight);
+    }
+    if(!placement)
+        return nullptr;
+    
+    // Until it's in mEntries nothing else would ever free the cell
+    std::shared_ptr<Texture> texture;
+    try
+    {
+        std::shared_ptr<C3D_Tex> target = page(placement->mPage);
+        FOX5Image image = fox.getImage(id);
+        writeTiledRect(static_cast<uint8_t*>(target->data), mPacker.pageSize(), mPacker.pageSize(),
+                       placement->mCell.mX, placement->mCell.mY, placement->mCell.mWidth, placement->mCell.mHeight,
+                       image);
+        C3D_TexFlush(target.get());
+        
+        float clip[4];
+        mPacker.clip(*placement, clip);
+        texture = std::make_shared<Texture>(target, mPacker.pageSize(), clip, info.mWidth, info.mHeight);
+        entries[id] = Entry{texture, *placement};
+    }
+    catch(...)
+    {
+        mPacker.remove(*placement);
+        throw;
+    }
+    return texture;
+}
+
+void TextureAtlas::collect()
+{
+    for(auto& file : mEntries)
+    {
+        for(auto it = file.second.begin(); it != file.second.end();)
+        {
+            if(it->second.mTexture.expired())
+            {
+                mPacker.remove(it->second.mPlacement);
+                it = file.second.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+}
+
+void TextureAtlas::evict(const std::string& fileName, uint32_t id)
+{
+    auto file = mEntries.find(fileName);
+    if(file == mEntries.end())
+        return;
+    auto it = file->second.find(id);
+    if(it == file->second.end())
+        return;
+    mPacker.remove(it->second.mPlacement);
+    file->second.erase(it);
+}
+
+void TextureAtlas::clear()
+{
+    mEntries.clear();
+    mPacker.clear();
+    mPages.clear();
+}
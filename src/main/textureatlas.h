@@ -0,0 +1,47 @@
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <citro3d.h>
+#include "atlaspacker.h"
+#include "fox5.h"
+#include "3dstexture.h"
+
+// Small FOX5 images packed onto shared GPU_RGBA8 pages, so sprites share
+// binds and don't each pay for a power of two texture. The Textures handed
+// out point at a page with mClip set to their cell.
+class TextureAtlas
+{
+public:
+    TextureAtlas(uint16_t pageSize = 256, uint32_t maxPages = 0);
+    
+    // nullptr if the image is bigger than a page or the atlas is full even
+    // after collect(), callers fall back to a Texture of its own then
+    std::shared_ptr<Texture> getFromFox(FOX5& fox, uint32_t id);
+    
+    // Frees the cells of textures nobody holds any more
+    void collect();
+    // Frees a cell right away. Anything still drawing it will show
+    // whatever gets packed there next.
+    void evict(const std::string& fileName, uint32_t id);
+    void clear();
+    
+    const AtlasPacker::Stats& stats() const { return mPacker.stats(); };
+    
+protected:
+    struct Entry
+    {
+        std::weak_ptr<Texture> mTexture;
+        AtlasPacker::Placement mPlacement;
+    };
+    
+    AtlasPacker mPacker;
+    std::vector<std::shared_ptr<C3D_Tex>> mPages;
+    std::unordered_map<std::string, std::unordered_map<uint32_t, Entry>> mEntries;
+    
+    std::shared_ptr<C3D_Tex> page(uint32_t index);
+};
+
+#endif // TEXTUREATLAS_H
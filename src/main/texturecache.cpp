@@ -1,29 +1,126 @@
 #include "texturecache.h"
 
-std::shared_ptr<Texture> TextureCache::getFromFox(FOX5& fox, uint32_t ptr)
+namespace
 {
-    auto itOuter = mTextureMap.find(fox.mFileName); // Check if 'name' exists in the outer map
-    if (itOuter != mTextureMap.end()) {
-        auto itInner = itOuter->second.find(ptr); // Check if 'ptr' exists in the inner map
-        if (itInner != itOuter->second.end()) {
-            // Entry exists
-            itInner->second.mLastUse = mCurrentAge;
-            return itInner->second.mTexture; // Return shared_ptr directly
-        }
+    // Evicting a texture someone else still holds frees nothing, and
+    // asking for it again would load a second copy
+    bool onlyCached(const TextureCache::TextureKey&, const TextureCache::TextureEntry& entry)
+    {
+        return entry.mTexture.use_count() == 1;
     }
+}
+
+size_t TextureCache::TextureKeyHash::operator()(const TextureKey& key) const
+{
+    size_t hash = std::hash<std::string>()(key.mFileName);
+    hash ^= std::hash<uint32_t>()(key.mImageID) + 0x9E3779B9 + (hash << 6) + (hash >> 2);
+    hash ^= std::hash<const TexturePalette*>()(key.mPalette) + 0x9E3779B9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+void TextureCache::setBudget(size_t bytes)
+{
+    mTextures.setBudget(bytes);
+}
+
+void TextureCache::nextFrame()
+{
+    // The GPU may still be drawing the frame just submitted, so evict
+    // while its textures are pinned and only then move on
+    trim();
+    shift();
+    mTextures.nextFrame();
     
-    FOX5Image image = fox.getImage(ptr);
+    // Decoded 8-bit images whose last remapped texture went
+    for (auto itFile = mIndexedImages.begin(); itFile != mIndexedImages.end();) {
+        std::erase_if(itFile->second, [](const auto& image) { return image.second.expired(); });
+        if (itFile->second.empty())
+            itFile = mIndexedImages.erase(itFile);
+        else
+            ++itFile;
+    }
+}
 
-    // Create a new Texture object as a shared pointer
-    std::shared_ptr<Texture> texture = std::make_shared<Texture>(image);
+void TextureCache::clearAll()
+{
+    mTextures.clear();
+    mIndexedImages.clear();
+}
 
-    // Insert the new entry into the map
-    TextureEntry newEntry;
-    newEntry.mTexture = texture;
-    newEntry.mLastUse = mCurrentAge;
+void TextureCache::shift(uint32_t since)
+{
+    mTextures.dropUnused(since, onlyCached);
+}
 
-    mTextureMap[fox.mFileName].emplace(ptr, newEntry);
+void TextureCache::trim()
+{
+    mTextures.trim(onlyCached);
+}
 
-    // Return the shared pointer
+std::shared_ptr<Texture> TextureCache::add(const TextureKey& key, TextureEntry entry)
+{
+    std::shared_ptr<Texture> texture = entry.mTexture;
+    // No trim here, update() runs while the last frame may still be drawn
+    mTextures.insert(key, std::move(entry), texture->memorySize());
     return texture;
-}
\ No newline at end of file
+}
+
+std::shared_ptr<Texture> TextureCache::getFromFox(FOX5& fox, uint32_t ptr)
+{
+    TextureKey key = {fox.mFileName, ptr};
+    if (TextureEntry* entry = mTextures.find(key))
+        return entry->mTexture;
+    
+    FOX5Image image = fox.getImage(ptr);
+    
+    auto itPolicy = mFormatPolicies.find(fox.mFileName);
+    GPUFormat format = itPolicy != mFormatPolicies.end() ? itPolicy->second.choose(ptr, image)
+                                                         : selectTextureFormat(analyzeTexture(image));
+    
+    TextureEntry entry;
+    entry.mTexture = std::make_shared<Texture>(image, format);
+    return add(key, std::move(entry));
+}
+
+std::shared_ptr<Texture> TextureCache::getFromPack(FOX5Pack& pack, uint32_t ptr)
+{
+    TextureKey key = {pack.mFileName, ptr};
+    if (TextureEntry* entry = mTextures.find(key))
+        return entry->mTexture;
+    
+    TextureEntry entry;
+    entry.mTexture = std::make_shared<Texture>(pack, ptr);
+    return add(key, std::move(entry));
+}
+
+std::shared_ptr<Texture> TextureCache::getRemapped(FOX5& fox, uint32_t ptr, std::shared_ptr<const TexturePalette> palette)
+{
+    TextureKey key = {fox.mFileName, ptr, palette.get()};
+    if (TextureEntry* entry = mTextures.find(key))
+        return entry->mTexture;
+    
+    // Only indices can be remapped, decided before anything is decoded
+    if (fox.imageInfo(ptr).mImageFormat != FOX5Image::ImageFormat::E_8BIT)
+        return getFromFox(fox, ptr);
+    
+    std::weak_ptr<FOX5Image>& cached = mIndexedImages[fox.mFileName][ptr];
+    std::shared_ptr<FOX5Image> image = cached.lock();
+    if (!image) {
+        image = std::make_shared<FOX5Image>(fox.getImage(ptr));
+        cached = image;
+    }
+    
+    TextureEntry entry;
+    entry.mTexture = std::make_shared<Texture>(*image, *palette);
+    entry.mPalette = palette;
+    entry.mIndexedImage = image;
+    return add(key, std::move(entry));
+}
+
+std::shared_ptr<Texture> TextureCache::getForChannel(FOX5& fox, const FOX5Channel& channel,
+                                                     std::shared_ptr<const TexturePalette> palette)
+{
+    if (channel.mRemap && palette)
+        return getRemapped(fox, channel.mImageID, palette);
+    return getFromFox(fox, channel.mImageID);
+}
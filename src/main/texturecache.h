@@ -4,22 +4,58 @@
 #include <string>
 #include "singleton.h"
 #include "fox5.h"
+#include "fox5pack.h"
+#include "lrucache.h"
 #include "3dstexture.h"
 
+// Textures by file and image, kept within a byte budget. Whatever was
+// asked for this frame stays, past that the least recently used textures
+// nobody else holds go first.
 class TextureCache : public Singleton<TextureCache>
 {
 public:
+    // A file's image, through mPalette when it's remapped
+    struct TextureKey
+    {
+        std::string mFileName;
+        uint32_t mImageID;
+        const TexturePalette* mPalette = nullptr;
+        
+        bool operator==(const TextureKey& other) const = default;
+    };
+    struct TextureKeyHash
+    {
+        size_t operator()(const TextureKey& key) const;
+    };
     struct TextureEntry
     {
         std::shared_ptr<Texture> mTexture;
-        uint32_t mLastUse = 0;
+        // Remapped textures keep their palette, and with it their key,
+        // alive. The decoded 8-bit image lives as long as one of them.
+        std::shared_ptr<const TexturePalette> mPalette;
+        std::shared_ptr<FOX5Image> mIndexedImage;
     };
-    std::unordered_map<std::string, std::unordered_map<uint32_t, TextureEntry>> mTextureMap;
+    using Stats = LRUCache<TextureKey, TextureEntry, TextureKeyHash>::Stats;
+    
+    // Texture formats by file name, selectTextureFormat for files without one
+    std::unordered_map<std::string, TextureFormatPolicy> mFormatPolicies;
     
+    // Textures unused for this many frames go even within budget
     uint32_t mMaxAge = 16;
-    uint32_t mCurrentAge;
     
+    // Bytes of texture memory to stay within, applied by nextFrame().
+    // Textures in use this frame are never evicted, so a busy frame can go
+    // over it.
+    void setBudget(size_t bytes);
+    size_t budget() const { return mTextures.budget(); };
+    const Stats& stats() const { return mTextures.stats(); };
+    void resetCounters() { mTextures.resetCounters(); };
+    
+    // Once a frame, after drawing. Evicts down to the budget and anything
+    // older than mMaxAge, keeping this frame's textures, then unpins them.
+    void nextFrame();
     void clearAll();
+    // Drops textures unused for more than since frames, budget or not
     void shift(uint32_t since);
     void shift()
     {
@@ -27,6 +63,22 @@ public:
     };
     
     std::shared_ptr<Texture> getFromFox(FOX5& fox, uint32_t ptr);
+    std::shared_ptr<Texture> getFromPack(FOX5Pack& pack, uint32_t ptr);
+    // ptr expanded through palette, the plain texture if it isn't 8-bit
+    std::shared_ptr<Texture> getRemapped(FOX5& fox, uint32_t ptr, std::shared_ptr<const TexturePalette> palette);
+    // The channel's image, remapped when the channel asks for it
+    std::shared_ptr<Texture> getForChannel(FOX5& fox, const FOX5Channel& channel,
+                                           std::shared_ptr<const TexturePalette> palette);
+    
+protected:
+    // Linear memory is shared with everything else, leave room for it
+    static const size_t DEFAULT_BUDGET = 16 << 20;
+    
+    LRUCache<TextureKey, TextureEntry, TextureKeyHash> mTextures{DEFAULT_BUDGET};
+    std::unordered_map<std::string, std::unordered_map<uint32_t, std::weak_ptr<FOX5Image>>> mIndexedImages;
+    
+    std::shared_ptr<Texture> add(const TextureKey& key, TextureEntry entry);
+    void trim();
 };
 
-#endif // TEXTURECACHE_H
\ No newline at end of file
+#endif // TEXTURECACHE_H